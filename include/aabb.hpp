@@ -0,0 +1,70 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "common.hpp"
+
+// AABB is an axis-aligned bounding box, the interval of each axis it spans
+class AABB {
+public:
+    Interval x, y, z;
+
+    AABB() {}   // The default AABB is empty, since intervals are empty by default
+
+    AABB(const Interval& x, const Interval& y, const Interval& z) : x(x), y(y), z(z) {}
+
+    // Box with the two points a and b as opposite corners
+    AABB(const Point3& a, const Point3& b) {
+        x = (a[0] <= b[0]) ? Interval(a[0], b[0]) : Interval(b[0], a[0]);
+        y = (a[1] <= b[1]) ? Interval(a[1], b[1]) : Interval(b[1], a[1]);
+        z = (a[2] <= b[2]) ? Interval(a[2], b[2]) : Interval(b[2], a[2]);
+    }
+
+    // Smallest box enclosing both boxes
+    AABB(const AABB& box0, const AABB& box1) {
+        x = Interval(fmin(box0.x.min, box1.x.min), fmax(box0.x.max, box1.x.max));
+        y = Interval(fmin(box0.y.min, box1.y.min), fmax(box0.y.max, box1.y.max));
+        z = Interval(fmin(box0.z.min, box1.z.min), fmax(box0.z.max, box1.z.max));
+    }
+
+    const Interval& axis_Interval(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    // Index of the axis along which the box is largest
+    int longest_Axis() const {
+        if (x.size() > y.size()) {
+            return x.size() > z.size() ? 0 : 2;
+        }
+        return y.size() > z.size() ? 1 : 2;
+    }
+
+    // Whether the ray passes through the box within ray_t (slab test)
+    // On a hit, ray_t is narrowed to the part of the ray inside the box
+    bool hit(const Ray& r, Interval& ray_t) const {
+        const Point3& ray_orig = r.origin();
+        const Vec3& ray_dir = r.direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& ax = axis_Interval(axis);
+            const double adinv = 1.0 / ray_dir[axis];
+
+            auto t0 = (ax.min - ray_orig[axis]) * adinv;
+            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "common.hpp"
+#include "camera.hpp"
+#include "platform.hpp"
+#include "scene.hpp"
+#include "tile.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A camera pose at a point in time of a camera path
+struct Camera_Keyframe {
+    double time;            // Seconds from the start of the path
+    Point3 lookfrom;
+    Point3 lookat;
+    double vfov;
+    double focus_dist;
+};
+
+// Camera_Path moves the camera through a list of keyframes. Positions follow a
+// Catmull-Rom spline, so the camera passes every keyframe without sudden turns, and
+// the field of view and focus distance change linearly between keyframes
+class Camera_Path {
+public:
+    std::vector<Camera_Keyframe> keys;  // Keyframes in increasing time order
+
+    // Reads a path file with one keyframe per line:
+    //   time  lookfrom_x lookfrom_y lookfrom_z  lookat_x lookat_y lookat_z  vfov  focus_dist
+    // Empty lines and lines starting with '#' are skipped
+    // Returns false and reports the first bad line if the file can't be used
+    bool load(const std::string& filename) {
+        std::ifstream in(filename);
+        if (!in) {
+            std::cerr << "Could not open camera path: " << filename << "\n";
+            return false;
+        }
+
+        keys.clear();
+        std::string line;
+        for (int line_number = 1; std::getline(in, line); line_number++) {
+            std::istringstream fields(line);
+            std::string first;
+            if (!(fields >> first) || first[0] == '#') {
+                continue;
+            }
+            fields.str(line);
+            fields.clear();
+
+            Camera_Keyframe key;
+            double f[3], a[3];
+            if (!(fields >> key.time >> f[0] >> f[1] >> f[2] >> a[0] >> a[1] >> a[2] >> key.vfov >> key.focus_dist)) {
+                std::cerr << filename << ":" << line_number << ": expected time, lookfrom, lookat, vfov and focus_dist\n";
+                return false;
+            }
+            if (!keys.empty() && key.time <= keys.back().time) {
+                std::cerr << filename << ":" << line_number << ": keyframe times must increase\n";
+                return false;
+            }
+            key.lookfrom = Point3(f[0], f[1], f[2]);
+            key.lookat = Point3(a[0], a[1], a[2]);
+            keys.push_back(key);
+        }
+
+        if (keys.empty()) {
+            std::cerr << "Camera path has no keyframes: " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    double start_Time() const { return keys.front().time; }
+    double end_Time() const { return keys.back().time; }
+
+    // Camera pose at 'time', held at the first and last keyframe outside the path
+    Camera_Keyframe at(double time) const {
+        if (time <= start_Time() || keys.size() == 1) {
+            return keys.front();
+        }
+        if (time >= end_Time()) {
+            return keys.back();
+        }
+
+        size_t k = 0;
+        while (keys[k + 1].time < time) {
+            k++;
+        }
+        const Camera_Keyframe& k0 = keys[k];
+        const Camera_Keyframe& k1 = keys[k + 1];
+        double dt = k1.time - k0.time;
+        double s = (time - k0.time) / dt;
+
+        Camera_Keyframe pose;
+        pose.time = time;
+        pose.lookfrom = hermite(k0.lookfrom, k1.lookfrom, tangent(k, &Camera_Keyframe::lookfrom) * dt,
+                                tangent(k + 1, &Camera_Keyframe::lookfrom) * dt, s);
+        pose.lookat = hermite(k0.lookat, k1.lookat, tangent(k, &Camera_Keyframe::lookat) * dt,
+                              tangent(k + 1, &Camera_Keyframe::lookat) * dt, s);
+        pose.vfov = k0.vfov + (k1.vfov - k0.vfov) * s;
+        pose.focus_dist = k0.focus_dist + (k1.focus_dist - k0.focus_dist) * s;
+        return pose;
+    }
+
+    // Sets the camera to its pose at 'time'. Other settings, like vup, are kept
+    void apply(double time, Camera& cam) const {
+        Camera_Keyframe pose = at(time);
+        cam.lookfrom = pose.lookfrom;
+        cam.lookat = pose.lookat;
+        cam.vfov = pose.vfov;
+        cam.focus_dist = pose.focus_dist;
+    }
+
+private:
+    // Velocity of a point of the keyframes at keyframe k, from its neighbors
+    // (one-sided at the ends of the path)
+    Vec3 tangent(size_t k, Point3 Camera_Keyframe::*point) const {
+        size_t before = (k > 0) ? k - 1 : k;
+        size_t after = (k + 1 < keys.size()) ? k + 1 : k;
+        return (keys[after].*point - keys[before].*point) / (keys[after].time - keys[before].time);
+    }
+
+    // Cubic Hermite curve from p0 to p1 with end tangents m0 and m1, at s in [0,1]
+    static Point3 hermite(const Point3& p0, const Point3& p1, const Vec3& m0, const Vec3& m1, double s) {
+        double s2 = s * s, s3 = s2 * s;
+        return (2*s3 - 3*s2 + 1) * p0 + (s3 - 2*s2 + s) * m0 + (-2*s3 + 3*s2) * p1 + (s3 - s2) * m1;
+    }
+};
+
+// Writes the frames of an animation, either to numbered PPM files or as raw 8-bit RGB
+// frames to standard output, for piping into a video encoder, e.g.
+//   ffmpeg -f rawvideo -pix_fmt rgb24 -s <width>x<height> -r <fps> -i - out.mp4
+class Frame_Writer {
+public:
+    // 'output' is a printf pattern for the frame number like "frame_%04d.ppm", or "-"
+    // for standard output
+    explicit Frame_Writer(const std::string& output) : output(output) {
+        if (to_Pipe()) {
+            set_Binary_Mode(stdout);
+        }
+    }
+
+    bool to_Pipe() const { return output == "-"; }
+
+    // Writes frame number 'index', a linear HDR image of width x height pixels
+    bool write(int index, const std::vector<Color>& image, int width, int height) {
+        bytes.resize(size_t(width) * height * 3);
+        for (size_t p = 0; p < image.size(); p++) {
+            color_To_Bytes(image[p], &bytes[p * 3]);
+        }
+
+        if (to_Pipe()) {
+            return std::fwrite(bytes.data(), 1, bytes.size(), stdout) == bytes.size() && std::fflush(stdout) == 0;
+        }
+
+        char filename[1024];
+        std::snprintf(filename, sizeof(filename), output.c_str(), index);
+        std::ofstream out(filename, std::ios::binary);
+        out << "P6\n" << width << " " << height << "\n255\n";
+        out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        return bool(out);
+    }
+
+private:
+    std::string output;
+    std::vector<unsigned char> bytes;   // Pixels of the frame being written
+};
+
+// Settings of an animation render
+struct Animation_Settings {
+    double fps = 24;                // Frames per second of path time
+    int frames_in_flight = 3;       // Frames whose tiles may be rendered at the same time
+    int num_threads = 1;            // Render threads
+};
+
+// Statistics of a finished animation render
+struct Animation_Stats {
+    int frames = 0;
+    double seconds = 0;             // Wall clock time of the whole animation
+    double busy_seconds = 0;        // Time render threads spent rendering tiles, summed
+
+    void print(std::ostream& out, int num_threads) const {
+        out << "Rendered " << frames << " frames in " << seconds << " s ("
+            << (seconds > 0 ? frames / seconds : 0) << " frames/s), render threads busy "
+            << (seconds > 0 ? 100.0 * busy_seconds / (seconds * num_threads) : 0) << "% of the time\n";
+    }
+};
+
+// Renders the frames of a camera path with the settings of 'base' and hands each one,
+// in order, to 'writer'. The scene is shared by all frames, so it is built only once
+// Render threads take tiles in frame order from a shared counter and move on to the
+// next frame while the last tiles of a frame are still being rendered, so no thread
+// idles at the end of a frame. Up to frames_in_flight frames are held in memory; the
+// calling thread writes finished frames while later ones render
+inline bool render_Animation(const Scene& scene, const Camera& base, const Camera_Path& path,
+                             const Animation_Settings& settings, Frame_Writer& writer,
+                             std::ostream& log, Animation_Stats& stats) {
+    const int frame_count = int((path.end_Time() - path.start_Time()) * settings.fps) + 1;
+    const int frames_in_flight = std::max(1, settings.frames_in_flight);
+    const int num_threads = std::max(1, settings.num_threads);
+
+    // Frames are rendered into slots, frame f into slot f % frames_in_flight
+    struct Frame_Slot {
+        Camera cam;
+        std::vector<Color> image;
+        std::atomic<int> tiles_left{0};
+        bool done = false;      // All tiles rendered and the frame not yet written
+    };
+    std::vector<std::unique_ptr<Frame_Slot>> slots;
+    for (int s = 0; s < frames_in_flight; s++) {
+        slots.push_back(std::make_unique<Frame_Slot>());
+    }
+
+    Camera sizing = base;
+    sizing.initialize();
+    const int width = sizing.image_width;
+    const int height = sizing.get_Image_Height();
+    const std::vector<Tile> tiles = make_Tiles(width, height, base.tile_size);
+    const int tile_count = int(tiles.size());
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    long long next_item = 0;        // Next (frame, tile) pair to render, frame * tile_count + tile
+    int frames_written = 0;
+    bool failed = false;
+    std::atomic<long long> busy_nanoseconds(0);
+
+    auto render_section = [&]() {
+        Trace::set_Thread_Name("render");
+        std::vector<Color> tile_pixels(size_t(base.tile_size) * base.tile_size);
+        for (;;) {
+            Frame_Slot* slot;
+            int t;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Wait for a free slot before starting a frame. Other threads take items
+                // while this one waits, so the frame is read again on every wake
+                int frame = 0;
+                changed.wait(lock, [&] {
+                    frame = int(next_item / tile_count);
+                    return failed || frame >= frame_count || frame < frames_written + frames_in_flight;
+                });
+                if (failed || frame >= frame_count) {
+                    return;
+                }
+                t = int(next_item % tile_count);
+                next_item++;
+                slot = slots[frame % frames_in_flight].get();
+                if (t == 0) {
+                    // The first tile of a frame sets up its camera; later tiles are
+                    // taken under the same lock afterwards
+                    slot->cam = base;
+                    path.apply(path.start_Time() + frame / settings.fps, slot->cam);
+                    slot->cam.initialize();
+                    slot->image.assign(size_t(width) * height, Color(0,0,0));
+                    slot->tiles_left.store(tile_count);
+                }
+            }
+
+            Trace_Scope trace_tile("tile", "render", t);
+            auto start = std::chrono::steady_clock::now();
+            const Tile& tile = tiles[t];
+            slot->cam.render_Tile(scene, tile, tile_pixels.data());
+            for (int j = tile.y0; j < tile.y1; j++) {
+                for (int i = tile.x0; i < tile.x1; i++) {
+                    slot->image[size_t(j) * width + i] = tile_pixels[(j - tile.y0) * tile.width() + (i - tile.x0)];
+                }
+            }
+            busy_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            if (--slot->tiles_left == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot->done = true;
+                changed.notify_all();
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+        threads.emplace_back(render_section);
+    }
+
+    // Write the frames in order as they finish
+    for (int frame = 0; frame < frame_count && !failed; frame++) {
+        Frame_Slot& slot = *slots[frame % frames_in_flight];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return slot.done; });
+        }
+
+        // Threads don't touch the slot again until frames_written moves past it
+        bool written;
+        {
+            Trace_Scope trace_write("frame write", "io", frame);
+            written = writer.write(frame, slot.image, width, height);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.done = false;
+        if (!written) {
+            log << "Could not write frame " << frame << "\n";
+            failed = true;
+        }
+        frames_written++;
+        changed.notify_all();
+        if (!writer.to_Pipe() || frame % 10 == 9 || frame == frame_count - 1) {
+            log << "Frame " << frame + 1 << " of " << frame_count << " written\n";
+        }
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    stats.frames = frames_written;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.busy_seconds = busy_nanoseconds.load() * 1e-9;
+    return !failed;
+}
+
+#endif
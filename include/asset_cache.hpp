@@ -0,0 +1,76 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+// Cache of preprocessed assets, such as decoded and tiled environment maps
+// Entries are keyed by a hash of the source file's contents, so an edited source gets a
+// new entry, and are kept across runs in asset_cache_directory. Entries are written under
+// a temporary name and then renamed, so processes building the same entry at the same
+// time, like render workers, never read a partly written file
+
+#include "platform.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Directory of the asset cache, relative to the working directory
+const std::string asset_cache_directory = "asset_cache";
+
+// 64-bit FNV-1a hash of a file's contents, 0 if it can't be read
+inline uint64_t hash_File(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    uint64_t hash = 0xCBF29CE484222325ull;
+    std::vector<char> buffer(1 << 20);
+    while (in) {
+        in.read(buffer.data(), std::streamsize(buffer.size()));
+        std::streamsize count = in.gcount();
+        for (std::streamsize i = 0; i < count; i++) {
+            hash = (hash ^ uint64_t(static_cast<unsigned char>(buffer[i]))) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+// Path of the cache entry of kind 'extension' for a source file, e.g.
+// asset_cache/texturify_court.jpg.0123456789abcdef.tiles
+// Returns an empty string if the source file can't be read
+inline std::string asset_Cache_Path(const std::string& source_file, const std::string& extension) {
+    uint64_t hash = hash_File(source_file);
+    if (hash == 0) {
+        return std::string();
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    std::string basename = source_file.substr(source_file.find_last_of("/\\") + 1);
+    return asset_cache_directory + "/" + basename + "." + hex + "." + extension;
+}
+
+// Builds the cache entry at cache_path with write(temp_path), unless it exists already
+// and open(cache_path) accepts it. Returns whether the entry was opened
+template <typename Write, typename Open>
+bool open_Or_Build_Asset(const std::string& cache_path, Write&& write, Open&& open) {
+    if (open(cache_path)) {
+        return true;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(asset_cache_directory, error);
+    std::string temp_path = cache_path + "." + std::to_string(current_Process_Id()) + ".tmp";
+    if (!write(temp_path)) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    if (!replace_File(temp_path, cache_path)) {
+        // Another process may hold the entry open (Windows); its copy is just as good
+        std::remove(temp_path.c_str());
+    }
+    return open(cache_path);
+}
+
+#endif
@@ -0,0 +1,705 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Headless micro-benchmarks, run with --bench <name>
+
+#include "common.hpp"
+#include "asset_cache.hpp"
+#include "camera.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "wide_bvh.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Seconds elapsed since 'start'
+inline double seconds_Since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds 'count' randomly placed spheres inside a cube of side 'extent' around the origin
+inline void add_Random_Spheres(Hittable_List& world, int count, double extent, std::mt19937& gen) {
+    std::uniform_real_distribution<double> position(-extent / 2, extent / 2);
+    std::uniform_real_distribution<double> size(0.05, 0.4);
+    auto material = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    for (int i = 0; i < count; i++) {
+        world.add(make_shared<Sphere>(Point3(position(gen), position(gen), position(gen)), size(gen), material));
+    }
+}
+
+// Compares closest-hit and any-hit queries on segments between random points of a scene
+// of random spheres, as cast for shadow and visibility tests
+inline void run_Occlusion_Benchmark() {
+    const int sphere_count = 1000;
+    const int ray_count = 200000;
+    const double extent = 20.0;
+
+    std::mt19937 gen(1);
+    Hittable_List world;
+    add_Random_Spheres(world, sphere_count, extent, gen);
+
+    // Segments from p to q, with t in [0,1] spanning the segment
+    std::uniform_real_distribution<double> position(-extent / 2, extent / 2);
+    std::vector<Ray> rays;
+    for (int i = 0; i < ray_count; i++) {
+        Point3 p(position(gen), position(gen), position(gen));
+        Point3 q(position(gen), position(gen), position(gen));
+        rays.emplace_back(p, q - p);
+    }
+    const Interval segment(0.001, 0.999);
+
+    // Run both queries twice and keep the faster run, to reduce timing noise
+    std::vector<char> closest_result(ray_count), any_result(ray_count);
+    double closest_seconds = infinity, any_seconds = infinity;
+    for (int run = 0; run < 2; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ray_count; i++) {
+            Hit_Record rec;
+            closest_result[i] = world.hit(rays[i], segment, rec);
+        }
+        closest_seconds = std::min(closest_seconds, seconds_Since(start));
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ray_count; i++) {
+            any_result[i] = world.occluded(rays[i], segment);
+        }
+        any_seconds = std::min(any_seconds, seconds_Since(start));
+    }
+
+    int occluded = 0, mismatches = 0;
+    for (int i = 0; i < ray_count; i++) {
+        occluded += any_result[i] ? 1 : 0;
+        mismatches += (any_result[i] != closest_result[i]) ? 1 : 0;
+    }
+
+    std::cout << "Occlusion benchmark: " << sphere_count << " spheres, " << ray_count << " segments, "
+              << 100.0 * occluded / ray_count << "% occluded\n"
+              << "  Closest-hit (hit):    " << ray_count / closest_seconds / 1e6 << " Mrays/s\n"
+              << "  Any-hit (occluded):   " << ray_count / any_seconds / 1e6 << " Mrays/s\n"
+              << "  Speedup: " << closest_seconds / any_seconds << "x, mismatched results: " << mismatches << "\n";
+}
+
+// Copies the image shown by a frame buffer, after a frame ended
+inline std::vector<uint32_t> displayed_Pixels(Frame_Buffer& frame) {
+    std::vector<uint32_t> pixels;
+    frame.upload_Dirty([&](int width, int height, const Tile& region, const uint32_t* data, int pitch) {
+        pixels.assign(data, data + size_t(width) * height);
+    });
+    return pixels;
+}
+
+// Root mean square difference of two displayed images, in 8-bit levels per channel
+inline double displayed_RMSE(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    double sum = 0;
+    for (size_t p = 0; p < a.size(); p++) {
+        for (int shift = 0; shift <= 16; shift += 8) {
+            double d = double((a[p] >> shift) & 0xFF) - double((b[p] >> shift) & 0xFF);
+            sum += d * d;
+        }
+    }
+    return std::sqrt(sum / (3.0 * a.size()));
+}
+
+// Renders a short real-time camera path at full rate and interleaved, tracing 1 in N pixels
+// per frame, and reports the frame times and the error of the interleaved frames against
+// the full-rate ones while the camera moves and after it stops
+inline void run_Interleave_Benchmark() {
+    Scene scene;
+    build_Default_Scene(scene);
+    scene.wait_Until_Loaded();
+
+    const int moving_frames = 8;
+    const int still_frames = 6;
+    std::atomic<bool> rendering_complete(false);
+
+    Camera reference;
+    reference.init_Real_Time_Settings();
+    std::cout << "Interleave benchmark: default scene, " << reference.image_width << " px, "
+              << reference.samples_per_pixel << " spp, depth " << reference.max_depth << ", "
+              << moving_frames << " moving then " << still_frames << " still frames\n";
+
+    for (int n : {2, 4}) {
+        Camera full, interleaved;
+        full.init_Real_Time_Settings();
+        interleaved.init_Real_Time_Settings();
+        interleaved.interleave = n;
+        Frame_Buffer full_frame, interleaved_frame;
+
+        double full_ms = 0, interleaved_ms = 0;
+        double moving_rmse = 0, still_rmse = 0, last_rmse = 0;
+        for (int f = 0; f < moving_frames + still_frames; f++) {
+            if (f < moving_frames) {
+                full.update_Camera_Position(Vec3(0.05, 0, 0));
+                interleaved.update_Camera_Position(Vec3(0.05, 0, 0));
+            }
+            full.render(scene, full_frame, rendering_complete);
+            interleaved.render(scene, interleaved_frame, rendering_complete);
+            full_ms += full.last_render_ms;
+            interleaved_ms += interleaved.last_render_ms;
+
+            double rmse = displayed_RMSE(displayed_Pixels(full_frame), displayed_Pixels(interleaved_frame));
+            (f < moving_frames ? moving_rmse : still_rmse) += rmse;
+            last_rmse = rmse;
+        }
+        moving_rmse /= moving_frames;
+        still_rmse /= still_frames;
+
+        auto psnr = [](double rmse) { return rmse > 0 ? 20 * std::log10(255 / rmse) : infinity; };
+        std::cout << "  1 in " << n << " pixels:\tframe time " << full_ms / (moving_frames + still_frames)
+                  << " ms -> " << interleaved_ms / (moving_frames + still_frames) << " ms (speedup "
+                  << full_ms / interleaved_ms << "x)\n"
+                  << "\t\t\tmoving: RMSE " << moving_rmse << ", PSNR " << psnr(moving_rmse) << " dB\n"
+                  << "\t\t\tstill: RMSE " << still_rmse << ", PSNR " << psnr(still_rmse) << " dB, last frame RMSE "
+                  << last_rmse << "\n";
+    }
+}
+
+// Root mean square difference of two linear images, and the mean difference (a - b)
+// over all channels, which shows bias that averaging many samples does not remove
+inline void image_Error(const std::vector<Color>& a, const std::vector<Color>& b, double& rmse, double& bias) {
+    double squares = 0, sum = 0;
+    for (size_t p = 0; p < a.size(); p++) {
+        for (int c = 0; c < 3; c++) {
+            double d = a[p][c] - b[p][c];
+            squares += d * d;
+            sum += d;
+        }
+    }
+    rmse = std::sqrt(squares / (3.0 * a.size()));
+    bias = sum / (3.0 * a.size());
+}
+
+// Renders the default and interior scenes with pure path tracing and with the irradiance
+// cache, and compares both against a path traced reference with many more samples.
+// The cached render runs twice to show the cost of filling the cache and of reusing it
+inline void run_Irradiance_Benchmark() {
+    const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    const int samples = 8;
+    const int reference_samples = 128;
+
+    for (const char* scene_name : {"default", "interior"}) {
+        Scene scene;
+        build_Scene(scene_name, scene);
+        scene.wait_Until_Loaded();
+
+        Camera cam;
+        cam.init_High_Quality_Settings();
+        cam.image_width = 320;
+        cam.max_depth = 8;
+
+        std::vector<Color> reference, traced, cached;
+        cam.samples_per_pixel = reference_samples;
+        cam.render_HDR(scene, reference, num_threads);
+
+        std::cout << "Irradiance cache benchmark: " << scene_name << " scene, " << cam.image_width << " px, "
+                  << samples << " spp against a " << reference_samples << " spp path traced reference\n";
+        cam.samples_per_pixel = samples;
+        auto start = std::chrono::steady_clock::now();
+        cam.render_HDR(scene, traced, num_threads);
+        double traced_seconds = seconds_Since(start);
+        double rmse, bias;
+        image_Error(traced, reference, rmse, bias);
+        std::cout << "  Path traced:\t\t" << traced_seconds << " s, RMSE " << rmse << ", bias " << bias << "\n";
+
+        cam.irradiance_cache = make_shared<Irradiance_Cache>();
+        for (const char* pass : {"cold cache", "warm cache"}) {
+            start = std::chrono::steady_clock::now();
+            cam.render_HDR(scene, cached, num_threads);
+            double cached_seconds = seconds_Since(start);
+            image_Error(cached, reference, rmse, bias);
+            std::cout << "  Cached, " << pass << ":\t" << cached_seconds << " s, RMSE " << rmse << ", bias " << bias
+                      << ", " << cam.irradiance_cache->size() << " records\n";
+        }
+    }
+}
+
+// Renders progressively with the camera's settings into 'film' until 'seconds' have passed,
+// and meanwhile calls check(elapsed_seconds) from another thread every 'interval' seconds
+// and once more when the time is up. Render threads keep adding samples while a check
+// reads the film
+template <typename Check>
+void render_Progressive_Checked(Camera& cam, const Scene& scene, Film& film, double seconds, double interval,
+                                Check&& check) {
+    Frame_Buffer frame;
+    std::atomic<bool> keep_rendering(true), rendering_complete(false);
+    auto start = std::chrono::steady_clock::now();
+    std::thread timer([&]() {
+        double next_check = interval;
+        while (!rendering_complete.load() && seconds_Since(start) < seconds) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            double elapsed = seconds_Since(start);
+            if (elapsed >= next_check) {
+                check(elapsed);
+                next_check = elapsed - std::fmod(elapsed, interval) + interval;
+            }
+        }
+        check(seconds_Since(start));
+        keep_rendering.store(false);
+    });
+    cam.render_Progressive(scene, frame, film, keep_rendering, rendering_complete);
+    timer.join();
+}
+
+// Average number of samples per pixel in a film
+inline double film_Samples(Film& film) {
+    std::vector<Color> sums;
+    std::vector<int32_t> counts;
+    film.snapshot(sums, counts);
+    double samples = 0;
+    for (int32_t count : counts) {
+        samples += count;
+    }
+    return samples / std::max<size_t>(1, counts.size());
+}
+
+// Renders progressively with the camera's settings until 'seconds' have passed and returns
+// the averaged image, and in 'samples' the average number of samples per pixel it reached
+inline std::vector<Color> render_Progressive_For(Camera& cam, const Scene& scene, double seconds, double& samples) {
+    Film film;
+    render_Progressive_Checked(cam, scene, film, seconds, seconds, [](double) {});
+
+    std::vector<Color> image(size_t(film.width()) * film.height());
+    film.tile_Average(Tile{0, 0, film.width(), film.height()}, image.data());
+    samples = film_Samples(film);
+    return image;
+}
+
+// Mean over all pixels and channels of the squared difference of 'image' and 'reference'
+// relative to the squared reference value, so dark and bright areas count alike
+// (relMSE; epsilon keeps black pixels from dominating)
+inline double relative_MSE(const std::vector<Color>& image, const std::vector<Color>& reference) {
+    const double epsilon = 0.01;
+    double sum = 0;
+    for (size_t p = 0; p < image.size(); p++) {
+        for (int c = 0; c < 3; c++) {
+            double d = image[p][c] - reference[p][c];
+            sum += d * d / (reference[p][c] * reference[p][c] + epsilon);
+        }
+    }
+    return sum / (3.0 * image.size());
+}
+
+// Reference image cache entries: "SRTREF1", width and height as int32, then the pixels
+// as doubles, row-major
+inline bool write_Reference(const std::string& filename, int width, int height, const std::vector<Color>& image) {
+    std::ofstream out(filename, std::ios::binary);
+    int32_t size[2] = {width, height};
+    out.write("SRTREF1", 7);
+    out.write(reinterpret_cast<const char*>(size), sizeof(size));
+    for (const Color& pixel : image) {
+        double channels[3] = {pixel.x(), pixel.y(), pixel.z()};
+        out.write(reinterpret_cast<const char*>(channels), sizeof(channels));
+    }
+    return bool(out);
+}
+
+// Reads a reference image of the given width written by write_Reference
+inline bool read_Reference(const std::string& filename, int width, std::vector<Color>& image) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[7];
+    int32_t size[2];
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(size), sizeof(size));
+    if (!in || std::string(magic, sizeof(magic)) != "SRTREF1" || size[0] != width || size[1] <= 0) {
+        return false;
+    }
+    image.resize(size_t(size[0]) * size[1]);
+    for (Color& pixel : image) {
+        double channels[3];
+        in.read(reinterpret_cast<char*>(channels), sizeof(channels));
+        pixel = Color(channels[0], channels[1], channels[2]);
+    }
+    return bool(in);
+}
+
+// Path traced reference of a scene with the camera's settings and 'samples' samples per
+// pixel, from the asset cache, or rendered and added to it. 'version' is part of the cache
+// entry's name, bumped after changing a scene
+inline std::vector<Color> cached_Reference(Camera& cam, const Scene& scene, const std::string& scene_name, int samples,
+                                           int version) {
+    const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    // The reference draws other random numbers than the renders, so their errors don't cancel
+    std::string cache_path = asset_cache_directory + "/reference." + scene_name + "."
+                           + std::to_string(cam.image_width) + "px." + std::to_string(samples)
+                           + "spp.depth" + std::to_string(cam.max_depth) + ".v" + std::to_string(version);
+    std::vector<Color> reference;
+    if (!read_Reference(cache_path, cam.image_width, reference)) {
+        std::cout << "Rendering the " << scene_name << " scene reference, " << samples << " spp" << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        int samples_per_pixel = cam.samples_per_pixel;
+        cam.samples_per_pixel = samples;
+        cam.seed = 1;
+        cam.render_HDR(scene, reference, num_threads);
+        cam.seed = 0;
+        cam.samples_per_pixel = samples_per_pixel;
+        int height = int(reference.size()) / cam.image_width;
+        open_Or_Build_Asset(cache_path,
+            [&](const std::string& temp_path) { return write_Reference(temp_path, cam.image_width, height, reference); },
+            [&](const std::string& path) { return read_Reference(path, cam.image_width, reference); });
+        std::cout << "  Rendered in " << seconds_Since(start) << " s, cached as " << cache_path << "\n";
+    }
+    return reference;
+}
+
+// Renders the lamp, interior and default scenes progressively for the same time with plain
+// path tracing and with path guiding, and compares both against the path traced reference of
+// the convergence benchmark. Guided samples cost more, so the comparison is at equal render
+// time. The lamp scene is lit by light only scattered rays find, which is what guiding learns
+inline void run_Guiding_Benchmark() {
+    const double seconds = 10;
+    const int reference_version = 1;
+
+    struct Benchmark_Scene {
+        const char* name;
+        int reference_samples;
+    };
+    for (const Benchmark_Scene& benchmark : {Benchmark_Scene{"lamp", 2048}, Benchmark_Scene{"interior", 2048},
+                                             Benchmark_Scene{"default", 8192}}) {
+        Scene scene;
+        build_Scene(benchmark.name, scene);
+        scene.wait_Until_Loaded();
+
+        Camera cam;
+        cam.init_High_Quality_Settings();
+        cam.image_width = 320;
+        cam.max_depth = 8;
+        std::vector<Color> reference = cached_Reference(cam, scene, benchmark.name, benchmark.reference_samples,
+                                                        reference_version);
+
+        std::cout << "Path guiding benchmark: " << benchmark.name << " scene, " << cam.image_width << " px, "
+                  << seconds << " s per render against a " << benchmark.reference_samples
+                  << " spp path traced reference\n";
+        // A sample target the renders don't reach, so they stop on time
+        cam.samples_per_pixel = 1 << 20;
+        for (bool guided : {false, true}) {
+            cam.path_guide = guided ? make_shared<Path_Guide>() : nullptr;
+            double samples, rmse, bias;
+            std::vector<Color> image = render_Progressive_For(cam, scene, seconds, samples);
+            image_Error(image, reference, rmse, bias);
+            std::cout << "  " << (guided ? "Guided:\t\t" : "Path traced:\t") << samples << " spp, RMSE " << rmse
+                      << ", relMSE " << relative_MSE(image, reference) << ", bias " << bias << "\n";
+            if (guided) {
+                std::cout << "  ";
+                cam.path_guide->print_Stats(std::cout);
+            }
+        }
+    }
+}
+
+// Renders each fixed scene progressively for a few time budgets and reports the error of
+// the image against a path traced reference with many more samples: RMSE, relMSE, and how
+// long the render took to reach a target relMSE. Unlike rays per second, this shows whether
+// a change to the sampling, the materials or the integrator makes images converge faster
+// The reference is rendered once and kept in the asset cache; delete its entry after
+// changing a scene, or bump reference_version
+inline void run_Convergence_Benchmark() {
+    const int reference_version = 1;
+    const std::vector<double> budgets = {1, 5, 30};     // Seconds, in increasing order
+    const double check_interval = 0.1;                  // Seconds between error measurements
+
+    struct Benchmark_Scene {
+        const char* name;
+        int reference_samples;          // Many more than the renders reach in the longest budget
+        double target_relative_mse;     // Reached within the budgets on a few cores
+    };
+    for (const Benchmark_Scene& benchmark : {Benchmark_Scene{"default", 8192, 1e-3},
+                                             Benchmark_Scene{"interior", 2048, 3e-2}}) {
+        Scene scene;
+        build_Scene(benchmark.name, scene);
+        scene.wait_Until_Loaded();
+
+        Camera cam;
+        cam.init_High_Quality_Settings();
+        cam.image_width = 320;
+        cam.max_depth = 8;
+
+        std::vector<Color> reference = cached_Reference(cam, scene, benchmark.name, benchmark.reference_samples,
+                                                        reference_version);
+
+        std::cout << "Convergence benchmark: " << benchmark.name << " scene, " << cam.image_width << " px, against a "
+                  << benchmark.reference_samples << " spp path traced reference\n";
+        // A sample target the render doesn't reach, so it stops on time
+        cam.samples_per_pixel = 1 << 20;
+        Film film;
+        std::vector<Color> image(reference.size());
+        size_t next_budget = 0;
+        double target_seconds = -1, target_samples = 0;
+        render_Progressive_Checked(cam, scene, film, budgets.back(), check_interval, [&](double elapsed) {
+            if (film.width() == 0 || size_t(film.width()) * film.height() != reference.size()) {
+                return;
+            }
+            film.tile_Average(Tile{0, 0, film.width(), film.height()}, image.data());
+            double relative = relative_MSE(image, reference);
+            if (target_seconds < 0 && relative <= benchmark.target_relative_mse) {
+                target_seconds = elapsed;
+                target_samples = film_Samples(film);
+            }
+            if (next_budget < budgets.size() && elapsed >= budgets[next_budget] - check_interval / 2) {
+                double rmse, bias;
+                image_Error(image, reference, rmse, bias);
+                std::cout << "  " << budgets[next_budget] << " s:\t" << film_Samples(film) << " spp, RMSE " << rmse
+                          << ", relMSE " << relative << "\n";
+                next_budget++;
+            }
+        });
+        if (target_seconds >= 0) {
+            std::cout << "  relMSE " << benchmark.target_relative_mse << " reached after " << target_seconds << " s ("
+                      << target_samples << " spp)\n";
+        }
+        else {
+            std::cout << "  relMSE " << benchmark.target_relative_mse << " not reached in " << budgets.back() << " s\n";
+        }
+    }
+}
+
+// Renders the light field scene with 10 to 100000 lights, choosing the light to sample
+// uniformly and with the light tree, and reports the noise of both at the same sample count
+// The noise is measured without a reference: two renders with other random numbers differ
+// by twice the variance of one, on average
+inline void run_Light_Benchmark() {
+    const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    cam.image_width = 160;
+    cam.samples_per_pixel = 4;
+    cam.max_depth = 3;
+    cam.defocus_angle = 0;
+    // Looking down at the ground from below the lights, so the image shows the light they
+    // cast and not the lights themselves, which are too small to be hit without aliasing
+    cam.lookfrom = Point3(0, 1.8, -2);
+    cam.lookat = Point3(0, -0.5, 2);
+    std::cout << "Light benchmark: light field scene, " << cam.image_width << " px, " << cam.samples_per_pixel
+              << " spp, depth " << cam.max_depth << ", relative MSE of one render\n";
+
+    for (int light_count : {10, 100, 1000, 10000, 100000}) {
+        Scene scene;
+        build_Light_Field_Scene(scene, light_count);
+        auto build_start = std::chrono::steady_clock::now();
+        scene.build_Light_Tree();
+        double build_seconds = seconds_Since(build_start);
+        scene.build_BVH();
+
+        double noise[2], seconds[2];
+        for (int uniform = 0; uniform < 2; uniform++) {
+            scene.light_tree->uniform_selection = (uniform == 1);
+            std::vector<Color> images[2];
+            auto start = std::chrono::steady_clock::now();
+            for (int run = 0; run < 2; run++) {
+                cam.seed = uint32_t(run + 1);
+                cam.render_HDR(scene, images[run], num_threads);
+            }
+            seconds[uniform] = seconds_Since(start) / 2;
+            noise[uniform] = relative_MSE(images[0], images[1]) / 2;
+        }
+        cam.seed = 0;
+
+        std::cout << "  " << light_count << " lights:\tuniform " << noise[1] << " (" << seconds[1] << " s), light tree "
+                  << noise[0] << " (" << seconds[0] << " s), tree built in " << build_seconds * 1000 << " ms\n";
+    }
+}
+
+// Traces the same rays through a list of objects, a binary BVH and the wide BVH over them,
+// and reports the memory of the nodes, closest-hit and any-hit speed, and the nodes each
+// closest-hit ray visits. The node bytes visited per ray stand in for the cache misses of
+// traversal, which can't be counted portably; the list is only timed on the smallest scene
+inline void run_BVH_Benchmark() {
+    const int ray_count = 200000;
+    std::cout << "BVH benchmark: " << ray_count << " rays from random points in random directions, and as many segments\n";
+
+    // Rays start at random points of 'region'; segments join two such points
+    auto run_Scene = [&](const std::string& name, const std::vector<shared_ptr<Hittable>>& objects, const AABB& region,
+                         bool time_list) {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        auto random_Point = [&]() {
+            return Point3(region.x.min + unit(gen) * region.x.size(), region.y.min + unit(gen) * region.y.size(),
+                          region.z.min + unit(gen) * region.z.size());
+        };
+        std::vector<Ray> rays, segments;
+        for (int i = 0; i < ray_count; i++) {
+            Point3 p = random_Point();
+            Vec3 d(unit(gen) * 2 - 1, unit(gen) * 2 - 1, unit(gen) * 2 - 1);
+            rays.emplace_back(p, d);
+            segments.emplace_back(p, random_Point() - p);
+        }
+        const Interval ray_t(0.001, infinity);
+        const Interval segment_t(0.001, 0.999);
+
+        Hittable_List list;
+        list.objects = objects;
+        auto build_start = std::chrono::steady_clock::now();
+        Binary_BVH binary(objects);
+        double binary_build_seconds = seconds_Since(build_start);
+        build_start = std::chrono::steady_clock::now();
+        Wide_BVH wide(objects);
+        double wide_build_seconds = seconds_Since(build_start);
+
+        // Best of two runs of each query, the closest hit distances kept for comparing
+        auto time_Queries = [&](const Hittable& hierarchy, std::vector<double>& t, double& closest_seconds, double& any_seconds) {
+            t.assign(ray_count, infinity);
+            closest_seconds = any_seconds = infinity;
+            int occluded = 0;
+            for (int run = 0; run < 2; run++) {
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < ray_count; i++) {
+                    Hit_Record rec;
+                    if (hierarchy.hit(rays[i], ray_t, rec)) {
+                        t[i] = rec.t;
+                    }
+                }
+                closest_seconds = std::min(closest_seconds, seconds_Since(start));
+
+                start = std::chrono::steady_clock::now();
+                occluded = 0;
+                for (int i = 0; i < ray_count; i++) {
+                    occluded += hierarchy.occluded(segments[i], segment_t) ? 1 : 0;
+                }
+                any_seconds = std::min(any_seconds, seconds_Since(start));
+            }
+            return occluded;
+        };
+        auto report = [&](const char* label, double closest_seconds, double any_seconds) {
+            std::cout << "    " << label << "closest " << ray_count / closest_seconds / 1e6 << " Mrays/s, any-hit "
+                      << ray_count / any_seconds / 1e6 << " Mrays/s";
+        };
+
+        std::cout << "  " << name << ", " << objects.size() << " objects:\n";
+        std::vector<double> list_t, binary_t, wide_t;
+        double closest_seconds, any_seconds;
+        if (time_list) {
+            time_Queries(list, list_t, closest_seconds, any_seconds);
+            report("List:        ", closest_seconds, any_seconds);
+            std::cout << "\n";
+        }
+
+        int binary_occluded = time_Queries(binary, binary_t, closest_seconds, any_seconds);
+        BVH_Traversal_Stats binary_stats;
+        for (int i = 0; i < ray_count; i++) {
+            Hit_Record rec;
+            binary.hit_Counted(rays[i], ray_t, rec, binary_stats);
+        }
+        double binary_nodes = double(binary_stats.nodes_visited) / binary_stats.rays;
+        report("Binary BVH:  ", closest_seconds, any_seconds);
+        std::cout << ", " << binary_nodes << " nodes (" << binary_nodes * sizeof(Binary_BVH::Node) / 1024
+                  << " KB) per ray, " << binary.node_Bytes() / 1024.0 << " KB of nodes, built in "
+                  << binary_build_seconds * 1000 << " ms\n";
+
+        int wide_occluded = time_Queries(wide, wide_t, closest_seconds, any_seconds);
+        BVH_Traversal_Stats wide_stats;
+        for (int i = 0; i < ray_count; i++) {
+            Hit_Record rec;
+            wide.hit_Counted(rays[i], ray_t, rec, wide_stats);
+        }
+        double wide_nodes = double(wide_stats.nodes_visited) / wide_stats.rays;
+        report("Wide BVH:    ", closest_seconds, any_seconds);
+        std::cout << ", " << wide_nodes << " nodes (" << wide_nodes * sizeof(Wide_BVH::Node) / 1024
+                  << " KB) per ray, " << wide.node_Bytes() / 1024.0 << " KB of nodes, built in "
+                  << wide_build_seconds * 1000 << " ms\n";
+
+        // Every structure must find the same hits
+        const std::vector<double>& reference = time_list ? list_t : binary_t;
+        int mismatches = (wide_occluded != binary_occluded) ? 1 : 0;
+        for (int i = 0; i < ray_count; i++) {
+            mismatches += (binary_t[i] != reference[i] || wide_t[i] != reference[i]) ? 1 : 0;
+        }
+        std::cout << "    " << 100.0 * wide_occluded / ray_count << "% of segments occluded, mismatched results: "
+                  << mismatches << "\n";
+    };
+
+    const double extent = 20.0;
+    const AABB cube(Interval(-extent / 2, extent / 2), Interval(-extent / 2, extent / 2), Interval(-extent / 2, extent / 2));
+    for (int sphere_count : {1000, 10000, 100000}) {
+        std::mt19937 gen(1);
+        Hittable_List world;
+        add_Random_Spheres(world, sphere_count, extent, gen);
+        run_Scene("Random spheres", world.objects, cube, sphere_count <= 1000);
+    }
+
+    // The light field scene before build_BVH, from the space between the ground and the lights
+    Scene scene;
+    build_Light_Field_Scene(scene, 10000);
+    run_Scene("Light field scene", scene.world.objects, AABB(Interval(-10, 10), Interval(-0.4, 3), Interval(-9, 11)), false);
+}
+
+// Renders the interior scene progressively for the same time with path traced caustics and
+// with caustic photons, and compares both against the path traced reference of the
+// convergence benchmark. The reference has caustic fireflies of its own, so part of the
+// error of either render is the reference's
+inline void run_Caustics_Benchmark() {
+    const double seconds = 10;
+
+    Scene scene;
+    build_Scene("interior", scene);
+    scene.wait_Until_Loaded();
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    cam.image_width = 320;
+    cam.max_depth = 8;
+    std::vector<Color> reference = cached_Reference(cam, scene, "interior", 2048, 1);
+
+    // A sample target the renders don't reach, so they stop on time
+    cam.samples_per_pixel = 1 << 20;
+    std::cout << "Caustics benchmark: interior scene, " << cam.image_width << " px, " << seconds
+              << " s per render against a 2048 spp path traced reference\n";
+    std::vector<Color> images[2];
+    double samples[2];
+    for (int photons = 0; photons < 2; photons++) {
+        cam.caustics = (photons == 1) ? make_shared<Caustic_Photons>() : nullptr;
+        images[photons] = render_Progressive_For(cam, scene, seconds, samples[photons]);
+    }
+
+    for (int photons = 0; photons < 2; photons++) {
+        double rmse, bias;
+        image_Error(images[photons], reference, rmse, bias);
+        std::cout << "  " << (photons ? "Caustic photons:\t" : "Path traced:\t\t") << samples[photons] << " spp, RMSE "
+                  << rmse << ", relMSE " << relative_MSE(images[photons], reference) << ", bias " << bias << "\n";
+    }
+    std::cout << "  ";
+    cam.caustics->print_Stats(std::cout);
+}
+
+// Runs the named benchmark, returns false if there is no such benchmark
+inline bool run_Benchmark(const std::string& name) {
+    if (name == "occlusion") {
+        run_Occlusion_Benchmark();
+    }
+    else if (name == "interleave") {
+        run_Interleave_Benchmark();
+    }
+    else if (name == "irradiance") {
+        run_Irradiance_Benchmark();
+    }
+    else if (name == "guiding") {
+        run_Guiding_Benchmark();
+    }
+    else if (name == "convergence") {
+        run_Convergence_Benchmark();
+    }
+    else if (name == "lights") {
+        run_Light_Benchmark();
+    }
+    else if (name == "bvh") {
+        run_BVH_Benchmark();
+    }
+    else if (name == "caustics") {
+        run_Caustics_Benchmark();
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -1,18 +1,26 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
-#include "..\third_party\SDL2\include\SDL.h"
 
 #include "common.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
 #include "environmentmap.hpp"
+#include "scene.hpp"
+#include "tile.hpp"
+#include "film.hpp"
+#include "frame_buffer.hpp"
+#include "interleave.hpp"
+#include "irradiance_cache.hpp"
+#include "path_guide.hpp"
+#include "photon_map.hpp"
+#include "trace.hpp"
 
 #include <atomic>
+#include <chrono>
 #include <thread>
-#include <mutex>
 #include <vector>
-#include <random>
+#include <algorithm>
 
 class Camera {
 public:
@@ -21,6 +29,22 @@ public:
     int image_width = 100;       // Rendered image width in pixel count
     int samples_per_pixel = 10;  // Count of random samples per pixel
     int max_depth = 10;          // Maximum number of ray bounces into scene
+    int tile_size = 32;          // Side length in pixels of the square tiles handed to render threads
+    int samples_per_pass = 4;    // Samples added to every pixel per pass of a progressive render
+    double last_render_ms = 0;          // Time the last call to render took
+    uint32_t seed = 0;                  // Selects an independent set of random streams for the samples,
+                                        // e.g. for a reference image uncorrelated with other renders
+    int interleave = 1;                 // render traces 1 in interleave pixels per frame and
+                                        // reconstructs the rest, 2 is a checkerboard
+    shared_ptr<Irradiance_Cache> irradiance_cache;  // Interpolates indirect light on diffuse surfaces
+                                                    // from cached samples, pure path tracing if null
+    shared_ptr<Path_Guide> path_guide;  // Learns where light comes from during progressive renders and
+                                        // scatters off diffuse surfaces towards it, off if null
+                                        // Streamed geometry is traced without guiding
+    shared_ptr<Caustic_Photons> caustics;   // Photons that glass and metal focus onto diffuse surfaces,
+                                            // gathered at the diffuse hits of paths, off if null
+                                            // Progressive renders trace new photons every pass
+                                            // Streamed geometry is traced without them
 
     double vfov = 90;                   // Vertical view angle (field of view)
     Point3 lookfrom = Point3(0,0,-1);    // Point camera is looking from
@@ -46,6 +70,17 @@ public:
         focus_dist = 3.4;
     }
 
+    // Initialize the default settings for a single high-quality render
+    void init_High_Quality_Settings() {
+        aspect_ratio = 16.0 / 9.0;
+        image_width = 800;
+        samples_per_pixel = 50;
+        max_depth = 20;
+        vfov = 45;
+        defocus_angle = 1.0;
+        focus_dist = 3.4;
+    }
+
     // Initialize custom camera settings
     void init_Custom_Settings() {
         std::string input;
@@ -64,13 +99,7 @@ public:
         
         // Use default settings
         if (input.empty()) {
-            aspect_ratio = 16.0 / 9.0;
-            image_width = 800;
-            samples_per_pixel = 50;
-            max_depth = 20;
-            vfov = 45;
-            defocus_angle = 1.0;
-            focus_dist = 3.4;
+            init_High_Quality_Settings();
         } 
         // Custom settings
         else if (input == "A") {
@@ -115,74 +144,275 @@ public:
         }
     }
 
-    void render(const Hittable& world, SDL_Surface* surface, const EnvironmentMap* envmap, std::atomic<bool>& rendering_complete) {
+    // Renders one frame into the back buffer of 'frame' and swaps it to the front when done,
+    // so the display only ever shows whole frames
+    void render(const Scene& scene, Frame_Buffer& frame, std::atomic<bool>& rendering_complete) {
+        Trace_Scope trace_frame("frame", "render");
+        auto start = std::chrono::steady_clock::now();
         initialize();
+        use_Scene_Lighting(scene);
+        frame.begin_Frame(image_width, image_height);
+        if (interleave > 1) {
+            Interleaved_Frame::View view{center, pixel00_loc, pixel_delta_u, pixel_delta_v, defocus_disk_u,
+                                         scene.envmap && scene.envmap->loaded(), samples_per_pixel, max_depth};
+            pattern_size = interleave;
+            pattern_phase = interleaved.begin_Frame(image_width, image_height, interleave, view);
+        }
 
         // Determine the number of threads to use based on hardware
         const int num_threads = std::thread::hardware_concurrency();
-        std::vector<std::thread> threads;
-        
-        // Mutex to protect access to the shared SDL surface
-        std::mutex surface_mutex;
+        prepare_Caustics(scene, num_threads);
 
-        // std::seed_seq is a class that generates a sequence of seeds from a set
-        // of initial values. Initialize it with a fixed seed
-        std::seed_seq seed{0};
-
-        // Create a vector of random number generators, one for each thread
-        std::vector<std::mt19937> generators(num_threads);
-        for (int i = 0; i < num_threads; i++) {
-            generators[i].seed(seed);
-            // Advance the generator a different amount for each thread
-            generators[i].discard(i);
-        }
-
-        // Lambda function to render a section of the image
-        auto render_section = [&](int start_row, int end_row, std::mt19937 &gen) {
-            
-            std::uniform_real_distribution<double> dist(0.0, 1.0);
-
-            for (int j = start_row; j < end_row; j++) {
-                for (int i = 0; i < image_width; i++) {
-                    Color pixel_color(0, 0, 0);
-                    // Calculate current pixel color
-                    for (int sample = 0; sample < samples_per_pixel; sample++) {
-                        Ray r = get_Ray(i, j, gen, dist);
-                        pixel_color += ray_Color(r, max_depth, world, gen, dist, envmap);
-                    }
+        render_Tiles(scene, num_threads, [&](const Tile& tile, const Color* tile_pixels) {
+            if (pattern_size > 1) {
+                interleaved.store_Tile(tile, tile_pixels);
+            }
+            else {
+                frame.draw_Tile(tile, tile_pixels);
+            }
+        });
+        if (pattern_size > 1) {
+            // The missing pixels need their neighbors in other tiles, so they are filled in
+            // once all tiles are done
+            Trace_Scope trace_reconstruct("reconstruct", "render");
+            frame.draw_Tile(Tile{0, 0, image_width, image_height}, interleaved.reconstruct().data());
+        }
+        frame.end_Frame();
+        last_render_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-                    // Convert the color to SDL format
-                    Uint32 color = SDL_MapRGB(surface->format,
-                        static_cast<Uint8>(255.999 * pixel_samples_scale * pixel_color.x()),
-                        static_cast<Uint8>(255.999 * pixel_samples_scale * pixel_color.y()),
-                        static_cast<Uint8>(255.999 * pixel_samples_scale * pixel_color.z()));
+        // Signal that rendering is complete
+        rendering_complete.store(true);
+    }
 
-                    // Lock the mutex before accessing the shared surface
-                    std::lock_guard<std::mutex> lock(surface_mutex);
-                    Uint32* pixels = (Uint32*)surface->pixels;
-                    pixels[j * image_width + i] = color;
+    // Renders the whole frame into a linear HDR image of image_width * image_height pixels,
+    // without any display. This is the single-process path used as the baseline for
+    // distributed rendering
+    void render_HDR(const Scene& scene, std::vector<Color>& image, int num_threads) {
+        initialize();
+        use_Scene_Lighting(scene);
+        prepare_Caustics(scene, num_threads);
+        image.assign(size_t(image_width) * image_height, Color(0,0,0));
+
+        render_Tiles(scene, num_threads, [&](const Tile& tile, const Color* tile_pixels) {
+            // Tiles never overlap, so threads can write their own tile without locking
+            for (int j = tile.y0; j < tile.y1; j++) {
+                for (int i = tile.x0; i < tile.x1; i++) {
+                    image[size_t(j) * image_width + i] = tile_pixels[(j - tile.y0) * tile.width() + (i - tile.x0)];
                 }
             }
+        });
+    }
+
+    // Renders the frame without keeping the image: each finished tile is passed to
+    // on_tile(tile, tile_pixels) from the thread that rendered it, and the pixels are
+    // reused for the thread's next tile once it returns. For images too large for memory
+    template <typename Tile_Callback>
+    void render_Streamed(const Scene& scene, int num_threads, Tile_Callback&& on_tile) {
+        initialize();
+        use_Scene_Lighting(scene);
+        prepare_Caustics(scene, num_threads);
+        render_Tiles(scene, num_threads, on_tile);
+    }
+
+    // Renders the frame progressively into film, adding samples_per_pass samples (one for
+    // guided renders without caustics) to every pixel per pass until each pixel has
+    // samples_per_pixel samples, and shows the running average of finished tiles in 'frame'.
+    // Samples already in the film (e.g. from a resumed checkpoint) are kept, and only the
+    // missing samples are rendered
+    // Stops early, between tiles, once keep_rendering is false
+    void render_Progressive(const Scene& scene, Frame_Buffer& frame, Film& film, const std::atomic<bool>& keep_rendering, std::atomic<bool>& rendering_complete) {
+        Trace_Scope trace_render("progressive render", "render");
+        initialize();
+        use_Scene_Lighting(scene);
+        if (film.width() != image_width || film.height() != image_height) {
+            film.reset(image_width, image_height);
+        }
+        if (frame.width() != image_width || frame.height() != image_height) {
+            frame.resize(image_width, image_height);
+        }
+
+        const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+        // Guided renders pass one sample at a time, so the first iterations of the guide are
+        // short and later samples sooner follow what it learned. With caustics, every pass
+        // also traces photons, so passes keep their size
+        const int pass_samples = (path_guide && !caustics) ? 1 : std::max(1, samples_per_pass);
+        std::vector<Tile> tiles = make_Tiles(image_width, image_height, tile_size);
+
+        // Samples each tile already has. Every pixel of a tile always receives the same samples
+        std::vector<int> start_samples;
+        int passes = 0;
+        for (const Tile& tile : tiles) {
+            int samples = film.samples_At(tile.x0, tile.y0);
+            start_samples.push_back(samples);
+            passes = std::max(passes, (samples_per_pixel - samples + pass_samples - 1) / pass_samples);
+        }
+
+        auto show_Tile = [&](const Tile& tile, std::vector<Color>& averages) {
+            film.tile_Average(tile, averages.data());
+            frame.submit_Tile(tile, averages.data());
         };
 
-        // Divide the image into sections and assign each to a thread
-        int rows_per_thread = image_height / num_threads;
-        for (int i = 0; i < num_threads; i++) {
-            int start_row = i * rows_per_thread;
-            // Ensure the last thread covers any remaining rows
-            int end_row = (i == num_threads - 1) ? image_height : (i + 1) * rows_per_thread;
-            threads.emplace_back(render_section, start_row, end_row, std::ref(generators[i]));
+        // Show what a resumed film already contains
+        std::vector<Color> averages(size_t(tile_size) * tile_size);
+        for (const Tile& tile : tiles) {
+            show_Tile(tile, averages);
         }
 
-        // Wait for all threads to complete
-        for (auto& thread : threads) {
-            thread.join();
+        // Jobs are (pass, tile) pairs in pass order. A job's sample range depends only on the
+        // pass, so threads never need to wait for the previous pass of a tile to finish
+        const int job_count = passes * int(tiles.size());
+        std::atomic<int> next_job(0);
+        int end_job = job_count;
+
+        auto render_section = [&]() {
+            Trace::set_Thread_Name("render");
+            std::vector<Color> tile_sums(size_t(tile_size) * tile_size);
+            std::vector<Color> tile_averages(size_t(tile_size) * tile_size);
+            for (int job = next_job++; job < end_job && keep_rendering.load(); job = next_job++) {
+                Trace_Scope trace_tile("tile pass", "render", job);
+                int t = job % int(tiles.size());
+                int first_sample = start_samples[t] + (job / int(tiles.size())) * pass_samples;
+                int sample_count = std::min(pass_samples, samples_per_pixel - first_sample);
+                if (sample_count <= 0) {
+                    continue;
+                }
+
+                accumulate_Tile(scene, tiles[t], first_sample, sample_count, tile_sums.data());
+                film.add_Tile(tiles[t], tile_sums.data(), sample_count);
+                show_Tile(tiles[t], tile_averages);
+            }
+        };
+
+        auto render_Jobs = [&](int first, int end) {
+            next_job.store(first);
+            end_job = end;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < num_threads; i++) {
+                threads.emplace_back(render_section);
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        };
+
+        bool photon_passes = caustics && !scene.streamed;
+        if (photon_passes) {
+            caustics->restart();
+        }
+        if (!path_guide && !photon_passes) {
+            render_Jobs(0, job_count);
+        }
+        else {
+            // Guided renders learn in iterations of 1, 1, 2, 4, ... samples. Threads finish
+            // each iteration before the guide refines what it learned
+            // Every pass gathers its own caustic photons, traced once the last pass is done
+            for (int pass = 0; pass < passes && keep_rendering.load(); ) {
+                int end_pass = path_guide ? std::min(passes, std::max(pass + 1, 2 * pass)) : passes;
+                if (photon_passes) {
+                    for (int photon_pass = pass; photon_pass < end_pass && keep_rendering.load(); photon_pass++) {
+                        trace_Caustic_Pass(scene, num_threads);
+                        render_Jobs(photon_pass * int(tiles.size()), (photon_pass + 1) * int(tiles.size()));
+                    }
+                }
+                else {
+                    render_Jobs(pass * int(tiles.size()), end_pass * int(tiles.size()));
+                }
+                if (path_guide) {
+                    Trace_Scope trace_refine("guide refine", "render");
+                    path_guide->end_Iteration();
+                }
+                pass = end_pass;
+            }
         }
 
         // Signal that rendering is complete
         rendering_complete.store(true);
     }
 
+    // Renders the pixels of a single tile into 'out', row-major with tile.width() pixels per row
+    // Each entry is the averaged linear color of the pixel's samples
+    // initialize() must have been called for the current camera settings
+    void render_Tile(const Scene& scene, const Tile& tile, Color* out) const {
+        accumulate_Tile(scene, tile, 0, samples_per_pixel, out);
+        for (int p = 0; p < tile.pixel_Count(); p++) {
+            out[p] *= pixel_samples_scale;
+        }
+    }
+
+    // Renders samples [first_sample, first_sample + sample_count) of every pixel of a tile,
+    // writing the sum of each pixel's samples into 'sums', row-major
+    // Every sample draws its random numbers from its own stream, keyed by pixel and sample
+    // index, so a pixel renders the same no matter the tile size, which thread or process
+    // renders it, or whether the render was resumed from a checkpoint in between
+    void accumulate_Tile(const Scene& scene, const Tile& tile, int first_sample, int sample_count, Color* sums) const {
+        // Streamed geometry is traced in batches, so chunk reads are shared by many rays
+        if (scene.streamed) {
+            accumulate_Tile_Batched(scene, tile, first_sample, sample_count, sums);
+            return;
+        }
+
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                Color pixel_color(0, 0, 0);
+                if (!traced_Pixel(i, j)) {
+                    *sums++ = pixel_color;
+                    continue;
+                }
+                // Calculate current pixel color
+                for (int sample = first_sample; sample < first_sample + sample_count; sample++) {
+                    Rng path = Rng::for_Sample(i, j, sample, seed);
+                    Ray r = get_Ray(i, j, path);
+                    pixel_color += ray_Color(r, max_depth, scene, path, pixel_spread);
+                }
+                *sums++ = pixel_color;
+            }
+        }
+    }
+
+    // Initialize the private camera settings from the public ones
+    // Called at the start of every render; render workers call it directly before render_Tile
+    void initialize() {
+        // Calculate image height and make sure that it's at least 1
+        image_height = int(image_width/aspect_ratio);
+        image_height = (image_height < 1) ? 1 : image_height;
+
+        pixel_samples_scale = 1.0 / samples_per_pixel;
+
+        // Every pixel is traced unless render interleaves the frame
+        pattern_size = 1;
+        pattern_phase = 0;
+
+        center = lookfrom;
+
+        // Determine viewport dimensions
+        auto theta = degrees_to_radians(vfov);
+        auto h = tan(theta/2);
+        auto viewport_height = 2 * h * focus_dist;
+        auto viewport_width = viewport_height * (double(image_width)/image_height);
+
+        // Calculate the u,v,w unit basis vectors for the camera coordinate frame
+        w = unit_Vector(lookfrom - lookat);
+        u = unit_Vector(cross(vup, w));
+        v = cross(w, u);
+
+        // Calculate the vectors across the horizontal and down the vertical viewport edges
+        auto viewport_u = viewport_width * u;       // Vector accross viewport horizontal edge
+        auto viewport_v = viewport_height * -v;     // Vector down viewport vertical edge
+
+        // Calculate hori. and vert. delta vectors from pixel to pixel
+        pixel_delta_u = viewport_u / image_width;
+        pixel_delta_v = viewport_v / image_height;
+        pixel_spread = pixel_delta_u.length() / focus_dist;
+
+        // Calculate the location of the upper left pixel
+        auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
+        pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
+
+        // Calculate the camera defocus disk basis vectors
+        auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
+        defocus_disk_u = u * defocus_radius;
+        defocus_disk_v = v * defocus_radius;
+    }
 
     int get_Image_Height() {
         return image_height;
@@ -262,103 +492,345 @@ private:
     Vec3 u, v, w;               // Camera frame basis vectors
     Vec3 defocus_disk_u;        // Defocus disk horizontal radius
     Vec3 defocus_disk_v;        // Defocus disk vertical radius
+    double pixel_spread;        // Angle in radians covered by one pixel, the footprint of camera rays
+    int pattern_size = 1;       // accumulate_Tile traces 1 in pattern_size pixels of the frame,
+    int pattern_phase = 0;      // those of this phase of the interleaved pattern
+    Interleaved_Frame interleaved;  // Earlier frames of interleaved real-time renders
+    int caustic_lighting = -1;      // Lighting the caustic photons of renders that aren't progressive were traced in
+
+    // Irradiance cache records hold until the lighting changes, which happens when the
+    // environment map replaces the placeholder sky, or until max_depth changes
+    void use_Scene_Lighting(const Scene& scene) const {
+        if (irradiance_cache) {
+            irradiance_cache->use_Lighting((scene.envmap && scene.envmap->loaded()) ? 1 : 0, max_depth);
+        }
+    }
 
-    // Initialize the private camera settings
-    void initialize() {
-        // Calculate image height and make sure that it's at least 1
-        image_height = int(image_width/aspect_ratio);
-        image_height = (image_height < 1) ? 1 : image_height;
+    // Renders that aren't progressive gather the photons of a single pass, traced again
+    // only when the lighting changes, like the irradiance cache records
+    void prepare_Caustics(const Scene& scene, int num_threads) {
+        int lighting = (scene.envmap && scene.envmap->loaded()) ? 1 : 0;
+        if (!caustics || scene.streamed || (caustics->traced() && caustic_lighting == lighting)) {
+            return;
+        }
+        caustics->restart();
+        trace_Caustic_Pass(scene, num_threads);
+        caustic_lighting = lighting;
+    }
 
-        pixel_samples_scale = 1.0 / samples_per_pixel;
+    // Traces the next pass of caustic photons, lit by the same sky as the camera rays
+    void trace_Caustic_Pass(const Scene& scene, int num_threads) {
+        caustics->trace_Pass(scene, [&](const Vec3& direction) {
+            return background(Ray(Point3(0,0,0), direction), scene, 0);
+        }, num_threads);
+    }
 
-        center = lookfrom;
+    // Whether accumulate_Tile traces pixel (i, j) in the current frame
+    bool traced_Pixel(int i, int j) const {
+        return pattern_size <= 1 || Interleaved_Frame::traced(i, j, pattern_size, pattern_phase);
+    }
 
-        // Determine viewport dimensions
-        auto theta = degrees_to_radians(vfov);
-        auto h = tan(theta/2);
-        auto viewport_height = 2 * h * focus_dist;
-        auto viewport_width = viewport_height * (double(image_width)/image_height);
+    // Dispatches the tiles of the frame to num_threads threads, which take the next
+    // unrendered tile from a shared counter until none are left
+    // on_tile(tile, tile_pixels) is called from the rendering thread once a tile is done
+    template <typename Tile_Callback>
+    void render_Tiles(const Scene& scene, int num_threads, Tile_Callback&& on_tile) const {
+        std::vector<Tile> tiles = make_Tiles(image_width, image_height, tile_size);
+        std::atomic<int> next_tile(0);
+        std::vector<std::thread> threads;
 
-        // Calculate the u,v,w unit basis vectors for the camera coordinate frame
-        w = unit_Vector(lookfrom - lookat);
-        u = unit_Vector(cross(vup, w));
-        v = cross(w, u);
+        // Lambda function run by each thread, renders tiles until there are none left
+        auto render_section = [&]() {
+            Trace::set_Thread_Name("render");
+            std::vector<Color> tile_pixels(size_t(tile_size) * tile_size);
+            for (int t = next_tile++; t < int(tiles.size()); t = next_tile++) {
+                Trace_Scope trace_tile("tile", "render", t);
+                render_Tile(scene, tiles[t], tile_pixels.data());
+                on_tile(tiles[t], tile_pixels.data());
+            }
+        };
 
-        // Calculate the vectors across the horizontal and down the vertical viewport edges
-        auto viewport_u = viewport_width * u;       // Vector accross viewport horizontal edge
-        auto viewport_v = viewport_height * -v;     // Vector down viewport vertical edge
+        num_threads = (num_threads < 1) ? 1 : num_threads;
+        for (int i = 0; i < num_threads; i++) {
+            threads.emplace_back(render_section);
+        }
 
-        // Calculate hori. and vert. delta vectors from pixel to pixel
-        pixel_delta_u = viewport_u / image_width;
-        pixel_delta_v = viewport_v / image_height;
+        // Wait for all threads to complete
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
 
-        // Calculate the location of the upper left pixel
-        auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
-        pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
+    // Cone of directions a fuzzy reflection scattered into, for rays escaping to the sky
+    struct Reflection_Lobe {
+        Vec3 center;            // Mirror direction
+        double roughness = 0;   // Width of the cone, as the material's roughness
+    };
+
+    // State of a path traced by accumulate_Tile_Batched
+    struct Path_State {
+        Ray ray;                // Next segment of the path
+        Color throughput;       // Product of the attenuations along the path so far
+        Rng path;               // Random stream of the path's sample
+        int pixel;              // Index of the pixel in the tile
+        int depth;              // Bounces left, as in ray_Color
+        double spread;          // As in ray_Color
+        double bsdf_pdf;        // As in ray_Color
+        Reflection_Lobe lobe;   // As in ray_Color, unused while its roughness is 0
+    };
+
+    // accumulate_Tile for scenes with streamed geometry
+    // Traces every path of the tile one bounce at a time, so each bounce is a single
+    // batch of rays for the streamed geometry, and so are the shadow rays of its light
+    // samples. Gives the same result as ray_Color, with the same random numbers
+    void accumulate_Tile_Batched(const Scene& scene, const Tile& tile, int first_sample, int sample_count, Color* sums) const {
+        std::vector<Path_State> paths;
+        paths.reserve(size_t(tile.pixel_Count()) * sample_count);
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                int pixel = (j - tile.y0) * tile.width() + (i - tile.x0);
+                sums[pixel] = Color(0,0,0);
+                if (!traced_Pixel(i, j)) {
+                    continue;
+                }
+                for (int sample = first_sample; sample < first_sample + sample_count; sample++) {
+                    Rng path = Rng::for_Sample(i, j, sample, seed);
+                    paths.push_back(Path_State{get_Ray(i, j, path), Color(1,1,1), path, pixel, max_depth, pixel_spread, 0,
+                                               Reflection_Lobe{}});
+                }
+            }
+        }
+        if (max_depth <= 0) {
+            return;
+        }
 
-        // Calculate the camera defocus disk basis vectors
-        auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
-        defocus_disk_u = u * defocus_radius;
-        defocus_disk_v = v * defocus_radius;
+        std::vector<Path_State> next_paths;
+        std::vector<Ray> rays, shadow_rays;
+        std::vector<double> t_max;
+        std::vector<Hit_Record> recs;
+        std::vector<char> hits, blocked;
+        std::vector<Interval> shadow_segments;
+        std::vector<std::pair<int, Color>> shadow_contributions;    // (pixel, light arriving there)
+
+        while (!paths.empty()) {
+            // Closest hits with the resident objects first, which shortens the rays
+            // traced against the streamed geometry
+            size_t n = paths.size();
+            rays.resize(n);
+            t_max.resize(n);
+            recs.resize(n);
+            hits.assign(n, 0);
+            for (size_t k = 0; k < n; k++) {
+                rays[k] = paths[k].ray;
+                hits[k] = scene.world.hit(rays[k], Interval(0.001, infinity), recs[k]);
+                t_max[k] = hits[k] ? recs[k].t : infinity;
+            }
+            scene.streamed->intersect(rays, 0.001, t_max, recs, hits);
+
+            next_paths.clear();
+            shadow_rays.clear();
+            shadow_segments.clear();
+            shadow_contributions.clear();
+            for (size_t k = 0; k < n; k++) {
+                const Path_State& state = paths[k];
+                const Ray& r = state.ray;
+                if (!hits[k]) {
+                    const Reflection_Lobe* lobe = (state.lobe.roughness > 0) ? &state.lobe : nullptr;
+                    sums[state.pixel] += state.throughput * background(r, scene, state.spread, lobe);
+                    continue;
+                }
+
+                const Hit_Record& rec = recs[k];
+                Color emitted = rec.mat->emitted(r, rec);
+                if (state.bsdf_pdf > 0 && !emitted.near_Zero()) {
+                    double light_pdf = scene.light_tree ? scene.light_tree->pdf_Value(r.origin(), r.direction()) : 0.0;
+                    emitted *= power_Heuristic(state.bsdf_pdf, light_pdf);
+                }
+                sums[state.pixel] += state.throughput * emitted;
+
+                Rng rng = state.path.for_Bounce(max_depth - state.depth + 1);
+                Ray scattered;
+                Color attenuation;
+                if (!rec.mat->scatter(r, rec, attenuation, scattered, rng)) {
+                    continue;
+                }
+
+                double scattered_spread = std::max(state.spread, rec.mat->roughness());
+                double scattered_pdf = rec.mat->scattering_Pdf(r, rec, scattered);
+
+                Light_Sample sample;
+                if (scattered_pdf > 0 && scene.light_tree
+                    && sample_Light(r, rec, attenuation, scene, rng, sample)
+                    && !scene.world.occluded(sample.ray, sample.segment)) {
+                    shadow_rays.push_back(sample.ray);
+                    shadow_segments.push_back(sample.segment);
+                    shadow_contributions.emplace_back(state.pixel, state.throughput * sample.contribution);
+                }
+
+                if (state.depth > 1) {
+                    Reflection_Lobe lobe;
+                    if (rec.mat->reflection_Lobe(r, rec, lobe.center)) {
+                        lobe.roughness = rec.mat->roughness();
+                    }
+                    next_paths.push_back(Path_State{scattered, state.throughput * attenuation, state.path,
+                                                    state.pixel, state.depth - 1, scattered_spread, scattered_pdf, lobe});
+                }
+            }
+
+            // Light samples the resident objects don't block still need the streamed geometry
+            blocked.assign(shadow_rays.size(), 0);
+            scene.streamed->occluded(shadow_rays, shadow_segments, blocked);
+            for (size_t s = 0; s < shadow_rays.size(); s++) {
+                if (!blocked[s]) {
+                    sums[shadow_contributions[s].first] += shadow_contributions[s].second;
+                }
+            }
+
+            paths.swap(next_paths);
+        }
     }
 
     // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square
-    Vec3 pixel_Sample_Square(std::mt19937 &gen, std::uniform_real_distribution<double> &dist) const {    
-        double px = -0.5 + dist(gen);
-        double py = -0.5 + dist(gen);
+    Vec3 pixel_Sample_Square(Rng& rng) const {
+        double px = -0.5 + random_double(rng);
+        double py = -0.5 + random_double(rng);
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
-    Ray get_Ray(int i, int j, std::mt19937 gen, std::uniform_real_distribution<double> &dist) const {
-        
+    // Returns the camera ray of a sample of pixel (i, j), drawn from the path's first stream
+    Ray get_Ray(int i, int j, const Rng& path) const {
+        Rng rng = path.for_Bounce(0);
+
         Point3 pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
 
-        Point3 pixel_sample = pixel_center + pixel_Sample_Square(gen, dist);
+        Point3 pixel_sample = pixel_center + pixel_Sample_Square(rng);
         
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_Disk_Sample(gen, dist);
+        auto ray_origin = (defocus_angle <= 0) ? center : defocus_Disk_Sample(rng);
         auto ray_direction = pixel_sample - ray_origin;
 
         return Ray(ray_origin, ray_direction);
     }
 
     // Returns a random point in the camera defocus disk
-    Point3 defocus_Disk_Sample(std::mt19937 &gen, std::uniform_real_distribution<double> &dist) const {    
-        auto p = random_In_Unit_Disk(gen, dist);
+    Point3 defocus_Disk_Sample(Rng& rng) const {
+        auto p = random_In_Unit_Disk(rng);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
     
+    // 'spread' is the angular width of the cone of directions this ray stands for. It grows
+    // with the roughness of every surface the path scatters off, and selects how blurred
+    // the environment map lookup of an escaping ray is
+    // 'bsdf_pdf' is the pdf with which a diffuse surface sampled this ray, or 0 if the ray
+    // comes from the camera or a specular surface. Light the ray hits is then weighted
+    // against the direct light sample taken at that surface (multiple importance sampling)
+    // 'path' is the random stream of the sample; each bounce draws from its own sub-stream
+    // 'emission', if given, receives the part of the result emitted by the surface the ray hits
+    // 'lobe', if given, is the cone a fuzzy reflection scattered the ray from. If the ray
+    // escapes, the sky light of the whole cone is read from the prefiltered environment map
+    // 'after_gather' marks rays from a diffuse hit that gathered caustic photons, through any
+    // specular surfaces since. Light they reach through a specular surface is left out, as
+    // the photons already brought it
     Color ray_Color(const Ray& r, 
                     int depth, 
-                    const Hittable& world, 
-                    std::mt19937 &gen, 
-                    std::uniform_real_distribution<double> &dist, 
-                    const EnvironmentMap* envmap = nullptr) const {
+                    const Scene& scene, 
+                    const Rng& path, 
+                    double spread = 0,
+                    double bsdf_pdf = 0,
+                    Color* emission = nullptr,
+                    const Reflection_Lobe* lobe = nullptr,
+                    bool after_gather = false) const {
         // If we've exceeded the ray bounce limit, no more light is gathered
         if (depth <= 0) {
             return Color(0,0,0);
         }
 
         Hit_Record rec;
+        // Rays straight from the diffuse hit have a BSDF pdf, rays from specular surfaces don't
+        const bool caustic_path = after_gather && bsdf_pdf <= 0;
+
+        if (scene.hit(r, Interval(0.001, infinity), rec)) {
+            Color emitted = caustic_path ? Color(0,0,0) : rec.mat->emitted(r, rec);
+            if (bsdf_pdf > 0 && !emitted.near_Zero()) {
+                double light_pdf = scene.light_tree ? scene.light_tree->pdf_Value(r.origin(), r.direction()) : 0.0;
+                emitted *= power_Heuristic(bsdf_pdf, light_pdf);
+            }
+            if (emission) {
+                *emission = emitted;
+            }
 
-        if (world.hit(r, Interval(0.001, infinity), rec)) {
+            Rng rng = path.for_Bounce(max_depth - depth + 1);
             Ray scattered;
             Color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-                return attenuation * ray_Color(scattered, depth-1, world, gen, dist, envmap);
+            if (!rec.mat->scatter(r, rec, attenuation, scattered, rng)) {
+                return emitted;
+            }
+
+            double scattered_spread = std::max(spread, rec.mat->roughness());
+            double scattered_pdf = rec.mat->scattering_Pdf(r, rec, scattered);
+
+            // Diffuse surfaces also sample a light directly (next-event estimation)
+            Color direct(0,0,0);
+            if (scattered_pdf > 0 && scene.light_tree) {
+                direct = sample_Direct_Light(r, rec, attenuation, scene, rng);
             }
+
+            // Diffuse hits also take the light focused onto them by specular surfaces from the
+            // caustic photons (Lambertian BSDF: albedo / pi)
+            bool diffuse = scattered_pdf > 0 && rec.mat->roughness() >= 1.0;
+            bool gather = diffuse && caustics && caustics->traced();
+            if (gather) {
+                direct += attenuation * caustics->irradiance(rec.p, rec.normal) / pi;
+            }
+            bool scattered_after_gather = gather || (after_gather && rec.mat->specular());
+
+            // The first diffuse hit of a path takes its indirect light from the irradiance
+            // cache. Paths that already bounced off a diffuse surface (spread 1) are traced
+            // on, which includes the hemisphere rays of new cache records
+            if (irradiance_cache && diffuse && spread < 1.0) {
+                return emitted + direct + attenuation * cached_Indirect(rec, scene, rng, gather);
+            }
+
+            // Only the first bounces are guided, later ones carry little of the pixel's light
+            if (path_guide && scattered_pdf > 0 && max_depth - depth < path_guide->guided_bounces) {
+                Guide_Region& guide = path_guide->region_At(rec.p);
+                return emitted + direct
+                    + guided_Indirect(r, rec, attenuation, guide, scattered, depth, scene, path, rng, scattered_spread,
+                                           scattered_after_gather);
+            }
+
+            Reflection_Lobe scattered_lobe;
+            bool glossy = rec.mat->reflection_Lobe(r, rec, scattered_lobe.center);
+            scattered_lobe.roughness = rec.mat->roughness();
+            return emitted + direct
+                + attenuation * ray_Color(scattered, depth-1, scene, path, scattered_spread, scattered_pdf,
+                                               nullptr, glossy ? &scattered_lobe : nullptr, scattered_after_gather);
+        }
+
+        if (caustic_path) {
             return Color(0,0,0);
         }
+        return background(r, scene, spread, lobe);
+    }
 
+    // Light arriving along a ray that escapes the scene
+    // A ray from a fuzzy reflection wide enough for the prefiltered map ('lobe') takes the
+    // average light of its cone, not of its own direction. This ignores the part of the
+    // cone that geometry blocks, but rough reflections of the sky converge in a few samples
+    static Color background(const Ray& r, const Scene& scene, double spread, const Reflection_Lobe* lobe = nullptr) {
+        const EnvironmentMap* envmap = scene.envmap.get();
         // Get the unit vector of the ray
         Vec3 unit_direction = unit_Vector(r.direction());
         // If an environment map was provided
-        if (envmap) {
+        if (envmap && envmap->loaded()) {
+            if (lobe && envmap->prefiltered_For(lobe->roughness)) {
+                return envmap->sample_Prefiltered(lobe->center, lobe->roughness);
+            }
             // Map the direction of the ray to (u, v) texture coordinates
             // Environment map images use spherical coordinates
             double u = 0.5 + atan2(unit_direction.z(), unit_direction.x()) / (2*pi);
             double v = 0.5 - asin(unit_direction.y()) / pi;
 
-            return envmap->sample(u, v);
+            return envmap->sample_Loaded(u, v, spread);
         }
         else {
             // Simple gradient
@@ -370,6 +842,132 @@ private:
             return (1.0-a)*Color(1.0, 1.0, 1.0) + a*Color(0.5,0.7,1.0);
         }
     }
+
+    // Cosine-weighted average radiance arriving at a diffuse hit, interpolated from the
+    // irradiance cache, or sampled into a new cache record if none is close enough
+    // Records are shared by hits at any depth, so their rays always get max_depth - 1
+    // bounces, as from a primary hit, whatever bounces the path took to get here
+    // 'gathered' leaves out the caustic light the hit gathered from photons
+    Color cached_Indirect(const Hit_Record& rec, const Scene& scene, Rng& rng, bool gathered) const {
+        Color radiance;
+        if (irradiance_cache->lookup(rec.p, rec.normal, radiance)) {
+            return radiance;
+        }
+        return irradiance_cache->add_Record(rec.p, rec.normal, rng, [&](const Ray& ray, double cos_theta, double& distance) {
+            Hit_Record first;
+            distance = scene.hit(ray, Interval(0.001, infinity), first) ? first.t : infinity;
+            Rng sample_path(rng.next_U64());
+            return ray_Color(ray, max_depth - 1, scene, sample_path, 1.0, cos_theta / pi, nullptr, nullptr, gathered);
+        });
+    }
+
+    // Indirect light arriving at a diffuse hit along a direction sampled from the light the
+    // path guide learned there, or from the BSDF, one or the other picked at random. The
+    // sample is weighted by the pdf of picking its direction either way, and the light it
+    // reflects, radiance times BSDF and cosine, is recorded into the guide
+    // Light emitted by the surface the ray hits is not recorded: direct light sampling
+    // finds it already, so guided directions go where only scattering finds light. That
+    // light is weighted against direct light sampling by the BSDF pdf alone, as without
+    // guiding: the weights still add up to one, and the light sample needs no guide lookup
+    // 'scattered' is the ray the material scattered, used when the BSDF is picked
+    // 'after_gather' is passed on to ray_Color for the scattered ray
+    Color guided_Indirect(const Ray& r, const Hit_Record& rec, const Color& attenuation, Guide_Region& guide,
+                          Ray scattered, int depth, const Scene& scene, const Rng& path, Rng& rng,
+                          double spread, bool after_gather) const {
+        // The guide learns directions around the surface normal, so nearby points with
+        // different normals share what they learned about the light above them
+        Vec3 t, b;
+        build_Orthonormal_Basis(rec.normal, t, b);
+        Guide_Direction direction;
+        if (guide.guiding() && rng.next_Double() < path_guide->guided_fraction) {
+            direction = guide.sampling.sample(rng);
+            const Vec3& d = direction.direction;
+            scattered = Ray(rec.p, d.x() * t + d.y() * b + d.z() * rec.normal);
+        }
+        else {
+            const Vec3& d = scattered.direction();
+            direction = Guide_Direction(Vec3(dot(d, t), dot(d, b), dot(d, rec.normal)));
+        }
+        // Guided directions below the surface carry no light
+        double surface_pdf = rec.mat->scattering_Pdf(r, rec, scattered);
+        if (surface_pdf <= 0) {
+            return Color(0,0,0);
+        }
+        double pdf = path_guide->mixed_Pdf(guide, surface_pdf, direction);
+        Color emission(0,0,0);
+        Color incoming = ray_Color(scattered, depth-1, scene, path, spread, surface_pdf, &emission, nullptr,
+                                        after_gather);
+
+        // attenuation * surface_pdf is the BSDF times the cosine term
+        guide.record(direction, attenuation * (incoming - emission) * surface_pdf, pdf);
+        return attenuation * incoming * (surface_pdf / pdf);
+    }
+
+    // Samples a direction towards the scene's lights from a diffuse hit and returns the
+    // light arriving along it, weighted against sampling the same direction from the BSDF
+    // 'attenuation' is the surface albedo returned by scatter
+    Color sample_Direct_Light(const Ray& r, const Hit_Record& rec, const Color& attenuation, const Scene& scene,
+                              Rng& rng) const {
+        Light_Sample sample;
+        if (!sample_Light(r, rec, attenuation, scene, rng, sample) || scene.occluded(sample.ray, sample.segment)) {
+            return Color(0,0,0);
+        }
+        return sample.contribution;
+    }
+
+    // A direct light sample: 'contribution' arrives along 'ray' unless something blocks 'segment'
+    struct Light_Sample {
+        Ray ray;
+        Interval segment;
+        Color contribution;
+    };
+
+    // Takes the light sample of sample_Direct_Light, leaving the visibility test to the caller
+    // Returns false if the sample carries no light
+    bool sample_Light(const Ray& r, const Hit_Record& rec, const Color& attenuation, const Scene& scene,
+                      Rng& rng, Light_Sample& sample) const {
+        // The light tree picks a light that is likely to reach the point. Its pdf below
+        // includes the chance of that choice, and of any other light along the direction
+        double choice_probability;
+        const Hittable* chosen = scene.light_tree->sample(rec.p, rng, choice_probability);
+        if (!chosen) {
+            return false;
+        }
+        const Hittable& light = *chosen;
+
+        Ray to_light(rec.p, light.random_Direction(rec.p, rng));
+        double light_pdf = scene.light_tree->pdf_Value(rec.p, to_light.direction());
+        double surface_pdf = rec.mat->scattering_Pdf(r, rec, to_light);
+        Hit_Record light_rec;
+        if (light_pdf <= 0 || surface_pdf <= 0 || !light.hit(to_light, Interval(0.001, infinity), light_rec)) {
+            return false;
+        }
+
+        // The light contributes if nothing is in the way, which only needs an any-hit query
+        // If another light is in front, that light's emission is what arrives instead
+        Interval before_light(0.001, light_rec.t * (1 - 1e-9));
+        if (scene.light_tree->occluded(to_light, before_light)) {
+            if (!scene.hit(to_light, Interval(0.001, infinity), light_rec)) {
+                return false;
+            }
+            before_light = Interval::empty;
+        }
+        Color emitted = light_rec.mat->emitted(to_light, light_rec);
+
+        // attenuation * surface_pdf is the BSDF times the cosine term
+        sample.ray = to_light;
+        sample.segment = before_light;
+        sample.contribution = power_Heuristic(light_pdf, surface_pdf) * surface_pdf / light_pdf * attenuation * emitted;
+        return true;
+    }
+
+    // Power heuristic weight of a sample taken with pdf 'f_pdf', when the same direction
+    // could also have been sampled with pdf 'g_pdf'
+    static double power_Heuristic(double f_pdf, double g_pdf) {
+        double f2 = f_pdf * f_pdf;
+        double g2 = g_pdf * g_pdf;
+        return (f2 + g2 > 0) ? f2 / (f2 + g2) : 0.0;
+    }
 };
 
 #endif
\ No newline at end of file
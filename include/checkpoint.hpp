@@ -0,0 +1,146 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "film.hpp"
+#include "frame_settings.hpp"
+#include "platform.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checkpoint file layout (host byte order):
+//   char magic[8]                      "SRTCKPT1"
+//   Frame_Settings settings            Camera settings the film was rendered with
+//   int32 width, height                Film size in pixels
+//   Color sums[width * height]         Per-pixel sample sums
+//   int32 counts[width * height]       Per-pixel sample counts
+const char checkpoint_magic[8] = {'S','R','T','C','K','P','T','1'};
+
+// Writes a checkpoint file. The file is written under a temporary name first and
+// then renamed, so a crash while writing never destroys the previous checkpoint
+inline bool save_Checkpoint(const std::string& filename, const Frame_Settings& settings, int width, int height,
+                            const std::vector<Color>& sums, const std::vector<int32_t>& counts) {
+    std::string temp_filename = filename + ".tmp";
+    {
+        std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+        int32_t size[2] = {width, height};
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        out.write(reinterpret_cast<const char*>(&settings), sizeof(settings));
+        out.write(reinterpret_cast<const char*>(size), sizeof(size));
+        out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(Color));
+        out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(int32_t));
+        if (!out) {
+            return false;
+        }
+    }
+    return replace_File(temp_filename, filename);
+}
+
+// Reads a checkpoint file into settings and film, returns false if it is missing or invalid
+inline bool load_Checkpoint(const std::string& filename, Frame_Settings& settings, Film& film) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(checkpoint_magic)];
+    int32_t size[2];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0
+        || !in.read(reinterpret_cast<char*>(&settings), sizeof(settings))
+        || !in.read(reinterpret_cast<char*>(size), sizeof(size))
+        || size[0] <= 0 || size[1] <= 0) {
+        return false;
+    }
+
+    size_t pixel_count = size_t(size[0]) * size[1];
+    std::vector<Color> sums(pixel_count);
+    std::vector<int32_t> counts(pixel_count);
+    if (!in.read(reinterpret_cast<char*>(sums.data()), pixel_count * sizeof(Color))
+        || !in.read(reinterpret_cast<char*>(counts.data()), pixel_count * sizeof(int32_t))) {
+        return false;
+    }
+
+    film.restore(size[0], size[1], std::move(sums), std::move(counts));
+    return true;
+}
+
+// Checkpointer periodically writes the film of a running render to a checkpoint file
+// from a background thread. Render threads are only held up while the film is copied,
+// never while the file is written
+class Checkpointer {
+public:
+    Checkpointer(Film& film, const std::string& filename, double interval_seconds)
+    : film(film), filename(filename), interval_seconds(interval_seconds) {}
+
+    ~Checkpointer() { stop(); }
+
+    // Starts writing checkpoints every interval for a render with the given camera settings
+    void start(const Frame_Settings& frame_settings) {
+        settings = frame_settings;
+        written_version = film.current_Version();
+        running = true;
+        thread = std::thread(&Checkpointer::run, this);
+    }
+
+    // Stops the background thread and writes a final checkpoint if the film changed
+    void stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        thread.join();
+        write();
+    }
+
+private:
+    Film& film;
+    std::string filename;
+    double interval_seconds;
+    Frame_Settings settings;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = false;
+    uint64_t written_version = 0;   // Film version of the last checkpoint written
+
+    void run() {
+        Trace::set_Thread_Name("checkpointer");
+        std::unique_lock<std::mutex> lock(mutex);
+        auto interval = std::chrono::duration<double>(interval_seconds);
+        while (running) {
+            if (wake.wait_for(lock, interval, [&] { return !running; })) {
+                break;
+            }
+            lock.unlock();
+            write();
+            lock.lock();
+        }
+    }
+
+    void write() {
+        std::vector<Color> sums;
+        std::vector<int32_t> counts;
+        uint64_t version = film.snapshot(sums, counts);
+        if (version == written_version) {
+            return;
+        }
+
+        Trace_Scope trace_write("checkpoint write", "io");
+        if (save_Checkpoint(filename, settings, film.width(), film.height(), sums, counts)) {
+            written_version = version;
+        }
+        else {
+            std::cerr << "Failed to write checkpoint: " << filename << std::endl;
+        }
+    }
+};
+
+#endif
@@ -14,6 +14,14 @@ inline double linear_To_Gamma(double linear_component) {
     return 0;
 }
 
+// Converts a linear color to gamma-corrected bytes r, g, b, as written by write_Color
+inline void color_To_Bytes(const Color& pixel_Color, unsigned char* rgb) {
+    static const Interval intensity(0.000, 0.999);
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = (unsigned char)(256 * intensity.clamp(linear_To_Gamma(pixel_Color[c])));
+    }
+}
+
 void write_Color(std::ostream& out, const Color& pixel_Color) {
     auto r = pixel_Color.x();
     auto g = pixel_Color.y();
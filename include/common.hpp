@@ -5,7 +5,8 @@
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <random>
+
+#include "rng.hpp"
 
 // C++ Std Usings
 using std::make_shared;
@@ -24,14 +25,14 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-// Returns a random real in [0,1)
-inline double random_double() {
-    return rand() / (RAND_MAX + 1.0 );
+// Returns a random real in [0,1) from the stream rng
+inline double random_double(Rng& rng) {
+    return rng.next_Double();
 }
 
-// Returns a random real in [min,max)
-inline double random_double(double min, double max) {
-    return min + (max-min)*random_double();
+// Returns a random real in [min,max) from the stream rng
+inline double random_double(Rng& rng, double min, double max) {
+    return min + (max-min)*random_double(rng);
 }
 
 // Common headers
@@ -0,0 +1,129 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "..\third_party\SDL2\include\SDL.h"
+
+#include "frame_buffer.hpp"
+
+#include <iostream>
+#include <string>
+
+// Display shows a Frame_Buffer in a resizable window through a streaming texture
+// Only the thread running the SDL event loop may use it. The image is scaled to the
+// window, keeping its aspect ratio, so neither resizing the window nor rendering at a
+// different internal resolution changes the other
+class Display {
+public:
+    ~Display() { close(); }
+
+    // Opens a window showing an image of width x height pixels, returns false on failure
+    bool open(const char* title, int width, int height) {
+        window = SDL_CreateWindow(title,
+            SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        if (!window) {
+            std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        if (!renderer) {
+            // Fall back to software rendering, e.g. on machines without a GPU driver
+            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+        }
+        if (!renderer) {
+            std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        // Smooth the image when it is scaled up from a lower internal resolution
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+        SDL_RaiseWindow(window);
+        return true;
+    }
+
+    void set_Title(const std::string& title) {
+        if (window) {
+            SDL_SetWindowTitle(window, title.c_str());
+        }
+    }
+
+    void close() {
+        if (texture) { SDL_DestroyTexture(texture); texture = nullptr; }
+        if (renderer) { SDL_DestroyRenderer(renderer); renderer = nullptr; }
+        if (window) { SDL_DestroyWindow(window); window = nullptr; }
+    }
+
+    // Redraws the window after it was resized, uncovered or restored
+    void handle_Event(const SDL_Event& e) {
+        if (e.type == SDL_WINDOWEVENT &&
+            (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED || e.window.event == SDL_WINDOWEVENT_EXPOSED
+             || e.window.event == SDL_WINDOWEVENT_RESTORED)) {
+            needs_redraw = true;
+        }
+    }
+
+    // Uploads the pixels of the frame buffer that changed and presents the window
+    // Does nothing if neither the frame buffer nor the window changed
+    void present(Frame_Buffer& frame) {
+        if (!renderer) {
+            return;
+        }
+
+        Trace_Scope trace_present("present", "display");
+
+        // The texture follows the image size, which only changes between frames
+        bool uploaded = frame.upload_Dirty([&](int width, int height, const Tile& region, const uint32_t* pixels, int pitch) {
+            if ((width != texture_width || height != texture_height) && !create_Texture(width, height)) {
+                return;
+            }
+            if (!texture) {
+                return;
+            }
+            SDL_Rect rect{region.x0, region.y0, region.width(), region.height()};
+            SDL_UpdateTexture(texture, &rect, pixels, pitch);
+        });
+        if ((!uploaded && !needs_redraw) || !texture) {
+            return;
+        }
+        needs_redraw = false;
+
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+private:
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    int texture_width = 0;
+    int texture_height = 0;
+    bool needs_redraw = true;   // Window contents were lost, e.g. by a resize
+
+    bool create_Texture(int width, int height) {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+        texture_width = width;
+        texture_height = height;
+        if (width <= 0 || height <= 0) {
+            return false;
+        }
+
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (!texture) {
+            std::cerr << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        // Scale the image to the window, letterboxed to keep its aspect ratio
+        SDL_RenderSetLogicalSize(renderer, width, height);
+        needs_redraw = true;
+        return true;
+    }
+};
+
+#endif
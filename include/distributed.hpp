@@ -0,0 +1,472 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// Multi-process tile rendering
+// A Render_Coordinator splits the frame into tiles and hands them out over TCP to
+// worker connections. Each worker process loads the scene once, opens one connection
+// per render thread, and renders tiles until the coordinator tells it to quit.
+// Tiles from dead workers are re-queued at once, tiles from slow workers are also
+// handed to the next idle worker, and whichever result arrives first is kept.
+
+#include "network.hpp"
+#include "platform.hpp"
+#include "camera.hpp"
+#include "frame_settings.hpp"
+#include "tile.hpp"
+
+#ifndef _WIN32
+    #include <sys/types.h>
+    #include <sys/wait.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Message types exchanged between the coordinator and workers
+enum Render_Message : uint32_t {
+    MSG_HELLO = 1,  // Worker -> coordinator: Worker_Hello
+    MSG_FRAME,      // Coordinator -> worker: Frame_Settings, camera for the following tiles
+    MSG_TILE,       // Coordinator -> worker: Tile_Message, a tile to render
+    MSG_RESULT,     // Worker -> coordinator: Tile_Message followed by RGB floats of the tile
+    MSG_QUIT        // Coordinator -> worker: no payload, close the connection
+};
+
+struct Worker_Hello {
+    uint32_t process_id;    // Worker process id, connections from one process share it
+};
+
+struct Tile_Message {
+    uint32_t frame_id;      // Frame the tile belongs to, stale results are discarded
+    int32_t tile_id;        // Index of the tile in make_Tiles order
+    Tile tile;              // Pixel bounds of the tile
+};
+
+// Process helpers, used to launch local worker processes
+
+#ifdef _WIN32
+using process_t = HANDLE;
+#else
+using process_t = pid_t;
+#endif
+
+// Starts program args[0] with the given arguments, returns false if it could not be started
+inline bool spawn_Process(const std::vector<std::string>& args, process_t& process) {
+#ifdef _WIN32
+    std::string command_line;
+    for (const auto& arg : args) {
+        command_line += "\"" + arg + "\" ";
+    }
+    STARTUPINFOA startup_info;
+    PROCESS_INFORMATION process_info;
+    ZeroMemory(&startup_info, sizeof(startup_info));
+    startup_info.cb = sizeof(startup_info);
+    if (!CreateProcessA(nullptr, &command_line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr,
+                        &startup_info, &process_info)) {
+        return false;
+    }
+    CloseHandle(process_info.hThread);
+    process = process_info.hProcess;
+    return true;
+#else
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        execv(argv[0], argv.data());
+        _exit(127);     // Only reached if exec failed
+    }
+    process = pid;
+    return true;
+#endif
+}
+
+// Waits for a spawned process to exit
+inline void wait_Process(process_t process) {
+#ifdef _WIN32
+    WaitForSingleObject(process, INFINITE);
+    CloseHandle(process);
+#else
+    waitpid(process, nullptr, 0);
+#endif
+}
+
+
+// Tile_Scheduler is the shared tile queue of one distributed frame
+class Tile_Scheduler {
+public:
+    explicit Tile_Scheduler(int tile_count) : done(tile_count, false), remaining(tile_count) {
+        for (int i = 0; i < tile_count; i++) {
+            pending.push_back(i);
+        }
+    }
+
+    // Blocks until a tile is available and takes it
+    // Returns false once every tile of the frame is done
+    bool next_Tile(int& tile_id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            available.wait(lock, [&] { return !pending.empty() || remaining == 0; });
+            if (remaining == 0) {
+                return false;
+            }
+            tile_id = pending.front();
+            pending.pop_front();
+            // A re-queued tile may have been finished by its original worker meanwhile
+            if (!done[tile_id]) {
+                return true;
+            }
+        }
+    }
+
+    // Marks a tile as done. Returns false if another worker already finished it
+    bool complete(int tile_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (done[tile_id]) {
+            return false;
+        }
+        done[tile_id] = true;
+        if (--remaining == 0) {
+            available.notify_all();
+        }
+        return true;
+    }
+
+    // Puts an unfinished tile back at the front of the queue for another worker
+    void requeue(int tile_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!done[tile_id]) {
+            pending.push_front(tile_id);
+            requeued++;
+            available.notify_one();
+        }
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return remaining == 0;
+    }
+
+    int requeued_Count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return requeued;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<int> pending;    // Tiles waiting for a worker, re-queued tiles go first
+    std::vector<bool> done;     // Whether each tile has been received
+    int remaining;              // Number of tiles not yet received
+    int requeued = 0;           // Number of times a tile was handed out again
+};
+
+
+class Render_Coordinator {
+public:
+    int tile_timeout_ms = 5000;     // A tile in flight this long is also handed to another worker
+    int dead_timeout_ms = 60000;    // A worker silent this long on a tile is considered dead
+
+    // Starts listening for workers on host:port. Port 0 picks a free port
+    bool listen(const std::string& host, int port) {
+        listener = Socket::listen_On(host, port);
+        return listener.valid();
+    }
+
+    int port() const {
+        return listener.local_Port();
+    }
+
+    // Starts count local worker processes of the program at exe_path, each building the
+    // named scene and rendering with threads_per_worker connections
+    bool spawn_Local_Workers(const std::string& exe_path, int count, int threads_per_worker, const std::string& scene_name) {
+        for (int i = 0; i < count; i++) {
+            process_t process;
+            if (!spawn_Process({exe_path, "--worker", "127.0.0.1", std::to_string(port()),
+                                std::to_string(threads_per_worker), "--scene", scene_name}, process)) {
+                return false;
+            }
+            processes.push_back(process);
+        }
+        return true;
+    }
+
+    // Accepts worker connections until count have said hello or timeout_ms passes
+    // Returns the number of connected workers
+    int accept_Workers(int count, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (int(connections.size()) < count) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                break;
+            }
+            Socket client = listener.accept_Connection(int(left.count()));
+            if (!client.valid()) {
+                continue;
+            }
+
+            uint32_t type;
+            std::vector<char> payload;
+            if (!client.recv_Message(type, payload) || type != MSG_HELLO || payload.size() != sizeof(Worker_Hello)) {
+                continue;
+            }
+            Worker_Hello hello;
+            std::memcpy(&hello, payload.data(), sizeof(hello));
+
+            auto connection = std::make_unique<Worker_Connection>();
+            connection->socket = std::move(client);
+            connection->process_id = hello.process_id;
+            connections.push_back(std::move(connection));
+        }
+        return int(connections.size());
+    }
+
+    // Renders one frame with the connected workers, assembling the linear HDR image of
+    // image_width * image_height pixels. Returns false if all workers were lost first
+    bool render(const Camera& cam, std::vector<Color>& image) {
+        Camera frame_cam = cam;
+        frame_cam.initialize();
+        const int image_width = frame_cam.image_width;
+        const int image_height = frame_cam.get_Image_Height();
+
+        std::vector<Tile> tiles = make_Tiles(image_width, image_height, frame_cam.tile_size);
+        Tile_Scheduler scheduler(int(tiles.size()));
+        Frame_Settings settings = Frame_Settings::from_Camera(frame_cam, ++frame_id);
+        image.assign(size_t(image_width) * image_height, Color(0,0,0));
+
+        // One thread per worker connection, each feeding its worker one tile at a time
+        std::vector<std::thread> threads;
+        for (auto& connection : connections) {
+            if (connection->alive) {
+                threads.emplace_back(&Render_Coordinator::serve_Connection, this, connection.get(),
+                    std::cref(settings), std::cref(tiles), std::ref(scheduler), std::ref(image), image_width);
+            }
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        requeued_tiles += scheduler.requeued_Count();
+        return scheduler.finished();
+    }
+
+    // Tells all workers to quit and waits for spawned worker processes to exit
+    void shutdown() {
+        for (auto& connection : connections) {
+            if (connection->alive) {
+                connection->socket.send_Message(MSG_QUIT, nullptr, 0);
+            }
+            connection->socket.close();
+        }
+        connections.clear();
+        for (auto process : processes) {
+            wait_Process(process);
+        }
+        processes.clear();
+        listener.close();
+    }
+
+    // Prints tiles rendered by each worker process, re-queued tiles and lost connections
+    void print_Stats(std::ostream& out) const {
+        std::map<uint32_t, std::pair<int, int>> per_process;    // pid -> (connections, tiles)
+        int lost = 0;
+        for (const auto& connection : connections) {
+            per_process[connection->process_id].first++;
+            per_process[connection->process_id].second += connection->tiles_rendered;
+            lost += connection->alive ? 0 : 1;
+        }
+        for (const auto& entry : per_process) {
+            out << "  Worker " << entry.first << ": " << entry.second.first << " connections, "
+                << entry.second.second << " tiles\n";
+        }
+        out << "  Re-queued tiles: " << requeued_tiles << "\n"
+            << "  Lost connections: " << lost << "\n";
+    }
+
+private:
+    struct Worker_Connection {
+        Socket socket;
+        uint32_t process_id = 0;
+        bool alive = true;          // False once the connection failed or timed out
+        int tiles_rendered = 0;     // Tiles whose result from this worker was kept
+    };
+
+    Socket listener;
+    std::vector<std::unique_ptr<Worker_Connection>> connections;
+    std::vector<process_t> processes;
+    uint32_t frame_id = 0;
+    int requeued_tiles = 0;
+
+    // Feeds tiles to a single worker connection until the frame is done or the worker is lost
+    void serve_Connection(Worker_Connection* connection, const Frame_Settings& settings,
+                          const std::vector<Tile>& tiles, Tile_Scheduler& scheduler,
+                          std::vector<Color>& image, int image_width) {
+        const int poll_ms = 50;
+        std::vector<char> payload;
+        uint32_t type;
+
+        if (!connection->socket.send_Message(MSG_FRAME, &settings, sizeof(settings))) {
+            connection->alive = false;
+            return;
+        }
+
+        int tile_id;
+        while (scheduler.next_Tile(tile_id)) {
+            Tile_Message request{settings.frame_id, tile_id, tiles[tile_id]};
+            if (!connection->socket.send_Message(MSG_TILE, &request, sizeof(request))) {
+                scheduler.requeue(tile_id);
+                connection->alive = false;
+                return;
+            }
+
+            // Wait for this tile's result, discarding stale results from earlier frames
+            auto sent_time = std::chrono::steady_clock::now();
+            bool handed_out_again = false;
+            while (true) {
+                if (!connection->socket.wait_Readable(poll_ms)) {
+                    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - sent_time).count();
+
+                    if (waited > dead_timeout_ms) {
+                        scheduler.requeue(tile_id);
+                        connection->alive = false;
+                        connection->socket.close();
+                        return;
+                    }
+                    if (!handed_out_again && waited > tile_timeout_ms) {
+                        scheduler.requeue(tile_id);
+                        handed_out_again = true;
+                    }
+                    // Another worker finished the frame, the late result is discarded next frame
+                    if (handed_out_again && scheduler.finished()) {
+                        return;
+                    }
+                    continue;
+                }
+
+                if (!connection->socket.recv_Message(type, payload)) {
+                    scheduler.requeue(tile_id);
+                    connection->alive = false;
+                    return;
+                }
+                if (type != MSG_RESULT || payload.size() < sizeof(Tile_Message)) {
+                    continue;
+                }
+
+                // Each connection has one tile out at a time, so the results of this frame
+                // from its worker are for that tile; anything else comes from a broken worker
+                Tile_Message result;
+                std::memcpy(&result, payload.data(), sizeof(result));
+                if (result.frame_id != settings.frame_id || result.tile_id != tile_id) {
+                    continue;
+                }
+
+                const Tile& tile = tiles[tile_id];
+                if (payload.size() != sizeof(Tile_Message) + sizeof(float) * 3 * tile.pixel_Count()) {
+                    continue;
+                }
+                // Only the first result of a tile is kept, so tiles are written by one thread
+                if (scheduler.complete(tile_id)) {
+                    const float* rgb = reinterpret_cast<const float*>(payload.data() + sizeof(Tile_Message));
+                    for (int j = tile.y0; j < tile.y1; j++) {
+                        for (int i = tile.x0; i < tile.x1; i++, rgb += 3) {
+                            image[size_t(j) * image_width + i] = Color(rgb[0], rgb[1], rgb[2]);
+                        }
+                    }
+                    connection->tiles_rendered++;
+                }
+                break;
+            }
+        }
+    }
+};
+
+
+class Render_Worker {
+public:
+    // Connects num_threads connections to the coordinator at host:port and renders the
+    // tiles it sends on each of them until told to quit. The scene is shared by all
+    // connections and stays loaded for every tile and frame
+    static void run(const std::string& host, int port, int num_threads, const Scene& scene) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < num_threads; i++) {
+            threads.emplace_back(serve, host, port, std::cref(scene));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    static void serve(const std::string& host, int port, const Scene& scene) {
+        Socket socket = Socket::connect_To(host, port);
+        if (!socket.valid()) {
+            std::cerr << "Worker could not connect to " << host << ":" << port << "\n";
+            return;
+        }
+
+        Worker_Hello hello{current_Process_Id()};
+        if (!socket.send_Message(MSG_HELLO, &hello, sizeof(hello))) {
+            return;
+        }
+
+        Camera cam;
+        uint32_t frame_id = 0;
+        uint32_t type;
+        std::vector<char> payload;
+        std::vector<Color> tile_pixels;
+        std::vector<char> result;
+
+        while (socket.recv_Message(type, payload)) {
+            if (type == MSG_QUIT) {
+                return;
+            }
+            if (type == MSG_FRAME && payload.size() == sizeof(Frame_Settings)) {
+                Frame_Settings settings;
+                std::memcpy(&settings, payload.data(), sizeof(settings));
+                settings.apply_To(cam);
+                cam.initialize();
+                frame_id = settings.frame_id;
+            }
+            else if (type == MSG_TILE && payload.size() == sizeof(Tile_Message)) {
+                Tile_Message request;
+                std::memcpy(&request, payload.data(), sizeof(request));
+                if (request.frame_id != frame_id) {
+                    continue;
+                }
+
+                const Tile& tile = request.tile;
+                tile_pixels.resize(tile.pixel_Count());
+                cam.render_Tile(scene, tile, tile_pixels.data());
+
+                // Result is the tile message followed by the HDR pixels as floats
+                result.resize(sizeof(Tile_Message) + sizeof(float) * 3 * tile.pixel_Count());
+                std::memcpy(result.data(), &request, sizeof(request));
+                float* rgb = reinterpret_cast<float*>(result.data() + sizeof(Tile_Message));
+                for (const Color& c : tile_pixels) {
+                    *rgb++ = float(c.x());
+                    *rgb++ = float(c.y());
+                    *rgb++ = float(c.z());
+                }
+                if (!socket.send_Message(MSG_RESULT, result.data(), result.size())) {
+                    return;
+                }
+            }
+        }
+    }
+};
+
+#endif
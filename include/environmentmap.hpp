@@ -1,54 +1,192 @@
+#ifndef ENVIRONMENTMAP_H
+#define ENVIRONMENTMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <string>
 #include <iostream>
+#include <thread>
 
 #include "color.hpp"
+#include "asset_cache.hpp"
+#include "prefiltered_environment.hpp"
+#include "texture_cache.hpp"
+#include "trace.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "..\third_party\stb_image\stb_image.h"
 
 class EnvironmentMap{
 public:
-    int width;              // EnvMap image width
-    int height;             // EnvMap image height
-    int channels;           // Number of channels (R,G,B, +- A)
-    unsigned char* data;    // Image data
-
-    // Constructor, load in the image file as the environment map
-    // File should be .jpg format
-    EnvironmentMap(const std::string& filename) {
-        data = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-        if (!data){
-            std::cout << "Failed to load environment map: " << filename << std::endl;
-        }
+    int width = 0;          // EnvMap image width
+    int height = 0;         // EnvMap image height
+    int channels = 0;       // Number of channels in the image file (R,G,B, +- A)
+    Tiled_Texture texture;  // Mipmapped image, read through per-thread tile caches
+    Prefiltered_Environment prefiltered;    // Image blurred by fuzzy reflection lobes, empty if it failed to build
+
+    // Memory budget of each render thread's tile cache
+    static const size_t cache_budget_bytes = size_t(8) << 20;
+
+    // Constructor, starts loading the image file as the environment map on a background
+    // thread, so rendering can start right away. Renders use a gradient sky until loaded()
+    // File should be .jpg format, or .hdr for high dynamic range maps
+    // The decoded image is converted into a tiled mip pyramid that is kept in the asset
+    // cache, so later runs skip decoding, and only the cached tiles stay in memory
+    EnvironmentMap(const std::string& filename) : filename(filename) {
+        loader = std::thread(&EnvironmentMap::load, this);
     }
 
-    // Deconstructor
     ~EnvironmentMap() {
-        stbi_image_free(data);
+        wait_Until_Loaded();
+    }
+
+    EnvironmentMap(const EnvironmentMap&) = delete;
+    EnvironmentMap& operator=(const EnvironmentMap&) = delete;
+
+    // Waits until the background load finished, returns whether the image was loaded
+    // Renders that must be reproducible, like headless and distributed renders, wait
+    // so that no part of the image uses the placeholder sky
+    bool wait_Until_Loaded() {
+        std::lock_guard<std::mutex> lock(loader_mutex);
+        if (loader.joinable()) {
+            loader.join();
+        }
+        return loaded();
     }
 
+    // Whether the background load finished, successfully or not
+    bool load_Finished() const { return finished.load(std::memory_order_acquire); }
+
+    // Whether the image was loaded. Until then, width, height and texture must not be used
+    bool loaded() const { return ready.load(std::memory_order_acquire); }
+
     // Sample the environment map given texture coordinates (u, v)
-    Color sample(double u, double v) const {
-        if (!data) {
+    // footprint is the angular width in radians of the cone of directions the lookup
+    // stands for, and selects the mip level. 0 samples the full resolution image
+    Color sample(double u, double v, double footprint = 0) const {
+        if (!loaded()) {
             std::cout << "black\n";
             return Color(0, 0, 0);  // Return black if no image is loaded
         }
+        return sample_Loaded(u, v, footprint);
+    }
 
-        // Map (u, v) to pixel coordinates
-        int i = static_cast<int>(u * width);
-        int j = static_cast<int>(v * height);
+    // sample without checking that the image was loaded, for callers that checked
+    // loaded() already
+    Color sample_Loaded(double u, double v, double footprint = 0) const {
+        // The image spans 2*pi radians horizontally, so a footprint covers
+        // footprint * width / (2*pi) texels of the full resolution image
+        double texels = footprint * width / (2*pi);
+        double lod = (texels > 1) ? std::log2(texels) : 0;
 
-        // Clamp coordinates to image bounds
-        if (i < 0) { i = 0; }
-        if (i >= width) { i = width - 1; }
-        if (j < 0) { j = 0; }
-        if (j >= height) { j = height - 1; }
+        return texture.sample(u, v, lod);
+    }
+
+    // Whether a fuzzy reflection of the given roughness that escapes to the sky can read
+    // the prefiltered image, for callers that checked loaded() already
+    bool prefiltered_For(double roughness) const {
+        return prefiltered.loaded() && roughness >= Prefiltered_Environment::min_Roughness();
+    }
 
-        // Calculate pixel color of image given index
-        int index = (i + width*j) * channels;
-        double r = data[index] / 255.999;
-        double g = data[index + 1] / 255.999;
-        double b = data[index + 2] / 255.999;
+    // Average light of the reflection lobe of the given roughness around 'direction'
+    // Only valid if prefiltered_For(roughness)
+    Color sample_Prefiltered(const Vec3& direction, double roughness) const {
+        return prefiltered.sample(direction, roughness);
+    }
 
-        return Color(r, g, b);
+    // Memory held by the image: tiles in the thread caches and the prefiltered levels
+    size_t memory_Bytes() const {
+        return loaded() ? texture.stats().resident_bytes + prefiltered.memory_Bytes() : 0;
+    }
+
+    // Prints the tile cache hit rate and the memory held by the tile caches
+    void print_Cache_Stats(std::ostream& out) const {
+        if (!loaded()) {
+            out << "Environment map cache: not loaded\n";
+            return;
+        }
+        Texture_Cache_Stats stats = texture.stats();
+        out << "Environment map cache: " << 100.0 * stats.hit_Rate() << "% hits ("
+            << stats.hits << " hits, " << stats.misses << " misses), "
+            << stats.resident_bytes / double(1 << 20) << " MB resident in " << stats.caches << " thread caches, "
+            << texture.stored_Bytes() / double(1 << 20) << " MB of " << texture.level_Count() << " mip levels on disk\n";
+    }
+
+private:
+    std::string filename;
+    std::thread loader;
+    std::mutex loader_mutex;
+    std::atomic<bool> ready{false};     // The image was loaded
+    std::atomic<bool> finished{false};  // The load finished, successfully or not
+
+    // Background load: opens the cached tiles of the image, decoding and tiling the
+    // image into the cache first if this version of the file was never loaded before
+    void load() {
+        Trace::set_Thread_Name("envmap loader");
+        Trace_Scope trace_load("envmap load", "assets");
+        auto start = std::chrono::steady_clock::now();
+        bool decoded = false;
+        std::string cache_path = asset_Cache_Path(filename, "tiles");
+
+        bool opened = !cache_path.empty() && open_Or_Build_Asset(cache_path,
+            [&](const std::string& temp_path) {
+                decoded = true;
+                bool written = false;
+                if (stbi_is_hdr(filename.c_str())) {
+                    float* data = stbi_loadf(filename.c_str(), &width, &height, &channels, 3);
+                    if (data) {
+                        written = Tiled_Texture::write_File(temp_path, width, height, nullptr, data);
+                        stbi_image_free(data);
+                    }
+                }
+                else {
+                    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channels, 3);
+                    if (data) {
+                        written = Tiled_Texture::write_File(temp_path, width, height, data, nullptr);
+                        stbi_image_free(data);
+                    }
+                }
+                return written;
+            },
+            [&](const std::string& path) { return texture.open(path, cache_budget_bytes); });
+
+        if (!opened) {
+            std::cout << "Failed to load environment map: " << filename << std::endl;
+            finished.store(true, std::memory_order_release);
+            return;
+        }
+
+        width = texture.width();
+        height = texture.height();
+        load_Prefiltered();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Environment map ready in " << seconds << " s ("
+                  << (decoded ? "decoded into the asset cache" : "from the asset cache") << ")" << std::endl;
+        ready.store(true, std::memory_order_release);
+        finished.store(true, std::memory_order_release);
+    }
+
+    // Opens the cached prefiltered image, building it from the loaded image first if this
+    // version of the file was never prefiltered before. Without it, fuzzy reflections
+    // sample the image directly
+    void load_Prefiltered() {
+        Trace_Scope trace_prefilter("envmap prefilter", "assets");
+        std::string cache_path = asset_Cache_Path(filename, "prefilter");
+        bool opened = !cache_path.empty() && open_Or_Build_Asset(cache_path,
+            [&](const std::string& temp_path) {
+                int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+                prefiltered.build([&](double u, double v, double footprint) {
+                    return sample_Loaded(u, v, footprint);
+                }, num_threads);
+                return prefiltered.write_File(temp_path);
+            },
+            [&](const std::string& path) { return prefiltered.read_File(path); });
+        if (!opened) {
+            prefiltered = Prefiltered_Environment();
+            std::cout << "Failed to prefilter environment map: " << filename << std::endl;
+        }
     }
 };
+
+#endif
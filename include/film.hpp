@@ -0,0 +1,97 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "common.hpp"
+#include "tile.hpp"
+#include "trace.hpp"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Film is the HDR accumulation buffer of a progressive render
+// It keeps the sum of all samples and the sample count of every pixel, so more
+// samples can be added at any time, including after resuming from a checkpoint
+class Film {
+public:
+    int width() const { return film_width; }
+    int height() const { return film_height; }
+
+    // Clears the film and resizes it to width x height pixels with no samples
+    void reset(int width, int height) {
+        std::lock_guard<std::mutex> lock(mutex);
+        film_width = width;
+        film_height = height;
+        sums.assign(size_t(width) * height, Color(0,0,0));
+        sample_counts.assign(size_t(width) * height, 0);
+        version++;
+    }
+
+    // Adds the per-pixel sample sums of a tile, each pixel having received 'samples' more samples
+    void add_Tile(const Tile& tile, const Color* tile_sums, int samples) {
+        auto lock = lock_Traced(mutex, "film lock");
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                size_t index = size_t(j) * film_width + i;
+                sums[index] += *tile_sums++;
+                sample_counts[index] += samples;
+            }
+        }
+        version++;
+    }
+
+    // Number of samples accumulated so far at pixel (i, j)
+    int samples_At(int i, int j) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sample_counts[size_t(j) * film_width + i];
+    }
+
+    // Writes the averaged color of every pixel of the tile to 'out', row-major
+    // Pixels without samples are black
+    void tile_Average(const Tile& tile, Color* out) {
+        auto lock = lock_Traced(mutex, "film lock");
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                size_t index = size_t(j) * film_width + i;
+                int count = sample_counts[index];
+                *out++ = (count > 0) ? sums[index] / count : Color(0,0,0);
+            }
+        }
+    }
+
+    // Copies the film contents. Only holds the lock for the copy, so a checkpoint
+    // can be written from the copy while render threads keep adding samples
+    // Returns the film version of the copy
+    uint64_t snapshot(std::vector<Color>& sums_out, std::vector<int32_t>& counts_out) {
+        auto lock = lock_Traced(mutex, "film lock");
+        sums_out = sums;
+        counts_out = sample_counts;
+        return version;
+    }
+
+    // Replaces the film contents, e.g. with the contents of a checkpoint
+    void restore(int width, int height, std::vector<Color> sums_in, std::vector<int32_t> counts_in) {
+        std::lock_guard<std::mutex> lock(mutex);
+        film_width = width;
+        film_height = height;
+        sums = std::move(sums_in);
+        sample_counts = std::move(counts_in);
+        version++;
+    }
+
+    // Incremented on every change, used to skip writing unchanged checkpoints
+    uint64_t current_Version() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return version;
+    }
+
+private:
+    std::mutex mutex;
+    int film_width = 0;
+    int film_height = 0;
+    std::vector<Color> sums;                // Sum of the linear colors of all samples of each pixel
+    std::vector<int32_t> sample_counts;     // Number of samples accumulated in each pixel
+    uint64_t version = 0;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include "common.hpp"
+#include "tile.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Frame_Buffer holds the displayed 8-bit image, kept apart from any SDL object so
+// render threads never touch the window. The display thread uploads the region that
+// changed since its last upload
+// Two ways of drawing are supported:
+//   submit_Tile                Puts a finished tile straight into the front buffer,
+//                              for progressive renders that should show every tile
+//   begin_Frame + draw_Tile    Draws into the back buffer and swaps it to the front
+//   + end_Frame                once the whole frame is done, so frames never mix. Each
+//                              frame may have a different size
+class Frame_Buffer {
+public:
+    // Size of the front buffer, only for the thread drawing into the buffer
+    int width() const { return buffer_width; }
+    int height() const { return buffer_height; }
+
+    // Resizes both buffers to width x height black pixels
+    // Must not be called while render threads are drawing
+    void resize(int width, int height) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer_width = back_width = width;
+        buffer_height = back_height = height;
+        front.assign(size_t(width) * height, pack_Pixel(Color(0,0,0)));
+        back.assign(size_t(width) * height, pack_Pixel(Color(0,0,0)));
+        dirty = Tile{0, 0, width, height};
+    }
+
+    // Writes a tile of linear colors, row-major, into the front buffer
+    void submit_Tile(const Tile& tile, const Color* colors) {
+        auto lock = lock_Traced(mutex, "frame buffer lock");
+        write_Tile(front, buffer_width, tile, colors);
+        add_Dirty(tile);
+    }
+
+    // Sizes the back buffer for a frame of width x height pixels
+    // The front buffer keeps showing the last frame until end_Frame, so the frame
+    // size can change between frames without showing a black image
+    void begin_Frame(int width, int height) {
+        if (back_width != width || back_height != height) {
+            back_width = width;
+            back_height = height;
+            back.assign(size_t(width) * height, pack_Pixel(Color(0,0,0)));
+        }
+    }
+
+    // Writes a tile of linear colors, row-major, into the back buffer
+    // Tiles never overlap, so threads draw their own tiles without locking
+    void draw_Tile(const Tile& tile, const Color* colors) {
+        write_Tile(back, back_width, tile, colors);
+    }
+
+    // Swaps the back buffer, holding a whole new frame, to the front
+    void end_Frame() {
+        auto lock = lock_Traced(mutex, "frame buffer lock");
+        std::swap(front, back);
+        std::swap(buffer_width, back_width);
+        std::swap(buffer_height, back_height);
+        dirty = Tile{0, 0, buffer_width, buffer_height};
+    }
+
+    // Calls upload(width, height, region, pixels, pitch) with the front buffer size, the
+    // region changed since the last call, pixels pointing at its upper left pixel and pitch
+    // the bytes per buffer row. The whole buffer is changed whenever its size changed
+    // Returns false without calling upload if nothing changed
+    // Render threads wait while upload runs, so it should only copy the pixels
+    template <typename Upload>
+    bool upload_Dirty(Upload&& upload) {
+        auto lock = lock_Traced(mutex, "frame buffer lock");
+        if (dirty.pixel_Count() <= 0) {
+            return false;
+        }
+        upload(buffer_width, buffer_height, dirty, front.data() + size_t(dirty.y0) * buffer_width + dirty.x0, buffer_width * int(sizeof(uint32_t)));
+        dirty = Tile{0, 0, 0, 0};
+        return true;
+    }
+
+    // Converts a linear color to a 32-bit ARGB pixel
+    static uint32_t pack_Pixel(const Color& pixel_color) {
+        static const Interval intensity(0.000, 0.999);
+        uint32_t r = uint32_t(256 * intensity.clamp(pixel_color.x()));
+        uint32_t g = uint32_t(256 * intensity.clamp(pixel_color.y()));
+        uint32_t b = uint32_t(256 * intensity.clamp(pixel_color.z()));
+        return 0xFF000000u | (r << 16) | (g << 8) | b;
+    }
+
+private:
+    std::mutex mutex;
+    int buffer_width = 0;
+    int buffer_height = 0;
+    int back_width = 0;
+    int back_height = 0;
+    std::vector<uint32_t> front;    // Pixels the display shows
+    std::vector<uint32_t> back;     // Frame being drawn by draw_Tile
+    Tile dirty{0, 0, 0, 0};         // Bounds of the front buffer pixels changed since the last upload
+
+    static void write_Tile(std::vector<uint32_t>& pixels, int width, const Tile& tile, const Color* colors) {
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                pixels[size_t(j) * width + i] = pack_Pixel(*colors++);
+            }
+        }
+    }
+
+    void add_Dirty(const Tile& tile) {
+        if (dirty.pixel_Count() <= 0) {
+            dirty = tile;
+            return;
+        }
+        dirty.x0 = std::min(dirty.x0, tile.x0);
+        dirty.y0 = std::min(dirty.y0, tile.y0);
+        dirty.x1 = std::max(dirty.x1, tile.x1);
+        dirty.y1 = std::max(dirty.y1, tile.y1);
+    }
+};
+
+#endif
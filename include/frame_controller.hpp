@@ -0,0 +1,113 @@
+#ifndef FRAME_CONTROLLER_H
+#define FRAME_CONTROLLER_H
+
+#include "camera.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+// Frame_Time_Controller adjusts the real-time render settings between frames to hold
+// a target frame time. Frames are rendered at an internal resolution that the display
+// scales up to the window, so a slow host trades sharpness for frame rate and a fast
+// host gets more resolution, bounces and samples
+// Settings are lowered in the order samples, bounces, resolution and raised in the
+// opposite order, since resolution matters most while moving the camera
+class Frame_Time_Controller {
+public:
+    double target_ms = 16;      // Frame time to hold, 0 keeps the settings fixed
+    int output_width = 800;     // Width of the window the frames are scaled up to
+
+    double min_scale = 0.25;    // Smallest internal resolution, as a fraction of output_width
+    int min_samples = 1;
+    int max_samples = 16;
+    int min_depth = 3;          // Below 3 bounces important reflections disappear
+    int max_depth = 8;
+
+    // Takes the camera's current settings as the starting point
+    void start(const Camera& cam) {
+        scale = std::clamp(double(cam.image_width) / output_width, min_scale, 1.0);
+        smoothed_ms = 0;
+        frames = 0;
+    }
+
+    // Records the time the last frame took and changes the camera settings for the next
+    // one if the frame time is off target. Returns true if the settings changed
+    // Must only be called between renders
+    bool frame_Done(double frame_ms, Camera& cam) {
+        last_ms = frame_ms;
+        if (target_ms <= 0) {
+            return false;
+        }
+
+        // Average a few frames so a single slow frame does not change the settings
+        smoothed_ms = (frames == 0) ? frame_ms : 0.7 * smoothed_ms + 0.3 * frame_ms;
+        if (++frames < settle_frames) {
+            return false;
+        }
+        const double ratio = smoothed_ms / target_ms;
+
+        bool changed = false;
+        if (ratio > 1.1) {
+            if (cam.samples_per_pixel > min_samples) {
+                cam.samples_per_pixel = std::max(min_samples, std::min(cam.samples_per_pixel - 1, int(cam.samples_per_pixel / ratio)));
+                changed = true;
+            }
+            else if (cam.max_depth > min_depth) {
+                cam.max_depth--;
+                changed = true;
+            }
+            else if (scale > min_scale) {
+                // The cost grows with the pixel count, the square of the scale
+                scale = std::max(min_scale, scale / std::sqrt(ratio));
+                changed = true;
+            }
+        }
+        else if (ratio < 0.7) {
+            if (scale < 1.0) {
+                // Grow by at most a quarter per step so the frame time does not overshoot
+                scale = std::min({1.0, scale / std::sqrt(ratio), scale * 1.25});
+                changed = true;
+            }
+            else if (cam.max_depth < max_depth) {
+                cam.max_depth++;
+                changed = true;
+            }
+            else if (cam.samples_per_pixel < max_samples) {
+                cam.samples_per_pixel++;
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            // Round to multiples of 8 pixels so the resolution does not change by single pixels
+            cam.image_width = std::max(8, int(scale * output_width) / 8 * 8);
+            // The average belongs to the old settings, start over with the new ones
+            frames = 0;
+        }
+        return changed;
+    }
+
+    // Short description of the current settings, e.g. for the window title
+    std::string status(const Camera& cam) const {
+        std::ostringstream out;
+        out.precision(3);
+        out << cam.image_width << "x" << int(cam.image_width / cam.aspect_ratio)
+            << ", " << cam.samples_per_pixel << " spp, depth " << cam.max_depth
+            << ", " << last_ms << " ms";
+        if (target_ms > 0) {
+            out << " (target " << target_ms << " ms)";
+        }
+        return out.str();
+    }
+
+private:
+    double scale = 1.0;         // Internal resolution as a fraction of output_width
+    double smoothed_ms = 0;     // Running average of the frame time since the settings changed
+    int frames = 0;             // Frames rendered since the settings changed
+    static constexpr int settle_frames = 3;    // Frames averaged before changing the settings again
+    double last_ms = 0;         // Time of the last frame
+};
+
+#endif
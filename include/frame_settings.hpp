@@ -0,0 +1,58 @@
+#ifndef FRAME_SETTINGS_H
+#define FRAME_SETTINGS_H
+
+#include "camera.hpp"
+
+#include <cstdint>
+
+// Public camera settings of one frame, in a fixed binary layout
+// Sent to render workers and stored in checkpoint files
+struct Frame_Settings {
+    uint32_t frame_id;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t tile_size;
+    double aspect_ratio;
+    double vfov;
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double defocus_angle;
+    double focus_dist;
+
+    static Frame_Settings from_Camera(const Camera& cam, uint32_t frame_id) {
+        Frame_Settings s;
+        s.frame_id = frame_id;
+        s.image_width = cam.image_width;
+        s.samples_per_pixel = cam.samples_per_pixel;
+        s.max_depth = cam.max_depth;
+        s.tile_size = cam.tile_size;
+        s.aspect_ratio = cam.aspect_ratio;
+        s.vfov = cam.vfov;
+        for (int i = 0; i < 3; i++) {
+            s.lookfrom[i] = cam.lookfrom[i];
+            s.lookat[i] = cam.lookat[i];
+            s.vup[i] = cam.vup[i];
+        }
+        s.defocus_angle = cam.defocus_angle;
+        s.focus_dist = cam.focus_dist;
+        return s;
+    }
+
+    void apply_To(Camera& cam) const {
+        cam.image_width = image_width;
+        cam.samples_per_pixel = samples_per_pixel;
+        cam.max_depth = max_depth;
+        cam.tile_size = tile_size;
+        cam.aspect_ratio = aspect_ratio;
+        cam.vfov = vfov;
+        cam.lookfrom = Point3(lookfrom[0], lookfrom[1], lookfrom[2]);
+        cam.lookat = Point3(lookat[0], lookat[1], lookat[2]);
+        cam.vup = Vec3(vup[0], vup[1], vup[2]);
+        cam.defocus_angle = defocus_angle;
+        cam.focus_dist = focus_dist;
+    }
+};
+
+#endif
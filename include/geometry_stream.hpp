@@ -0,0 +1,544 @@
+#ifndef GEOMETRY_STREAM_H
+#define GEOMETRY_STREAM_H
+
+// Out-of-core geometry for scenes larger than memory
+// Spheres are split into spatially coherent chunks that are stored in a file together
+// with a bounding volume tree over the chunks. Only the tree stays in memory; chunks are
+// read by a background loader when rays reach their bounds, and the least recently used
+// chunks are dropped again once a memory budget is exceeded. Rays are traced in batches
+// that are grouped by chunk, so every chunk read serves all the rays of a batch that
+// need it, and rays waiting for a chunk are deferred while resident chunks are traced.
+// A resident chunk is a Wide_BVH over its spheres, built as it is read
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "sphere.hpp"
+#include "trace.hpp"
+#include "wide_bvh.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Geometry chunk file layout (host byte order):
+//   char magic[8]                      "SRTGEOM1"
+//   int32 node_count, chunk_count
+//   Chunk_Node nodes[node_count]       Bounding volume tree over the chunks, root first
+//   Chunk_Info chunks[chunk_count]     Where each chunk's spheres are in the file
+//   Sphere_Record spheres[]            Spheres, each chunk's spheres stored together
+const char geometry_magic[8] = {'S','R','T','G','E','O','M','1'};
+
+// Sphere as stored in a geometry chunk file
+struct Sphere_Record {
+    double center[3];
+    double radius;
+    int32_t material;       // Index into the material table of the streamed geometry
+    int32_t padding;
+};
+
+// Node of the bounding volume tree over the chunks
+struct Chunk_Node {
+    double min[3];          // Bounds of every sphere below the node
+    double max[3];
+    int32_t left, right;    // Child nodes of inner nodes
+    int32_t chunk;          // Chunk of leaf nodes, -1 for inner nodes
+    int32_t padding;
+
+    AABB bounds() const { return AABB(Point3(min[0], min[1], min[2]), Point3(max[0], max[1], max[2])); }
+};
+
+struct Chunk_Info {
+    uint64_t offset;        // Byte offset of the chunk's first sphere in the file
+    uint32_t count;         // Number of spheres in the chunk
+    int32_t node;           // Leaf node holding the chunk's bounds
+};
+
+// Counters of a streamed geometry, summed over all threads
+struct Geometry_Stream_Stats {
+    int chunk_count = 0;                // Chunks in the file
+    uint64_t file_bytes = 0;            // Bytes of spheres in the file
+    uint64_t chunk_loads = 0;           // Chunks read from the file
+    uint64_t bytes_read = 0;            // Bytes of spheres read from the file
+    uint64_t evictions = 0;             // Chunks dropped to stay within the budget
+    uint64_t chunk_visits = 0;          // Batches of rays traced against a chunk
+    uint64_t ray_chunk_visits = 0;      // Rays traced against a chunk
+    double stall_seconds = 0;           // Time render threads waited for chunks to load
+    size_t resident_bytes = 0;          // Memory held by resident chunks
+    size_t peak_resident_bytes = 0;
+};
+
+// Writes spheres to a geometry chunk file of chunks of at most chunk_size spheres
+// Chunks are built by splitting the spheres at the median along the longest axis of
+// their centers until they are small enough, so every chunk covers a compact region
+// Reorders 'spheres'
+inline bool write_Geometry_Chunks(const std::string& filename, std::vector<Sphere_Record>& spheres, int chunk_size) {
+    std::vector<Chunk_Node> nodes;
+    std::vector<Chunk_Info> chunks;
+    std::vector<std::pair<size_t, size_t>> chunk_ranges;    // Sphere range of each chunk
+
+    auto sphere_Bounds = [&](size_t begin, size_t end, AABB& bounds, AABB& centers) {
+        for (size_t s = begin; s < end; s++) {
+            const Sphere_Record& sphere = spheres[s];
+            Point3 center(sphere.center[0], sphere.center[1], sphere.center[2]);
+            Vec3 extent(sphere.radius, sphere.radius, sphere.radius);
+            bounds = AABB(bounds, AABB(center - extent, center + extent));
+            centers = AABB(centers, AABB(center, center));
+        }
+    };
+
+    // Builds the node for spheres [begin, end) and returns its index
+    auto build = [&](auto& self, size_t begin, size_t end) -> int32_t {
+        AABB bounds, centers;
+        sphere_Bounds(begin, end, bounds, centers);
+
+        int32_t index = int32_t(nodes.size());
+        nodes.push_back(Chunk_Node{
+            {bounds.x.min, bounds.y.min, bounds.z.min}, {bounds.x.max, bounds.y.max, bounds.z.max}, -1, -1, -1, 0});
+
+        if (end - begin <= size_t(chunk_size)) {
+            nodes[index].chunk = int32_t(chunks.size());
+            chunks.push_back(Chunk_Info{0, uint32_t(end - begin), index});
+            chunk_ranges.emplace_back(begin, end);
+            return index;
+        }
+
+        int axis = centers.longest_Axis();
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element(spheres.begin() + begin, spheres.begin() + middle, spheres.begin() + end,
+            [axis](const Sphere_Record& a, const Sphere_Record& b) { return a.center[axis] < b.center[axis]; });
+
+        int32_t left = self(self, begin, middle);
+        int32_t right = self(self, middle, end);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    };
+    if (!spheres.empty()) {
+        build(build, 0, spheres.size());
+    }
+
+    // Spheres are written chunk by chunk, which is the order the tree was built in
+    uint64_t offset = sizeof(geometry_magic) + 2 * sizeof(int32_t)
+                    + nodes.size() * sizeof(Chunk_Node) + chunks.size() * sizeof(Chunk_Info);
+    for (size_t c = 0; c < chunks.size(); c++) {
+        chunks[c].offset = offset + chunk_ranges[c].first * sizeof(Sphere_Record);
+    }
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    int32_t counts[2] = {int32_t(nodes.size()), int32_t(chunks.size())};
+    out.write(geometry_magic, sizeof(geometry_magic));
+    out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+    out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Chunk_Node));
+    out.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(Chunk_Info));
+    out.write(reinterpret_cast<const char*>(spheres.data()), spheres.size() * sizeof(Sphere_Record));
+    return bool(out);
+}
+
+// Streamed_Geometry is the spheres of a geometry chunk file, paged in on demand
+// Use the batch queries (intersect, occluded with vectors) where possible; the single
+// ray queries of the Hittable interface wait for every chunk they need on their own
+class Streamed_Geometry : public Hittable {
+public:
+    Streamed_Geometry() {}
+    ~Streamed_Geometry() { close(); }
+
+    Streamed_Geometry(const Streamed_Geometry&) = delete;
+    Streamed_Geometry& operator=(const Streamed_Geometry&) = delete;
+
+    // Writes spheres to a new chunk file and opens it. The file is removed again when
+    // the geometry is closed
+    bool build(const std::string& filename, std::vector<Sphere_Record>& spheres, int chunk_size,
+               std::vector<shared_ptr<Material>> materials, size_t budget_bytes) {
+        if (!write_Geometry_Chunks(filename, spheres, chunk_size)) {
+            std::remove(filename.c_str());
+            return false;
+        }
+        owns_file = true;
+        return open(filename, std::move(materials), budget_bytes);
+    }
+
+    // Opens a geometry chunk file, keeping at most budget_bytes of chunks in memory
+    // 'materials' is the material table the spheres' material indices refer to
+    // Fails on files whose tree or chunk table is inconsistent or points past the end
+    bool open(const std::string& filename, std::vector<shared_ptr<Material>> materials, size_t budget_bytes) {
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        uint64_t file_size = in ? uint64_t(in.tellg()) : 0;
+        in.seekg(0);
+        char magic[sizeof(geometry_magic)];
+        int32_t counts[2];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, geometry_magic, sizeof(magic)) != 0
+            || !in.read(reinterpret_cast<char*>(counts), sizeof(counts))
+            || counts[0] < 0 || counts[1] < 0
+            || uint64_t(counts[0]) * sizeof(Chunk_Node) + uint64_t(counts[1]) * sizeof(Chunk_Info) > file_size) {
+            std::cerr << "Not a geometry chunk file: " << filename << "\n";
+            return false;
+        }
+        nodes.resize(counts[0]);
+        chunks.resize(counts[1]);
+        if (!in.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(Chunk_Node))
+            || !in.read(reinterpret_cast<char*>(chunks.data()), chunks.size() * sizeof(Chunk_Info))
+            || !valid_Tables(uint64_t(in.tellg()), file_size)) {
+            std::cerr << "Corrupt geometry chunk file: " << filename << "\n";
+            nodes.clear();
+            chunks.clear();
+            return false;
+        }
+
+        this->filename = filename;
+        this->materials = std::move(materials);
+        this->budget_bytes = budget_bytes;
+        slots.assign(chunks.size(), Slot());
+        loader = std::thread(&Streamed_Geometry::load_Chunks, this);
+        return true;
+    }
+
+    void close() {
+        if (loader.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake_loader.notify_all();
+            loader.join();
+        }
+        slots.clear();
+        if (owns_file) {
+            std::remove(filename.c_str());
+            owns_file = false;
+        }
+    }
+
+    bool loaded() const { return !nodes.empty(); }
+
+    // Closest hits of a batch of rays with the spheres. t_max[k] is the far end of ray k,
+    // for example the closest hit already found with other objects. Rays that hit a sphere
+    // before it get hits[k] set, recs[k] filled and t_max[k] lowered to the hit
+    void intersect(const std::vector<Ray>& rays, double t_min, std::vector<double>& t_max,
+                   std::vector<Hit_Record>& recs, std::vector<char>& hits) const {
+        auto segment = [&](int k) { return Interval(t_min, t_max[k]); };
+        trace_Batch(rays, segment, [&](const Chunk_Info& chunk, const Hittable& spheres, int k) {
+            Interval ray_t = segment(k);
+            if (nodes[chunk.node].bounds().hit(rays[k], ray_t)
+                && spheres.hit(rays[k], Interval(t_min, t_max[k]), recs[k])) {
+                hits[k] = 1;
+                t_max[k] = recs[k].t;
+            }
+        });
+    }
+
+    // Any-hit queries of a batch of shadow rays, each over its own segment
+    // Sets results[k] for rays blocked by a sphere; rays already set are skipped
+    void occluded(const std::vector<Ray>& rays, const std::vector<Interval>& segments, std::vector<char>& results) const {
+        auto segment = [&](int k) { return results[k] ? Interval::empty : segments[k]; };
+        trace_Batch(rays, segment, [&](const Chunk_Info& chunk, const Hittable& spheres, int k) {
+            if (!results[k] && spheres.occluded(rays[k], segments[k])) {
+                results[k] = 1;
+            }
+        });
+    }
+
+    bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const override {
+        std::vector<double> t_max{ray_t.max};
+        std::vector<Hit_Record> recs(1);
+        std::vector<char> hits(1, 0);
+        intersect(std::vector<Ray>{r}, ray_t.min, t_max, recs, hits);
+        if (hits[0]) {
+            rec = recs[0];
+        }
+        return hits[0] != 0;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        std::vector<char> results(1, 0);
+        occluded(std::vector<Ray>{r}, std::vector<Interval>{ray_t}, results);
+        return results[0] != 0;
+    }
+
+    Geometry_Stream_Stats stats() const {
+        Geometry_Stream_Stats stats;
+        stats.chunk_count = int(chunks.size());
+        for (const Chunk_Info& chunk : chunks) {
+            stats.file_bytes += uint64_t(chunk.count) * sizeof(Sphere_Record);
+        }
+        stats.chunk_loads = chunk_loads.load();
+        stats.bytes_read = bytes_read.load();
+        stats.evictions = evictions.load();
+        stats.chunk_visits = chunk_visits.load();
+        stats.ray_chunk_visits = ray_chunk_visits.load();
+        stats.stall_seconds = stall_nanoseconds.load() * 1e-9;
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.resident_bytes = resident_bytes;
+        stats.peak_resident_bytes = peak_resident_bytes;
+        return stats;
+    }
+
+    void print_Stats(std::ostream& out) const {
+        Geometry_Stream_Stats s = stats();
+        out << "Streamed geometry: " << s.chunk_count << " chunks, " << s.file_bytes / 1048576.0 << " MB on disk, "
+            << s.peak_resident_bytes / 1048576.0 << " MB peak resident of " << budget_bytes / 1048576.0 << " MB budget\n"
+            << "  I/O: " << s.chunk_loads << " chunk loads, " << s.bytes_read / 1048576.0 << " MB read, "
+            << s.evictions << " evictions, " << s.stall_seconds << " s stalled\n"
+            << "  Batching: " << (s.chunk_visits > 0 ? double(s.ray_chunk_visits) / s.chunk_visits : 0.0)
+            << " rays per chunk visit\n";
+    }
+
+private:
+    // A chunk's spheres in memory, shared with the threads tracing it so that
+    // evicting a chunk never frees it under a running batch
+    struct Slot {
+        shared_ptr<const Hittable> spheres;
+        size_t bytes = 0;
+        bool requested = false;             // Queued for or being loaded
+        bool failed = false;                // Could not be read; rays pass through it
+        std::list<int>::iterator lru_entry;
+    };
+
+    // Whether every index of the tree and the chunk table is in range, and every chunk's
+    // spheres lie between 'data_begin' and the end of the file. Children come after their
+    // parents, as written by write_Geometry_Chunks, so the tree has no cycles
+    bool valid_Tables(uint64_t data_begin, uint64_t file_size) const {
+        for (size_t n = 0; n < nodes.size(); n++) {
+            const Chunk_Node& node = nodes[n];
+            bool leaf_ok = node.chunk < int32_t(chunks.size()) && (node.chunk < 0 || chunks[node.chunk].node == int32_t(n));
+            bool inner_ok = node.chunk >= 0
+                         || (node.left > int32_t(n) && node.left < int32_t(nodes.size())
+                             && node.right > int32_t(n) && node.right < int32_t(nodes.size()));
+            if (!leaf_ok || !inner_ok) {
+                return false;
+            }
+        }
+        for (const Chunk_Info& chunk : chunks) {
+            if (chunk.node < 0 || chunk.node >= int32_t(nodes.size()) || chunk.offset < data_begin
+                || chunk.offset > file_size || uint64_t(chunk.count) * sizeof(Sphere_Record) > file_size - chunk.offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string filename;
+    bool owns_file = false;
+    std::vector<shared_ptr<Material>> materials;
+    size_t budget_bytes = 0;
+    std::vector<Chunk_Node> nodes;
+    std::vector<Chunk_Info> chunks;
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable wake_loader;
+    mutable std::condition_variable chunk_loaded;
+    mutable std::vector<Slot> slots;
+    shared_ptr<const Hittable> failed_chunk = make_shared<Hittable_List>();    // Stands in for unreadable chunks
+    mutable std::list<int> lru;             // Resident chunks, most recently used first
+    mutable std::deque<int> load_queue;
+    mutable size_t resident_bytes = 0;
+    mutable size_t peak_resident_bytes = 0;
+    mutable uint64_t load_generation = 0;   // Incremented whenever a chunk finishes loading
+    bool stopping = false;
+    std::thread loader;
+
+    mutable std::atomic<uint64_t> chunk_loads{0};
+    mutable std::atomic<uint64_t> bytes_read{0};
+    mutable std::atomic<uint64_t> evictions{0};
+    mutable std::atomic<uint64_t> chunk_visits{0};
+    mutable std::atomic<uint64_t> ray_chunk_visits{0};
+    mutable std::atomic<uint64_t> stall_nanoseconds{0};
+
+    // Memory of a resident sphere: the Sphere with its shared_ptr control block, and the
+    // two entries of the chunk's BVH pointing at it. The BVH nodes are counted per chunk
+    static constexpr size_t resident_bytes_per_sphere = sizeof(Sphere) + 3 * sizeof(void*) + sizeof(shared_ptr<Hittable>);
+
+    // Traces a batch of rays against every chunk they reach
+    // segment(k) is the part of ray k to trace, visit(chunk, spheres, k) traces ray k
+    // against a resident chunk. Chunks are visited in any order: resident chunks first,
+    // while the loader reads the others
+    template <typename Segment, typename Visit>
+    void trace_Batch(const std::vector<Ray>& rays, Segment&& segment, Visit&& visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        // Find the chunks whose bounds each ray passes through
+        std::vector<std::pair<int, int>> chunk_rays;     // (chunk, ray) pairs
+        std::vector<int> stack;
+        for (int k = 0; k < int(rays.size()); k++) {
+            Interval ray_t = segment(k);
+            if (ray_t.max <= ray_t.min) {
+                continue;
+            }
+            stack.push_back(0);
+            while (!stack.empty()) {
+                const Chunk_Node& node = nodes[stack.back()];
+                stack.pop_back();
+                Interval node_t = ray_t;
+                if (!node.bounds().hit(rays[k], node_t)) {
+                    continue;
+                }
+                if (node.chunk >= 0) {
+                    chunk_rays.emplace_back(node.chunk, k);
+                }
+                else {
+                    stack.push_back(node.left);
+                    stack.push_back(node.right);
+                }
+            }
+        }
+        std::sort(chunk_rays.begin(), chunk_rays.end());
+
+        // Group the rays by chunk
+        struct Group { int chunk; size_t begin, end; };
+        std::vector<Group> pending;
+        for (size_t begin = 0, end = 0; begin < chunk_rays.size(); begin = end) {
+            end = begin;
+            while (end < chunk_rays.size() && chunk_rays[end].first == chunk_rays[begin].first) {
+                end++;
+            }
+            pending.push_back(Group{chunk_rays[begin].first, begin, end});
+        }
+
+        // Trace the groups of resident chunks, and defer the others until they are loaded
+        std::vector<Group> deferred;
+        while (!pending.empty()) {
+            uint64_t generation = current_Generation();
+            for (const Group& group : pending) {
+                shared_ptr<const Hittable> spheres = acquire(group.chunk);
+                if (!spheres) {
+                    deferred.push_back(group);
+                    continue;
+                }
+                for (size_t p = group.begin; p < group.end; p++) {
+                    visit(chunks[group.chunk], *spheres, chunk_rays[p].second);
+                }
+                chunk_visits.fetch_add(1, std::memory_order_relaxed);
+                ray_chunk_visits.fetch_add(group.end - group.begin, std::memory_order_relaxed);
+            }
+            if (!deferred.empty() && deferred.size() == pending.size()) {
+                wait_For_Load(generation);
+            }
+            pending.swap(deferred);
+            deferred.clear();
+        }
+    }
+
+    // Returns the chunk if it is resident, or null after queueing it for loading
+    // Chunks that failed to load are returned empty
+    shared_ptr<const Hittable> acquire(int chunk) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot& slot = slots[chunk];
+        if (slot.failed) {
+            return failed_chunk;
+        }
+        if (slot.spheres) {
+            lru.splice(lru.begin(), lru, slot.lru_entry);
+            return slot.spheres;
+        }
+        if (!slot.requested) {
+            slot.requested = true;
+            load_queue.push_back(chunk);
+            wake_loader.notify_one();
+        }
+        return nullptr;
+    }
+
+    uint64_t current_Generation() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return load_generation;
+    }
+
+    // Waits until a chunk finished loading after 'generation', counting the wait as a stall
+    void wait_For_Load(uint64_t generation) const {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            chunk_loaded.wait(lock, [&] { return load_generation != generation || stopping; });
+        }
+        auto stalled = std::chrono::steady_clock::now() - start;
+        stall_nanoseconds.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(stalled).count()),
+                                    std::memory_order_relaxed);
+    }
+
+    // Loader thread: reads queued chunks and makes them resident, evicting the least
+    // recently used chunks to stay within the budget
+    void load_Chunks() {
+        Trace::set_Thread_Name("geometry loader");
+        std::ifstream file(filename, std::ios::binary);
+        std::vector<Sphere_Record> records;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake_loader.wait(lock, [&] { return stopping || !load_queue.empty(); });
+            if (stopping) {
+                break;
+            }
+            int chunk = load_queue.front();
+            load_queue.pop_front();
+            lock.unlock();
+
+            // Read and build the chunk without holding the lock
+            Trace_Scope trace_chunk("chunk load", "assets", chunk);
+            const Chunk_Info& info = chunks[chunk];
+            records.resize(info.count);
+            file.clear();
+            file.seekg(std::streamoff(info.offset));
+            bool read = bool(file.read(reinterpret_cast<char*>(records.data()),
+                                       std::streamsize(records.size() * sizeof(Sphere_Record))));
+            for (size_t r = 0; read && r < records.size(); r++) {
+                read = records[r].material >= 0 && size_t(records[r].material) < materials.size();
+            }
+            if (!read) {
+                std::cerr << "Corrupt or unreadable geometry chunk " << chunk << " of " << filename << "\n";
+                lock.lock();
+                Slot& slot = slots[chunk];
+                slot.failed = true;
+                slot.requested = false;
+                load_generation++;
+                chunk_loaded.notify_all();
+                continue;
+            }
+            std::vector<shared_ptr<Hittable>> objects;
+            objects.reserve(records.size());
+            for (const Sphere_Record& record : records) {
+                objects.push_back(make_shared<Sphere>(Point3(record.center[0], record.center[1], record.center[2]),
+                                                      record.radius, materials[record.material]));
+            }
+            auto spheres = make_shared<const Wide_BVH>(objects);
+            size_t bytes = records.size() * resident_bytes_per_sphere + spheres->node_Bytes();
+            chunk_loads.fetch_add(1, std::memory_order_relaxed);
+            bytes_read.fetch_add(records.size() * sizeof(Sphere_Record), std::memory_order_relaxed);
+
+            lock.lock();
+            while (!lru.empty() && resident_bytes + bytes > budget_bytes) {
+                Slot& victim = slots[lru.back()];
+                lru.pop_back();
+                resident_bytes -= victim.bytes;
+                victim.spheres.reset();
+                victim.bytes = 0;
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            Slot& slot = slots[chunk];
+            slot.spheres = spheres;
+            slot.bytes = bytes;
+            slot.requested = false;
+            lru.push_front(chunk);
+            slot.lru_entry = lru.begin();
+            resident_bytes += bytes;
+            peak_resident_bytes = std::max(peak_resident_bytes, resident_bytes);
+            load_generation++;
+            chunk_loaded.notify_all();
+        }
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "ray.hpp"
 #include "common.hpp"
+#include "aabb.hpp"
 
 class Material;
 
@@ -22,11 +23,68 @@ public:
     }
 };
 
+// Bounds of the light an emitter sends out, which the light tree clusters emitters by
+// The emitter lies within 'box' and emits 'power' in total, along directions within
+// theta_o of 'axis', each spreading up to theta_e further from its surface normal
+struct Light_Bounds {
+    AABB box;
+    double power = 0;           // Emitted power, as luminance
+    Vec3 axis = Vec3(0,0,1);    // Center of the normals of the emitting surface
+    double cos_theta_o = -1;    // Cosine of the widest angle of a normal from the axis; -1 for all directions
+    double cos_theta_e = 0;     // Cosine of the widest angle of emission from a normal; 0 for a hemisphere
+};
+
 class Hittable {
 public:
     virtual ~Hittable() = default;
 
     virtual bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const = 0;
+
+    // Any-hit query for shadow and visibility rays
+    // Returns true as soon as any intersection within ray_t is found, without searching
+    // for the closest one or filling a Hit_Record
+    virtual bool occluded(const Ray& r, Interval ray_t) const {
+        Hit_Record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // Light sampling, implemented by objects that can be sampled directly as light sources
+    // Returns the solid angle pdf of sampling 'direction' from 'origin' towards the object
+    virtual double pdf_Value(const Point3& origin, const Vec3& direction) const {
+        return 0.0;
+    }
+
+    // Returns a random direction from 'origin' towards the object
+    virtual Vec3 random_Direction(const Point3& origin, Rng& rng) const {
+        return Vec3(1, 0, 0);
+    }
+
+    // Fills 'bounds' with the light the object emits, for clustering it with other lights
+    // Returns false if the object emits no light
+    virtual bool light_Bounds(Light_Bounds& bounds) const {
+        return false;
+    }
+
+    // Fills 'box' with a box enclosing the object, for placing it in a BVH
+    // Returns false if the object is unbounded
+    virtual bool bounding_Box(AABB& box) const {
+        return false;
+    }
+
+    // Fills 'box' with a box enclosing the object if its surface is specular (see
+    // Material::specular), so caustic photons can be aimed at it
+    // Returns false for other objects
+    virtual bool specular_Bounds(AABB& box) const {
+        return false;
+    }
+
+    // Samples a point uniformly over the surface of an emitter, for emitting photons from it
+    // Fills 'normal' with the outward normal there, 'radiance' with the radiance it emits
+    // and 'area' with the area of the whole surface
+    // Returns false if the object emits no light
+    virtual bool sample_Emitter(Rng& rng, Point3& point, Vec3& normal, Color& radiance, double& area) const {
+        return false;
+    }
 };
 
 
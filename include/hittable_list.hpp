@@ -43,6 +43,37 @@ public:
 
         return hit_anything;
     }
+
+    // Check if any object in the list is hit by ray r within ray_t
+    // Stops at the first object hit
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The list samples each of its objects with equal probability, so the pdf of a
+    // direction is the average of the objects' pdfs
+    double pdf_Value(const Point3& origin, const Vec3& direction) const override {
+        if (objects.empty()) {
+            return 0.0;
+        }
+        double sum = 0.0;
+        for (const auto& object : objects) {
+            sum += object->pdf_Value(origin, direction);
+        }
+        return sum / objects.size();
+    }
+
+    // Returns a random direction towards a uniformly chosen object of the list
+    Vec3 random_Direction(const Point3& origin, Rng& rng) const override {
+        int index = int(random_double(rng) * objects.size());
+        index = (index < int(objects.size())) ? index : int(objects.size()) - 1;
+        return objects[index]->random_Direction(origin, rng);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,166 @@
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include "common.hpp"
+#include "tile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Interleaved_Frame holds the image of real-time renders that trace only 1 in N pixels
+// per frame and reconstruct the rest. Every frame traces the pixels of one phase of an
+// interleaved pattern, a checkerboard for N = 2, cycling through all phases in N frames
+// A pixel not traced this frame keeps its color from an earlier frame if the view has
+// not changed since, which gives the full-rate image as pixels render the same every
+// frame. After the view changed, its old color is clamped to the range of the traced
+// pixels around it, which keeps detail without smearing moving edges, and pixels never
+// traced before take the average of their traced neighbors
+class Interleaved_Frame {
+public:
+    // What the image shows; the history is only reused while this stays the same
+    struct View {
+        Point3 center;          // Camera center
+        Point3 pixel00;         // Location of pixel 0,0
+        Vec3 delta_u, delta_v;  // Offsets between pixels
+        Vec3 defocus_u;         // Defocus disk horizontal radius
+        bool sky_loaded;        // Whether the environment map replaced the placeholder sky
+        int samples_per_pixel;  // Quality the pixels are traced at, which the frame time
+        int max_depth;          // controller changes while the camera stays still
+
+        bool operator==(const View& other) const {
+            return same(center, other.center) && same(pixel00, other.pixel00)
+                && same(delta_u, other.delta_u) && same(delta_v, other.delta_v)
+                && same(defocus_u, other.defocus_u) && sky_loaded == other.sky_loaded
+                && samples_per_pixel == other.samples_per_pixel && max_depth == other.max_depth;
+        }
+
+    private:
+        static bool same(const Vec3& a, const Vec3& b) { return a.x() == b.x() && a.y() == b.y() && a.z() == b.z(); }
+    };
+
+    // Whether pixel (i, j) is traced in frames of the given phase of an n pixel pattern
+    // Rows are shifted by half the pattern so the traced pixels spread out diagonally
+    static bool traced(int i, int j, int n, int phase) {
+        return (i + j * ((n + 1) / 2)) % n == phase;
+    }
+
+    // Starts a frame of width x height pixels tracing 1 in n pixels, returns its phase
+    // Forgets the earlier frames if the size, pattern or view changed
+    int begin_Frame(int width, int height, int n, const View& view) {
+        if (width != image_width || height != image_height || n != pattern_size) {
+            image_width = width;
+            image_height = height;
+            pattern_size = n;
+            image.assign(size_t(width) * height, Color(0,0,0));
+            traced_frame.assign(size_t(width) * height, 0);
+            frame = 0;
+            view_frame = 1;
+        }
+        frame++;
+        if (!(view == last_view)) {
+            view_frame = frame;
+            last_view = view;
+        }
+        return int(frame % uint32_t(pattern_size));
+    }
+
+    // Stores the traced pixels of a tile of colors, row-major
+    // Tiles never overlap, so threads store their own tiles without locking
+    void store_Tile(const Tile& tile, const Color* colors) {
+        const int phase = int(frame % uint32_t(pattern_size));
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++, colors++) {
+                if (traced(i, j, pattern_size, phase)) {
+                    size_t index = size_t(j) * image_width + i;
+                    image[index] = *colors;
+                    traced_frame[index] = frame;
+                }
+            }
+        }
+    }
+
+    // Fills in the pixels not traced this frame, once all tiles are stored
+    // Returns the whole image, row-major
+    const std::vector<Color>& reconstruct() {
+        filled.resize(image.size());
+        const int phase = int(frame % uint32_t(pattern_size));
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                size_t index = size_t(j) * image_width + i;
+                if (traced(i, j, pattern_size, phase) || traced_frame[index] >= view_frame) {
+                    filled[index] = image[index];
+                }
+                else if (traced_frame[index] > 0) {
+                    filled[index] = clamp_To_Traced(image[index], i, j, phase);
+                }
+                else {
+                    filled[index] = average_Traced(i, j, phase);
+                }
+            }
+        }
+        // Filled in pixels are not kept as history, only traced ones are
+        return filled;
+    }
+
+private:
+    int image_width = 0;
+    int image_height = 0;
+    int pattern_size = 0;
+    std::vector<Color> image;           // Last traced color of every pixel
+    std::vector<uint32_t> traced_frame; // Frame each pixel was last traced in, 0 if never
+    std::vector<Color> filled;          // Reconstructed image of the current frame
+    uint32_t frame = 0;                 // Number of the current frame, starting at 1
+    uint32_t view_frame = 1;            // First frame with the current view
+    View last_view{};
+
+    // Clamps an earlier color of (i, j) to the range of the pixels traced this frame next to it
+    Color clamp_To_Traced(const Color& old_color, int i, int j, int phase) const {
+        Color low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+        int count = 0;
+        for (int y = std::max(0, j - 1); y <= std::min(image_height - 1, j + 1); y++) {
+            for (int x = std::max(0, i - 1); x <= std::min(image_width - 1, i + 1); x++) {
+                if (traced(x, y, pattern_size, phase)) {
+                    const Color& neighbor = image[size_t(y) * image_width + x];
+                    for (int c = 0; c < 3; c++) {
+                        low[c] = std::min(low[c], neighbor[c]);
+                        high[c] = std::max(high[c], neighbor[c]);
+                    }
+                    count++;
+                }
+            }
+        }
+        if (count == 0) {
+            return average_Traced(i, j, phase);
+        }
+        Color clamped;
+        for (int c = 0; c < 3; c++) {
+            clamped[c] = std::clamp(old_color[c], low[c], high[c]);
+        }
+        return clamped;
+    }
+
+    // Average of the pixels traced this frame nearest to (i, j), searching growing squares
+    // Every row has a traced pixel in each run of pattern_size pixels, so one is found
+    // within pattern_size / 2 + 1 pixels
+    Color average_Traced(int i, int j, int phase) const {
+        for (int radius = 1; radius <= pattern_size; radius++) {
+            Color sum(0,0,0);
+            int count = 0;
+            for (int y = std::max(0, j - radius); y <= std::min(image_height - 1, j + radius); y++) {
+                for (int x = std::max(0, i - radius); x <= std::min(image_width - 1, i + radius); x++) {
+                    if (traced(x, y, pattern_size, phase)) {
+                        sum += image[size_t(y) * image_width + x];
+                        count++;
+                    }
+                }
+            }
+            if (count > 0) {
+                return sum / count;
+            }
+        }
+        return image[size_t(j) * image_width + i];
+    }
+};
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+// Indirect light arriving at a diffuse surface point, sampled over the hemisphere
+// Radiance values are the cosine-weighted average of incoming radiance, which is the
+// irradiance over pi, so a Lambertian surface reflects albedo times this value
+struct Irradiance_Record {
+    Point3 p;                       // Where the hemisphere was sampled
+    Vec3 normal;                    // Surface normal at p
+    Color radiance;                 // Cosine-weighted average incoming radiance
+    double radius;                  // Harmonic mean distance to the surfaces seen from p
+    Vec3 rotation_gradient[3];      // Change of each color channel as the normal rotates
+    Vec3 translation_gradient[3];   // Change of each color channel as p moves
+};
+
+// Irradiance_Cache stores indirect lighting of diffuse surfaces sampled at sparse points
+// (Ward's irradiance caching) and interpolates it for hits nearby, with the gradients
+// of Ward and Heckbert so interpolation follows how the lighting changes between points
+// The records depend only on the scene, not on the camera, so the cache is kept across
+// frames and cleared when the lighting or the bounce count changes. Render threads look up records in
+// parallel; adding a record briefly locks out other threads
+class Irradiance_Cache {
+public:
+    double accuracy = 0.25;         // Largest interpolation error allowed (Ward's a); lower is slower and more accurate
+    double min_radius = 0.02;       // Closest spacing of records, in world units
+    double max_radius = 2.0;        // Widest spacing of records, in world units
+    int theta_strata = 8;           // Hemisphere rays per record: theta_strata * phi_strata
+    int phi_strata = 16;
+
+    // Clears the cache if 'lighting' or the bounce count 'max_depth' differ from those the
+    // records were traced with, as real-time renders lower and raise the depth with load
+    // Call before rendering a frame
+    void use_Lighting(int lighting, int max_depth) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (lighting != current_lighting || max_depth != current_max_depth) {
+            current_lighting = lighting;
+            current_max_depth = max_depth;
+            records.clear();
+            root = std::make_unique<Node>();
+        }
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return records.size();
+    }
+
+    // Interpolates the cached records around (p, normal) into 'radiance'
+    // Returns false if no record is close enough, then a new one is needed here
+    bool lookup(const Point3& p, const Vec3& normal, Color& radiance) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        Color sum(0,0,0);
+        double weight_sum = 0;
+
+        const Node* node = root.get();
+        Point3 center(0,0,0);
+        double half = root_half_size;
+        while (node) {
+            for (int index : node->records) {
+                const Irradiance_Record& record = records[index];
+                double weight = weight_Of(record, p, normal);
+                if (weight <= 0) {
+                    continue;
+                }
+                Vec3 rotation = cross(record.normal, normal);
+                Vec3 offset = p - record.p;
+                Color value;
+                for (int c = 0; c < 3; c++) {
+                    value[c] = record.radiance[c] + dot(rotation, record.rotation_gradient[c])
+                             + dot(offset, record.translation_gradient[c]);
+                }
+                sum += weight * value;
+                weight_sum += weight;
+            }
+            int child = child_Index(center, p);
+            if (!inside(center, half, p)) {
+                break;
+            }
+            half /= 2;
+            center = child_Center(center, half, child);
+            node = node->children[child].get();
+        }
+
+        if (weight_sum <= 0) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        hits.fetch_add(1, std::memory_order_relaxed);
+        radiance = sum / weight_sum;
+        for (int c = 0; c < 3; c++) {
+            radiance[c] = std::max(0.0, radiance[c]);
+        }
+        return true;
+    }
+
+    // Samples the hemisphere above (p, normal) with stratified cosine-distributed rays,
+    // adds the resulting record and returns its radiance
+    // trace(ray, cos_theta, distance) returns the radiance arriving along the ray and
+    // sets distance to the ray's first hit, infinity if it escapes
+    template <typename Trace>
+    Color add_Record(const Point3& p, const Vec3& normal, Rng& rng, Trace&& trace) {
+        const int M = std::max(2, theta_strata);
+        const int N = std::max(3, phi_strata);
+        Vec3 t, b;
+        build_Orthonormal_Basis(normal, t, b);
+
+        std::vector<Color> radiance(size_t(M) * N);
+        std::vector<double> distance(size_t(M) * N);
+        double inverse_distance_sum = 0;
+        Color sum(0,0,0);
+        for (int j = 0; j < M; j++) {
+            for (int k = 0; k < N; k++) {
+                // Cosine distributed: sin^2(theta) is uniform within the stratum
+                double sin_theta = std::sqrt((j + rng.next_Double()) / M);
+                double cos_theta = std::sqrt(std::max(0.0, 1 - sin_theta * sin_theta));
+                double phi = 2 * pi * (k + rng.next_Double()) / N;
+                Vec3 direction = sin_theta * std::cos(phi) * t + sin_theta * std::sin(phi) * b + cos_theta * normal;
+
+                size_t s = size_t(j) * N + k;
+                radiance[s] = trace(Ray(p, direction), cos_theta, distance[s]);
+                sum += radiance[s];
+                if (distance[s] < infinity) {
+                    inverse_distance_sum += 1 / std::max(distance[s], 1e-4);
+                }
+            }
+        }
+
+        Irradiance_Record record;
+        record.p = p;
+        record.normal = normal;
+        record.radiance = sum / double(M * N);
+        record.radius = (inverse_distance_sum > 0) ? (M * N) / inverse_distance_sum : max_radius;
+        record.radius = std::clamp(record.radius, min_radius, max_radius);
+        compute_Gradients(record, radiance, distance, M, N, t, b);
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        records.push_back(record);
+        insert(int(records.size()) - 1);
+        return record.radiance;
+    }
+
+    void print_Stats(std::ostream& out) const {
+        uint64_t h = hits.load(), m = misses.load();
+        out << "Irradiance cache: " << size() << " records, "
+            << (h + m > 0 ? 100.0 * h / double(h + m) : 0) << "% of lookups interpolated\n";
+    }
+
+private:
+    struct Node {
+        std::vector<int> records;               // Records whose influence overlaps the node
+        std::unique_ptr<Node> children[8];
+    };
+
+    static constexpr double root_half_size = 512;   // The root node spans [-512, 512]^3
+    static constexpr int max_node_depth = 20;
+
+    mutable std::shared_mutex mutex;
+    std::vector<Irradiance_Record> records;
+    std::unique_ptr<Node> root = std::make_unique<Node>();
+    int current_lighting = -1;
+    int current_max_depth = -1;
+    mutable std::atomic<uint64_t> hits{0};
+    mutable std::atomic<uint64_t> misses{0};
+
+    // Ward's weight of a record for a point, 0 if the record can't be used there
+    double weight_Of(const Irradiance_Record& record, const Point3& p, const Vec3& normal) const {
+        double normal_dot = dot(normal, record.normal);
+        if (normal_dot < 0.9) {
+            return 0;
+        }
+        Vec3 offset = p - record.p;
+        // Skip records in front of the point, they may see light the point can't
+        if (dot(offset, normal + record.normal) < -0.1 * record.radius) {
+            return 0;
+        }
+        double error = offset.length() / record.radius + std::sqrt(std::max(0.0, 1 - normal_dot));
+        if (error >= accuracy) {
+            return 0;
+        }
+        return 1 / std::max(error, 1e-6);
+    }
+
+    // Adds record 'index' to every node that its area of influence overlaps, at the depth
+    // where nodes are about as large as that area
+    void insert(int index) {
+        const Irradiance_Record& record = records[index];
+        double influence = accuracy * record.radius;
+        insert_Into(root.get(), Point3(0,0,0), root_half_size, 0, index, influence);
+    }
+
+    void insert_Into(Node* node, const Point3& center, double half, int depth, int index, double influence) {
+        const Point3& p = records[index].p;
+        if (depth == max_node_depth || half < influence || !inside(center, half, p)) {
+            node->records.push_back(index);
+            return;
+        }
+        double child_half = half / 2;
+        for (int child = 0; child < 8; child++) {
+            Point3 child_center = child_Center(center, child_half, child);
+            bool overlaps = true;
+            for (int a = 0; a < 3; a++) {
+                overlaps = overlaps && std::fabs(p[a] - child_center[a]) <= child_half + influence;
+            }
+            if (overlaps) {
+                if (!node->children[child]) {
+                    node->children[child] = std::make_unique<Node>();
+                }
+                insert_Into(node->children[child].get(), child_center, child_half, depth + 1, index, influence);
+            }
+        }
+    }
+
+    static bool inside(const Point3& center, double half, const Point3& p) {
+        return std::fabs(p.x() - center.x()) <= half && std::fabs(p.y() - center.y()) <= half
+            && std::fabs(p.z() - center.z()) <= half;
+    }
+
+    static int child_Index(const Point3& center, const Point3& p) {
+        return (p.x() > center.x() ? 1 : 0) | (p.y() > center.y() ? 2 : 0) | (p.z() > center.z() ? 4 : 0);
+    }
+
+    static Point3 child_Center(const Point3& center, double child_half, int child) {
+        return center + Vec3((child & 1) ? child_half : -child_half,
+                             (child & 2) ? child_half : -child_half,
+                             (child & 4) ? child_half : -child_half);
+    }
+
+    // Rotation and translation gradients of Ward and Heckbert from the stratified samples,
+    // in the units of the record's radiance (irradiance over pi)
+    static void compute_Gradients(Irradiance_Record& record, const std::vector<Color>& radiance,
+                                  const std::vector<double>& distance, int M, int N, const Vec3& t, const Vec3& b) {
+        for (int c = 0; c < 3; c++) {
+            record.rotation_gradient[c] = Vec3(0,0,0);
+            record.translation_gradient[c] = Vec3(0,0,0);
+        }
+
+        auto at = [&](int j, int k) { return size_t(j) * N + ((k + N) % N); };
+        for (int k = 0; k < N; k++) {
+            double phi = 2 * pi * (k + 0.5) / N;
+            double phi_minus = 2 * pi * k / N;
+            Vec3 u_k = std::cos(phi) * t + std::sin(phi) * b;                       // Toward the stratum
+            Vec3 v_k = -std::sin(phi) * t + std::cos(phi) * b;                      // Across it
+            Vec3 v_k_minus = -std::sin(phi_minus) * t + std::cos(phi_minus) * b;    // Across its wall at phi_minus
+
+            for (int j = 0; j < M; j++) {
+                double sin_minus = std::sqrt(double(j) / M);
+                double sin_plus = std::sqrt(double(j + 1) / M);
+                double tan_theta = std::tan(std::asin(std::sqrt((j + 0.5) / M)));
+                const Color& L = radiance[at(j, k)];
+
+                for (int c = 0; c < 3; c++) {
+                    // Rotating the normal tilts every stratum by tan(theta)
+                    record.rotation_gradient[c] += v_k * (-tan_theta * L[c] / (M * N));
+
+                    // Moving the point shifts the walls between strata by the distance to what they see
+                    if (j > 0) {
+                        double cos_minus_sq = 1 - sin_minus * sin_minus;
+                        double r = std::max(1e-3, std::min(distance[at(j, k)], distance[at(j - 1, k)]));
+                        record.translation_gradient[c] += u_k * ((2 * pi / N) * sin_minus * cos_minus_sq / r
+                                                                  * (L[c] - radiance[at(j - 1, k)][c]) / pi);
+                    }
+                    double r = std::max(1e-3, std::min(distance[at(j, k)], distance[at(j, k - 1)]));
+                    record.translation_gradient[c] += v_k_minus * ((sin_plus - sin_minus) / r
+                                                                   * (L[c] - radiance[at(j, k - 1)][c]) / pi);
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+// Light tree for choosing which of many lights to sample (after Conty Estevez and Kulla,
+// "Importance Sampling of Many Lights with Adaptive Tree Splitting")
+// Lights are clustered into a binary tree by their bounds, power and emission cones. To
+// pick a light for a shading point, the tree is walked from the root, choosing each time
+// between the two children by an estimate of the light each could send to the point, so
+// a light is found in logarithmic time and close, bright lights are picked far more often
+// than the many that barely reach the point. The estimate only depends on the position of
+// the shading point, so the pdf of a light sample can be recomputed from the ray alone
+// when a BSDF sample hits a light. The node bounds also intersect the lights, which finds
+// the lights in front of a sampled one without searching the whole scene
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class Light_Tree : public Hittable {
+public:
+    static constexpr int split_buckets = 12;    // Candidate splits per axis when building
+    static constexpr int max_depth = 64;        // Deeper subtrees are split in half by count, to bound the traversal stack
+
+    bool uniform_selection = false;     // Choose every light with equal probability, for comparison
+
+    Light_Tree() {}
+
+    // Builds the tree over the objects that emit light, the others are left out
+    explicit Light_Tree(const std::vector<shared_ptr<Hittable>>& objects) {
+        std::vector<Build_Light> build;
+        for (const auto& object : objects) {
+            Light_Bounds bounds;
+            if (object->light_Bounds(bounds)) {
+                build.push_back(Build_Light{bounds, int(lights.size())});
+                lights.push_back(object);
+            }
+        }
+        if (!build.empty()) {
+            nodes.reserve(2 * build.size() - 1);
+            build_Node(build, 0, build.size(), 0);
+        }
+    }
+
+    // The lights of the tree
+    const std::vector<shared_ptr<Hittable>>& objects() const { return lights; }
+
+    bool empty() const { return lights.empty(); }
+
+    size_t memory_Bytes() const {
+        return nodes.size() * sizeof(Node) + lights.size() * sizeof(shared_ptr<Hittable>);
+    }
+
+    // Chooses a light to sample from point p and sets 'probability' to the chance of choosing it
+    // Returns null if no light can reach p
+    const Hittable* sample(const Point3& p, Rng& rng, double& probability) const {
+        if (nodes.empty()) {
+            return nullptr;
+        }
+        // One random number picks the whole path down the tree, rescaled at each choice
+        double u = random_double(rng);
+        probability = 1;
+        int index = 0;
+        while (!nodes[index].leaf) {
+            int first = index + 1;
+            int second = nodes[index].child_or_light;
+            double first_weight = weight_Of(nodes[first], p);
+            double second_weight = weight_Of(nodes[second], p);
+            if (first_weight + second_weight <= 0) {
+                return nullptr;
+            }
+            double first_probability = first_weight / (first_weight + second_weight);
+            if (u < first_probability) {
+                u = std::min(u / first_probability, 1 - epsilon);
+                probability *= first_probability;
+                index = first;
+            }
+            else {
+                u = std::min((u - first_probability) / (1 - first_probability), 1 - epsilon);
+                probability *= 1 - first_probability;
+                index = second;
+            }
+        }
+        return lights[nodes[index].child_or_light].get();
+    }
+
+    // Solid angle pdf of sampling 'direction' from 'origin': over every light the direction
+    // reaches, the chance of choosing it times its own pdf of the direction. Only the
+    // subtrees whose bounds the direction passes through are visited
+    double pdf_Value(const Point3& origin, const Vec3& direction) const override {
+        if (nodes.empty()) {
+            return 0.0;
+        }
+        Ray r(origin, direction);
+        double pdf = 0;
+        std::pair<int, double> stack[2 * max_depth];     // (node, chance of reaching it)
+        int stack_size = 0;
+        stack[stack_size++] = {0, 1.0};
+        while (stack_size > 0) {
+            auto [index, probability] = stack[--stack_size];
+            const Node& node = nodes[index];
+            Interval ray_t(0.001, infinity);
+            if (!node.bounds.box.hit(r, ray_t)) {
+                continue;
+            }
+            if (node.leaf) {
+                pdf += probability * lights[node.child_or_light]->pdf_Value(origin, direction);
+                continue;
+            }
+            int first = index + 1;
+            int second = node.child_or_light;
+            double first_weight = weight_Of(nodes[first], origin);
+            double second_weight = weight_Of(nodes[second], origin);
+            double total = first_weight + second_weight;
+            if (total <= 0) {
+                continue;
+            }
+            if (second_weight > 0) {
+                stack[stack_size++] = {second, probability * second_weight / total};
+            }
+            if (first_weight > 0) {
+                stack[stack_size++] = {first, probability * first_weight / total};
+            }
+        }
+        return pdf;
+    }
+
+    // Direction towards a light chosen by the tree
+    Vec3 random_Direction(const Point3& origin, Rng& rng) const override {
+        double probability;
+        const Hittable* light = sample(origin, rng, probability);
+        return light ? light->random_Direction(origin, rng) : Vec3(1, 0, 0);
+    }
+
+    // Closest hit with the lights, visiting the nearer child first
+    bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        bool hit_anything = false;
+        int stack[2 * max_depth];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const Node& node = nodes[stack[--stack_size]];
+            Interval box_t = ray_t;
+            if (!node.bounds.box.hit(r, box_t)) {
+                continue;
+            }
+            if (node.leaf) {
+                if (lights[node.child_or_light]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+                continue;
+            }
+            int first = int(&node - nodes.data()) + 1;
+            int second = node.child_or_light;
+            if (r.direction()[node.split_axis] < 0) {
+                std::swap(first, second);
+            }
+            stack[stack_size++] = second;
+            stack[stack_size++] = first;
+        }
+        return hit_anything;
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        int stack[2 * max_depth];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int index = stack[--stack_size];
+            const Node& node = nodes[index];
+            Interval box_t = ray_t;
+            if (!node.bounds.box.hit(r, box_t)) {
+                continue;
+            }
+            if (node.leaf) {
+                if (lights[node.child_or_light]->occluded(r, ray_t)) {
+                    return true;
+                }
+                continue;
+            }
+            stack[stack_size++] = node.child_or_light;
+            stack[stack_size++] = index + 1;
+        }
+        return false;
+    }
+
+    // Estimate of the light the lights within 'bounds' can send to point p: their power,
+    // falling off with the squared distance, and with the angle between p and the nearest
+    // direction their cone of emission reaches. 0 if p is outside every emission cone
+    static double importance(const Light_Bounds& bounds, const Point3& p) {
+        Point3 center = 0.5 * (box_Min(bounds.box) + box_Max(bounds.box));
+        Vec3 half_diagonal = 0.5 * (box_Max(bounds.box) - box_Min(bounds.box));
+        Vec3 to_p = p - center;
+        double distance_squared = to_p.length_Squared();
+        double radius_squared = half_diagonal.length_Squared();
+        // Points among the lights would divide by a distance near zero; the whole cluster
+        // is as close as its size then
+        double falloff_distance_squared = std::max(distance_squared, radius_squared);
+
+        double cos_theta = 1;
+        if (bounds.cos_theta_o > -1 && distance_squared > radius_squared) {
+            // Angle of p from the axis, less the cone of normals and the angle the
+            // bounds subtend from p, is the smallest angle of p from any normal
+            double theta_w = std::acos(std::clamp(dot(bounds.axis, to_p) / std::sqrt(distance_squared), -1.0, 1.0));
+            double theta_o = std::acos(bounds.cos_theta_o);
+            double theta_b = std::asin(std::sqrt(radius_squared / distance_squared));
+            double theta = std::max(0.0, theta_w - theta_o - theta_b);
+            if (theta >= std::acos(bounds.cos_theta_e)) {
+                return 0;
+            }
+            cos_theta = std::cos(theta);
+        }
+        return bounds.power * cos_theta / falloff_distance_squared;
+    }
+
+    // Bounds of two groups of lights together: the box around both boxes, the sum of their
+    // power and the smallest cone holding both cones of normals
+    static Light_Bounds merged(const Light_Bounds& a, const Light_Bounds& b) {
+        if (a.power <= 0) {
+            return b;
+        }
+        if (b.power <= 0) {
+            return a;
+        }
+        Light_Bounds m;
+        m.box = AABB(a.box, b.box);
+        m.power = a.power + b.power;
+        m.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+        merge_Cones(a, b, m.axis, m.cos_theta_o);
+        return m;
+    }
+
+private:
+    struct Node {
+        Light_Bounds bounds;
+        int child_or_light;     // The second child of an inner node (the first follows it), or the light of a leaf
+        int light_count;        // Lights in the subtree
+        int split_axis;         // Axis the children were split along
+        bool leaf;
+    };
+
+    struct Build_Light {
+        Light_Bounds bounds;
+        int light;
+    };
+
+    static constexpr double epsilon = 1e-12;
+
+    std::vector<shared_ptr<Hittable>> lights;
+    std::vector<Node> nodes;        // Depth first, the root first
+
+    // Weight of choosing a node, relative to its sibling
+    double weight_Of(const Node& node, const Point3& p) const {
+        return uniform_selection ? double(node.light_count) : importance(node.bounds, p);
+    }
+
+    static Point3 box_Min(const AABB& box) { return Point3(box.x.min, box.y.min, box.z.min); }
+    static Point3 box_Max(const AABB& box) { return Point3(box.x.max, box.y.max, box.z.max); }
+
+    static Vec3 rotated(const Vec3& v, const Vec3& unit_axis, double angle) {
+        // Rodrigues' rotation formula
+        double c = std::cos(angle);
+        double s = std::sin(angle);
+        return c * v + s * cross(unit_axis, v) + (1 - c) * dot(unit_axis, v) * unit_axis;
+    }
+
+    // Smallest cone around both cones of normals, as its axis and the cosine of its angle
+    static void merge_Cones(const Light_Bounds& a, const Light_Bounds& b, Vec3& axis, double& cos_theta_o) {
+        axis = a.axis;
+        cos_theta_o = -1;
+        if (a.cos_theta_o <= -1 || b.cos_theta_o <= -1) {
+            return;
+        }
+        double theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0, 1.0));
+        double theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+        double theta_d = std::acos(std::clamp(dot(a.axis, b.axis), -1.0, 1.0));
+        if (std::min(theta_d + theta_b, pi) <= theta_a) {
+            axis = a.axis;
+            cos_theta_o = a.cos_theta_o;
+            return;
+        }
+        if (std::min(theta_d + theta_a, pi) <= theta_b) {
+            axis = b.axis;
+            cos_theta_o = b.cos_theta_o;
+            return;
+        }
+        double theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vec3 rotation_axis = cross(a.axis, b.axis);
+        if (theta_o >= pi || rotation_axis.length_Squared() < 1e-12) {
+            return;
+        }
+        axis = rotated(a.axis, unit_Vector(rotation_axis), theta_o - theta_a);
+        cos_theta_o = std::cos(theta_o);
+    }
+
+    // Cost of a cluster in the surface area orientation heuristic: its power times the
+    // surface of its box times the solid angle measure of its cone of emission
+    static double cluster_Cost(const Light_Bounds& bounds) {
+        if (bounds.power <= 0) {
+            return 0;
+        }
+        Vec3 size = box_Max(bounds.box) - box_Min(bounds.box);
+        double area = 2 * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+        double theta_o = std::acos(std::clamp(bounds.cos_theta_o, -1.0, 1.0));
+        double theta_e = std::acos(std::clamp(bounds.cos_theta_e, -1.0, 1.0));
+        double theta_w = std::min(theta_o + theta_e, pi);
+        double sin_theta_o = std::sin(theta_o);
+        double solid_angle = 2 * pi * (1 - bounds.cos_theta_o)
+                           + pi / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w)
+                                       - 2 * theta_o * sin_theta_o + bounds.cos_theta_o);
+        // Point lights have no area, but still cost their power
+        return bounds.power * std::max(area, 1e-12) * solid_angle;
+    }
+
+    // Builds the subtree over build[begin, end) and returns the index of its root
+    int build_Node(std::vector<Build_Light>& build, size_t begin, size_t end, int depth) {
+        int index = int(nodes.size());
+        nodes.push_back(Node{});
+        Light_Bounds bounds;
+        AABB centers;
+        for (size_t i = begin; i < end; i++) {
+            bounds = merged(bounds, build[i].bounds);
+            Point3 center = 0.5 * (box_Min(build[i].bounds.box) + box_Max(build[i].bounds.box));
+            centers = AABB(centers, AABB(center, center));
+        }
+        if (end - begin == 1) {
+            nodes[index] = Node{build[begin].bounds, build[begin].light, 1, 0, true};
+            return index;
+        }
+
+        // Split at the bucket boundary with the least cost, over the three axes. Splits
+        // along a short side of the box are penalized, they give children as wide as the parent
+        Vec3 size = box_Max(bounds.box) - box_Min(bounds.box);
+        double longest = std::max({size.x(), size.y(), size.z()});
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_bucket = 0;
+        for (int axis = 0; axis < 3 && depth < max_depth; axis++) {
+            const Interval& range = centers.axis_Interval(axis);
+            if (range.size() <= 0) {
+                continue;
+            }
+            Light_Bounds buckets[split_buckets];
+            for (size_t i = begin; i < end; i++) {
+                buckets[bucket_Of(build[i], axis, range)] = merged(buckets[bucket_Of(build[i], axis, range)], build[i].bounds);
+            }
+            Light_Bounds below[split_buckets];
+            for (int b = 0; b < split_buckets; b++) {
+                below[b] = (b == 0) ? buckets[0] : merged(below[b - 1], buckets[b]);
+            }
+            Light_Bounds above;
+            double regularization = longest / std::max(size[axis], 1e-12);
+            for (int b = split_buckets - 1; b > 0; b--) {
+                above = merged(above, buckets[b]);
+                if (below[b - 1].power <= 0 || above.power <= 0) {
+                    continue;
+                }
+                double cost = regularization * (cluster_Cost(below[b - 1]) + cluster_Cost(above));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bucket = b;
+                }
+            }
+        }
+
+        size_t middle;
+        if (best_axis >= 0) {
+            const Interval range = centers.axis_Interval(best_axis);
+            middle = size_t(std::partition(build.begin() + begin, build.begin() + end, [&](const Build_Light& light) {
+                return bucket_Of(light, best_axis, range) < best_bucket;
+            }) - build.begin());
+        }
+        else {
+            middle = begin;
+        }
+        if (middle == begin || middle == end) {
+            // Lights at the same place, or a subtree too deep: halve by count
+            best_axis = std::max(best_axis, 0);
+            middle = (begin + end) / 2;
+        }
+
+        build_Node(build, begin, middle, depth + 1);
+        int second = build_Node(build, middle, end, depth + 1);
+        nodes[index] = Node{bounds, second, int(end - begin), best_axis, false};
+        return index;
+    }
+
+    static int bucket_Of(const Build_Light& light, int axis, const Interval& range) {
+        double center = 0.5 * (light.bounds.box.axis_Interval(axis).min + light.bounds.box.axis_Interval(axis).max);
+        int b = int(split_buckets * (center - range.min) / range.size());
+        return std::clamp(b, 0, split_buckets - 1);
+    }
+};
+
+#endif
@@ -8,20 +8,64 @@ class Material {
 public:
     virtual ~Material() = default;
 
+    // Scatters the incoming ray, drawing random numbers from rng
+    // Returns false if the ray is absorbed
     virtual bool scatter(
-        const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered
+        const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered, Rng& rng
     ) const {
         return false;
     }
+
+    // How widely the material spreads scattered rays, as an angle in radians
+    // 0 for mirror-like materials. Used to choose how blurred a texture lookup
+    // by the scattered ray can be
+    virtual double roughness() const {
+        return 0;
+    }
+
+    // Center of the cone of directions the material scatters 'r_in' into, for materials
+    // that blur a mirror reflection by roughness(). A ray scattered so that escapes to the
+    // sky can take the light of the whole cone from the prefiltered environment map
+    // Returns false for materials that scatter otherwise
+    virtual bool reflection_Lobe(const Ray& r_in, const Hit_Record& rec, Vec3& center) const {
+        return false;
+    }
+
+    // Light emitted by the material towards the incoming ray, black for materials
+    // that don't emit light
+    virtual Color emitted(const Ray& r_in, const Hit_Record& rec) const {
+        return Color(0,0,0);
+    }
+
+    // Radiance the material emits the same in every direction, for estimating the power
+    // of lights. Black for materials that don't emit light
+    virtual Color emission() const {
+        return Color(0,0,0);
+    }
+
+    // Pdf of the scatter direction of 'scattered' for materials that scatter into any
+    // direction of the hemisphere. These materials are lit by sampling lights directly,
+    // and attenuation * scattering_Pdf is their BSDF times the cosine term.
+    // 0 for materials with specular scattering, which can't sample lights
+    virtual double scattering_Pdf(const Ray& r_in, const Hit_Record& rec, const Ray& scattered) const {
+        return 0;
+    }
+
+    // Whether the material reflects or refracts rays around a single direction, like glass
+    // and metal. These can't sample lights directly, so the light they focus onto diffuse
+    // surfaces (caustics) is gathered from caustic photons instead
+    virtual bool specular() const {
+        return false;
+    }
 };
 
 class Lambertian : public Material {
 public:
     Lambertian(const Color& albedo) : albedo(albedo) {}
 
-    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered)
+    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered, Rng& rng)
     const override{
-        auto scatter_direction = rec.normal + random_Unit_Vector();
+        auto scatter_direction = rec.normal + random_Unit_Vector(rng);
 
         // Catch defenerate scatter direction
         if (scatter_direction.near_Zero()) {
@@ -33,6 +77,17 @@ public:
         return true;
     }
 
+    // Diffuse scattering spreads over the whole hemisphere
+    double roughness() const override {
+        return 1.0;
+    }
+
+    // normal + random unit vector is cosine distributed around the normal
+    double scattering_Pdf(const Ray& r_in, const Hit_Record& rec, const Ray& scattered) const override {
+        double cos_theta = dot(rec.normal, unit_Vector(scattered.direction()));
+        return cos_theta < 0 ? 0 : cos_theta / pi;
+    }
+
 private:
     Color albedo;
 };
@@ -41,15 +96,33 @@ class Metal : public Material {
 public:
     Metal(const Color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
-    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered)
+    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered, Rng& rng)
     const override {
         Vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_Vector(reflected) + (fuzz * random_Unit_Vector());
+        reflected = unit_Vector(reflected) + (fuzz * random_Unit_Vector(rng));
         scattered = Ray(rec.p, reflected);
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0); 
     }
 
+    // Fuzzed reflections spread over a cone of about 'fuzz' radians
+    double roughness() const override {
+        return fuzz;
+    }
+
+    bool specular() const override {
+        return true;
+    }
+
+    // Fuzzed reflections scatter around the mirror direction
+    bool reflection_Lobe(const Ray& r_in, const Hit_Record& rec, Vec3& center) const override {
+        if (fuzz <= 0) {
+            return false;
+        }
+        center = unit_Vector(reflect(r_in.direction(), rec.normal));
+        return true;
+    }
+
 private:
     Color albedo;
     double fuzz;
@@ -59,7 +132,7 @@ class Dielectric : public Material {
 public:
     Dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered)
+    bool scatter(const Ray& r_in, const Hit_Record& rec, Color& attenuation, Ray& scattered, Rng& rng)
     const override {
         attenuation = Color(1.0,1.0,1.0);
         double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
@@ -71,7 +144,7 @@ public:
         bool cannot_refract = ri * sin_theta > 1.5;
         Vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double()) {
+        if (cannot_refract || reflectance(cos_theta, ri) > random_double(rng)) {
             direction = reflect(unit_direction, rec.normal);
         } else {
             direction = refract(unit_direction, rec.normal, ri);
@@ -81,6 +154,10 @@ public:
         return true;
     }
 
+    bool specular() const override {
+        return true;
+    }
+
 private:
     // Refractive index in vacuum or air, or the ratio of the materials refractive index
     // over the refractive index of the enclosing material
@@ -95,4 +172,21 @@ private:
 
 };
 
+// Diffuse_Light emits light equally in all directions and does not scatter
+class Diffuse_Light : public Material {
+public:
+    Diffuse_Light(const Color& emit) : emit(emit) {}
+
+    Color emitted(const Ray& r_in, const Hit_Record& rec) const override {
+        return emit;
+    }
+
+    Color emission() const override {
+        return emit;
+    }
+
+private:
+    Color emit;     // Emitted radiance
+};
+
 #endif
\ No newline at end of file
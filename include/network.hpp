@@ -0,0 +1,258 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+// Minimal blocking TCP sockets over Winsock or BSD sockets, with message framing
+// Used by the distributed renderer to talk between the coordinator and its workers
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+    #define NOMINMAX            // Keep the min and max macros from hiding std::min and std::max
+    #endif
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    using socket_t = SOCKET;
+    const socket_t invalid_socket = INVALID_SOCKET;
+#else
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/select.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+    using socket_t = int;
+    const socket_t invalid_socket = -1;
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Starts up the socket library once per process (only needed on Windows)
+inline void network_Init() {
+#ifdef _WIN32
+    static bool initialized = false;
+    if (!initialized) {
+        WSADATA wsa_data;
+        WSAStartup(MAKEWORD(2, 2), &wsa_data);
+        initialized = true;
+    }
+#endif
+}
+
+inline void close_Socket(socket_t sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+// Message header sent before every payload
+// NOTE: fields are sent in host byte order, coordinator and workers are assumed
+// to run on machines of the same endianness
+struct Message_Header {
+    uint32_t type;  // Application defined message type
+    uint32_t size;  // Payload size in bytes following the header
+};
+
+// Socket owns a connected or listening TCP socket and closes it on destruction
+class Socket {
+public:
+    Socket() : sock(invalid_socket) {}
+    explicit Socket(socket_t sock) : sock(sock) {}
+    ~Socket() { close(); }
+
+    // Sockets can be moved but not copied
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&& other) noexcept : sock(other.sock) { other.sock = invalid_socket; }
+    Socket& operator=(Socket&& other) noexcept {
+        if (this != &other) {
+            close();
+            sock = other.sock;
+            other.sock = invalid_socket;
+        }
+        return *this;
+    }
+
+    bool valid() const { return sock != invalid_socket; }
+
+    void close() {
+        if (valid()) {
+            close_Socket(sock);
+            sock = invalid_socket;
+        }
+    }
+
+    // Creates a socket listening on host:port. Port 0 picks a free port, see local_Port()
+    static Socket listen_On(const std::string& host, int port, int backlog = 64) {
+        network_Init();
+        Socket s(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!s.valid()) {
+            return s;
+        }
+
+        int reuse = 1;
+        setsockopt(s.sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+        sockaddr_in addr = make_Address(host, port);
+        if (::bind(s.sock, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(s.sock, backlog) != 0) {
+            s.close();
+        }
+        return s;
+    }
+
+    // Connects to a listening socket at host:port
+    static Socket connect_To(const std::string& host, int port) {
+        network_Init();
+        Socket s(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!s.valid()) {
+            return s;
+        }
+
+        sockaddr_in addr = make_Address(host, port);
+        if (::connect(s.sock, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            s.close();
+            return s;
+        }
+        s.set_No_Delay();
+        return s;
+    }
+
+    // Waits up to timeout_ms for an incoming connection, returns an invalid socket on timeout
+    Socket accept_Connection(int timeout_ms) {
+        if (!wait_Readable(timeout_ms)) {
+            return Socket();
+        }
+        Socket client(::accept(sock, nullptr, nullptr));
+        if (client.valid()) {
+            client.set_No_Delay();
+        }
+        return client;
+    }
+
+    // Makes sends fail once they make no progress for timeout_ms, instead of waiting forever
+    // for a peer that stopped reading
+    void set_Send_Timeout(int timeout_ms) {
+#ifdef _WIN32
+        DWORD timeout = DWORD(timeout_ms);
+#else
+        timeval timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+    }
+
+    // Ends the connection in both directions without closing the socket, so other threads
+    // blocked on it return with an error instead of using a closed handle
+    void disconnect() {
+        if (valid()) {
+#ifdef _WIN32
+            ::shutdown(sock, SD_BOTH);
+#else
+            ::shutdown(sock, SHUT_RDWR);
+#endif
+        }
+    }
+
+    // Returns the port this socket is bound to
+    int local_Port() const {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(sock, (sockaddr*)&addr, &len) != 0) {
+            return -1;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    // Returns true once data (or a connection, or a close) is ready to be read,
+    // false if timeout_ms passes first. A negative timeout waits forever
+    bool wait_Readable(int timeout_ms) const {
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(sock, &read_set);
+
+        timeval timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+        int ready = ::select(int(sock) + 1, &read_set, nullptr, nullptr, timeout_ms < 0 ? nullptr : &timeout);
+        return ready > 0;
+    }
+
+    // Sends exactly size bytes, returns false if the connection failed
+    bool send_All(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            int sent = ::send(sock, bytes, int(size), send_flags);
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // Receives exactly size bytes, returns false if the connection closed or failed
+    bool recv_All(void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            int received = ::recv(sock, bytes, int(size), 0);
+            if (received <= 0) {
+                return false;
+            }
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    // Sends a framed message: header followed by the payload
+    bool send_Message(uint32_t type, const void* payload, size_t size) {
+        Message_Header header{type, uint32_t(size)};
+        return send_All(&header, sizeof(header)) && (size == 0 || send_All(payload, size));
+    }
+
+    // Receives a framed message, resizing payload to fit
+    bool recv_Message(uint32_t& type, std::vector<char>& payload) {
+        Message_Header header;
+        if (!recv_All(&header, sizeof(header))) {
+            return false;
+        }
+        type = header.type;
+        payload.resize(header.size);
+        return header.size == 0 || recv_All(payload.data(), header.size);
+    }
+
+private:
+    socket_t sock;
+
+#ifdef MSG_NOSIGNAL
+    static const int send_flags = MSG_NOSIGNAL;   // Don't raise SIGPIPE when a peer dies
+#else
+    static const int send_flags = 0;
+#endif
+
+    static sockaddr_in make_Address(const std::string& host, int port) {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(uint16_t(port));
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+        return addr;
+    }
+
+    // Tiles are small messages, so disable Nagle's algorithm to avoid delaying them
+    void set_No_Delay() {
+        int flag = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+    }
+};
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef PATH_GUIDE_H
+#define PATH_GUIDE_H
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// A direction and where it maps to on the unit square the direction trees split, by
+// cylindrical coordinates x = (cos theta + 1) / 2 and y = phi / 2pi. The map preserves
+// area, so a density over the square is 4 pi times the density over directions
+struct Guide_Direction {
+    Vec3 direction;
+    double x, y;
+
+    Guide_Direction() : x(0), y(0) {}
+
+    explicit Guide_Direction(const Vec3& v) : direction(v) {
+        Vec3 d = unit_Vector(v);
+        x = std::clamp((d.z() + 1) / 2, 0.0, 1.0);
+        double phi = std::atan2(d.y(), d.x());
+        y = std::clamp((phi < 0 ? phi + 2 * pi : phi) / (2 * pi), 0.0, 1.0);
+    }
+
+    static Guide_Direction from_Square(double x, double y) {
+        double cos_theta = 2 * x - 1;
+        double sin_theta = std::sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+        double phi = 2 * pi * y;
+        Guide_Direction d;
+        d.direction = Vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+        d.x = x;
+        d.y = y;
+        return d;
+    }
+};
+
+// Direction_Tree is a distribution over the sphere of directions, learned from samples of
+// the light arriving from each direction (the directional quadtree of Müller et al.'s
+// "Practical Path Guiding"). The quadtree splits the unit square of Guide_Direction, so
+// its cells at each level have equal solid angle, and refines where most light comes from
+// Render threads record into a tree at the same time, into its leaves only; the sums of
+// the inner nodes and the structure only change between iterations
+class Direction_Tree {
+public:
+    Direction_Tree() : nodes(1) {}
+
+    Direction_Tree(const Direction_Tree& other) : nodes(other.nodes), samples(other.samples.load()) {}
+
+    Direction_Tree& operator=(const Direction_Tree& other) {
+        nodes = other.nodes;
+        samples.store(other.samples.load());
+        return *this;
+    }
+
+    // Sum of the recorded light over all directions, once build_Sums was called
+    double total() const {
+        return nodes[0].sum();
+    }
+
+    uint64_t sample_Count() const {
+        return samples.load(std::memory_order_relaxed);
+    }
+
+    // Sets the sample count, e.g. to share it out between the halves of a split region
+    void set_Sample_Count(uint64_t count) {
+        samples.store(count);
+    }
+
+    size_t node_Count() const {
+        return nodes.size();
+    }
+
+    // Adds 'value' of light arriving from 'direction'
+    void record(const Guide_Direction& direction, double value) {
+        samples.fetch_add(1, std::memory_order_relaxed);
+        if (!(value > 0) || !std::isfinite(value)) {
+            return;
+        }
+        double x = direction.x, y = direction.y;
+        uint32_t node = 0;
+        int q = quadrant(x, y);
+        while (nodes[node].child[q] != 0) {
+            node = nodes[node].child[q];
+            q = quadrant(x, y);
+        }
+        add_Atomic(nodes[node].energy[q], float(value));
+    }
+
+    // Sums the light recorded in the leaves up into the inner nodes
+    // Children come after their parents, so a backwards pass sums every child first
+    void build_Sums() {
+        for (size_t node = nodes.size(); node-- > 0;) {
+            for (int q = 0; q < 4; q++) {
+                if (nodes[node].child[q] != 0) {
+                    nodes[node].energy[q].store(float(nodes[nodes[node].child[q]].sum()));
+                }
+            }
+        }
+    }
+
+    // Pdf over solid angle of sampling 'direction' with sample
+    // Uniform over the sphere if nothing was recorded
+    double pdf(const Guide_Direction& direction) const {
+        double x = direction.x, y = direction.y;
+        double density = 1;     // Over the unit square
+        uint32_t node = 0;
+        while (true) {
+            double sum = nodes[node].sum();
+            if (sum <= 0) {
+                break;
+            }
+            int q = quadrant(x, y);
+            density *= 4 * nodes[node].energy[q].load(std::memory_order_relaxed) / sum;
+            if (nodes[node].child[q] == 0) {
+                break;
+            }
+            node = nodes[node].child[q];
+        }
+        return density / (4 * pi);
+    }
+
+    // Picks a direction in proportion to the recorded light
+    Guide_Direction sample(Rng& rng) const {
+        double x0 = 0, y0 = 0, size = 1;    // Square of the current node
+        uint32_t node = 0;
+        while (true) {
+            double e[4];
+            double sum = 0;
+            for (int q = 0; q < 4; q++) {
+                e[q] = nodes[node].energy[q].load(std::memory_order_relaxed);
+                sum += e[q];
+            }
+            if (sum <= 0) {
+                break;
+            }
+            double u = rng.next_Double() * sum;
+            int q = 0;
+            while (q < 3 && u >= e[q]) {
+                u -= e[q];
+                q++;
+            }
+            size /= 2;
+            x0 += (q & 1) ? size : 0;
+            y0 += (q & 2) ? size : 0;
+            if (nodes[node].child[q] == 0) {
+                break;
+            }
+            node = nodes[node].child[q];
+        }
+        return Guide_Direction::from_Square(x0 + size * rng.next_Double(), y0 + size * rng.next_Double());
+    }
+
+    // A tree with no light recorded, split where this tree recorded more than 'fraction'
+    // of its total light, at most 'max_depth' levels deep. Cells of this tree that were
+    // not split are assumed to hold their light evenly
+    Direction_Tree refined(double fraction, int max_depth) const {
+        Direction_Tree tree;
+        double threshold = fraction * total();
+        if (threshold > 0) {
+            tree.refine_Node(0, *this, 0, 0, 1, threshold, max_depth);
+        }
+        return tree;
+    }
+
+private:
+    struct Node {
+        std::atomic<float> energy[4] = {};      // Light recorded in each quadrant; floats keep
+                                                // nodes small, as lookups jump between regions
+        uint32_t child[4] = {};                 // Node splitting each quadrant, 0 if none
+
+        Node() = default;
+        Node(const Node& other) { *this = other; }
+
+        Node& operator=(const Node& other) {
+            for (int q = 0; q < 4; q++) {
+                energy[q].store(other.energy[q].load());
+                child[q] = other.child[q];
+            }
+            return *this;
+        }
+
+        double sum() const {
+            return double(energy[0].load(std::memory_order_relaxed)) + energy[1].load(std::memory_order_relaxed)
+                 + energy[2].load(std::memory_order_relaxed) + energy[3].load(std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<Node> nodes;            // nodes[0] is the root, covering the whole square
+    std::atomic<uint64_t> samples{0};   // Number of record calls, including ones carrying no light
+
+    // Quadrant of (x, y) in the unit square, which is then rescaled to the quadrant
+    static int quadrant(double& x, double& y) {
+        int q = 0;
+        x *= 2;
+        y *= 2;
+        if (x >= 1) { x -= 1; q |= 1; }
+        if (y >= 1) { y -= 1; q |= 2; }
+        return q;
+    }
+
+    static void add_Atomic(std::atomic<float>& target, float value) {
+        float current = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Splits the quadrants of node 'node' of this tree that hold more than 'threshold' in
+    // the matching node 'source_node' of 'source'. For cells that were a single leaf in
+    // source, source_energy > 0 is the light of that leaf, shared evenly by its quadrants
+    void refine_Node(uint32_t node, const Direction_Tree& source, uint32_t source_node, double source_energy,
+                     int depth, double threshold, int max_depth) {
+        for (int q = 0; q < 4; q++) {
+            bool inherited = (source_energy > 0);
+            double e = inherited ? source_energy / 4 : source.nodes[source_node].energy[q].load();
+            if (depth >= max_depth || e <= threshold) {
+                continue;
+            }
+            uint32_t child = uint32_t(nodes.size());
+            nodes.emplace_back();
+            nodes[node].child[q] = child;
+            uint32_t source_child = inherited ? 0 : source.nodes[source_node].child[q];
+            refine_Node(child, source, source_child, (source_child == 0) ? e : 0, depth + 1, threshold, max_depth);
+        }
+    }
+};
+
+// The learned light of one region of space: the distribution sampled in the current
+// iteration, learned in the previous one, and the one recording the current iteration
+class Guide_Region {
+public:
+    Direction_Tree sampling;
+    Direction_Tree recording;
+
+    // Whether the region learned enough to sample from
+    bool guiding() const {
+        return sampling.total() > 0;
+    }
+
+    // Records light 'reflected' from 'direction', found along a direction sampled with 'pdf'
+    // Luminance over pdf makes the recorded light of a cell estimate the integral of the
+    // reflected light over its directions
+    void record(const Guide_Direction& direction, const Color& reflected, double pdf) {
+        recording.record(direction, (0.2126 * reflected.x() + 0.7152 * reflected.y() + 0.0722 * reflected.z()) / pdf);
+    }
+};
+
+// Path_Guide learns where light comes from during a render and guides the paths of later
+// samples towards it (Müller et al. "Practical Path Guiding"). Space is split by an
+// adaptive binary tree into regions, each with a directional quadtree of the light
+// arriving there. Renders run in iterations: every iteration samples from the trees
+// learned in the last one and records into new ones, refined where the last ones saw most
+// light, and regions that recorded many samples are split
+// Only the recording trees change while rendering; end_Iteration must not run at the
+// same time as rendering
+class Path_Guide {
+public:
+    double guided_fraction = 0.5;           // Share of scatter directions drawn from the learned light
+    int guided_bounces = 8;                 // Bounces of each path that are guided and recorded
+    int spatial_split_samples = 12000;       // Samples a region records before it is split
+                                            // (times sqrt(2^iteration), as iterations grow)
+    double direction_split_fraction = 0.01; // Share of a region's light that makes a direction cell split
+    int max_direction_depth = 20;
+
+    Path_Guide() {
+        nodes.push_back(Spatial_Node{});
+        regions.push_back(std::make_unique<Region_Bounds>());
+    }
+
+    // The region holding point p
+    Guide_Region& region_At(const Point3& p) {
+        uint32_t node = 0;
+        while (nodes[node].region < 0) {
+            const Spatial_Node& n = nodes[node];
+            node = n.child[p[n.axis] < n.split ? 0 : 1];
+        }
+        Region_Bounds& region = *regions[nodes[node].region];
+        region.extend(p);
+        return region.guide;
+    }
+
+    // Pdf of a scatter direction at a surface whose BSDF samples it with 'bsdf_pdf'
+    double mixed_Pdf(const Guide_Region& region, double bsdf_pdf, const Guide_Direction& direction) const {
+        if (!region.guiding()) {
+            return bsdf_pdf;
+        }
+        return guided_fraction * region.sampling.pdf(direction) + (1 - guided_fraction) * bsdf_pdf;
+    }
+
+    // Ends an iteration: splits regions that recorded many samples, makes the recorded
+    // trees the ones sampled next, and refines them into new recording trees
+    void end_Iteration() {
+        const double split_samples = spatial_split_samples * std::sqrt(std::pow(2.0, iteration));
+        for (uint32_t node = 0; node < nodes.size(); node++) {
+            // Children are appended, so they are visited and split further in this loop
+            if (nodes[node].region >= 0) {
+                split_Region(node, split_samples);
+            }
+        }
+
+        for (auto& region : regions) {
+            Guide_Region& guide = region->guide;
+            guide.recording.build_Sums();
+            guide.sampling = guide.recording;
+            guide.recording = guide.sampling.refined(direction_split_fraction, max_direction_depth);
+        }
+        iteration++;
+    }
+
+    int iterations() const {
+        return iteration;
+    }
+
+    void print_Stats(std::ostream& out) const {
+        size_t direction_nodes = 0;
+        for (const auto& region : regions) {
+            direction_nodes += region->guide.sampling.node_Count();
+        }
+        out << "Path guiding: " << iteration << " iterations, " << regions.size() << " regions, "
+            << double(direction_nodes) / regions.size() << " direction nodes per region\n";
+    }
+
+private:
+    // Node of the spatial tree, a leaf if it has a region
+    struct Spatial_Node {
+        int axis = 0;               // Axis the node splits
+        double split = 0;           // Points below split on that axis are in child 0
+        uint32_t child[2] = {};
+        int region = 0;             // Index of the region of a leaf, -1 for inner nodes
+    };
+
+    // A region and the bounding box of the points it was looked up for, which is where
+    // it gets split
+    struct Region_Bounds {
+        Guide_Region guide;
+        std::atomic<double> low[3] = {infinity, infinity, infinity};
+        std::atomic<double> high[3] = {-infinity, -infinity, -infinity};
+
+        void extend(const Point3& p) {
+            for (int a = 0; a < 3; a++) {
+                // Points inside the box only cost two loads
+                double l = low[a].load(std::memory_order_relaxed);
+                while (p[a] < l && !low[a].compare_exchange_weak(l, p[a], std::memory_order_relaxed)) {
+                }
+                double h = high[a].load(std::memory_order_relaxed);
+                while (p[a] > h && !high[a].compare_exchange_weak(h, p[a], std::memory_order_relaxed)) {
+                }
+            }
+        }
+    };
+
+    std::vector<Spatial_Node> nodes;    // nodes[0] is the root, covering all of space
+    std::vector<std::unique_ptr<Region_Bounds>> regions;
+    int iteration = 0;
+
+    // Splits the region of leaf 'node' in half across the longest axis of its bounding box
+    // if it recorded more than split_samples samples. Both halves start with copies of its
+    // trees, each assumed to hold half of its samples
+    void split_Region(uint32_t node, double split_samples) {
+        Region_Bounds& region = *regions[nodes[node].region];
+        uint64_t samples = region.guide.recording.sample_Count();
+        if (samples <= split_samples) {
+            return;
+        }
+        int axis = 0;
+        double extent = -1;
+        for (int a = 0; a < 3; a++) {
+            double size = region.high[a].load() - region.low[a].load();
+            if (size > extent) {
+                extent = size;
+                axis = a;
+            }
+        }
+        if (!(extent > 1e-6)) {
+            return;
+        }
+
+        double split = (region.low[axis].load() + region.high[axis].load()) / 2;
+        auto upper = std::make_unique<Region_Bounds>();
+        upper->guide.recording = region.guide.recording;
+        region.guide.recording.set_Sample_Count(samples / 2);
+        upper->guide.recording.set_Sample_Count(samples - samples / 2);
+        for (int a = 0; a < 3; a++) {
+            upper->low[a].store(a == axis ? split : region.low[a].load());
+            upper->high[a].store(region.high[a].load());
+        }
+        region.high[axis].store(split);
+
+        Spatial_Node lower_leaf, upper_leaf;
+        lower_leaf.region = nodes[node].region;
+        upper_leaf.region = int(regions.size());
+        regions.push_back(std::move(upper));
+
+        nodes[node].axis = axis;
+        nodes[node].split = split;
+        nodes[node].region = -1;
+        nodes[node].child[0] = uint32_t(nodes.size());
+        nodes[node].child[1] = uint32_t(nodes.size() + 1);
+        nodes.push_back(lower_leaf);
+        nodes.push_back(upper_leaf);
+    }
+};
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+// Caustic photon map (after Jensen, "Global Illumination using Photon Maps"), progressive by
+// shrinking the gather radius from pass to pass (after Knaus and Zwicker, "Progressive
+// Photon Mapping: A Probabilistic Approach")
+// Light that glass or metal focus onto a diffuse surface only reaches a camera path if its
+// diffuse bounce happens to scatter towards the specular object and on through it to the
+// light, so path traced caustics stay fireflies for hundreds of samples. Photons are traced
+// the other way: from the lights and the sky, aimed at the specular objects, through them,
+// and stored where they land on a diffuse surface. Every diffuse hit of a camera path adds
+// the density of the photons around it, and its scattered ray leaves out the light that
+// reaches it through specular surfaces only, which the photons stand for
+// Photons are kept in a hashed grid of cells as wide as the gather diameter. Every pass
+// traces new photons and gathers them with a smaller radius, r_(i+1)^2 = r_i^2 (i + alpha) / (i + 1),
+// so averaging the passes of a progressive render converges to the blur-free caustic
+
+#include "common.hpp"
+#include "scene.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+class Caustic_Photons {
+public:
+    int photons_per_pass = 100000;  // Photons emitted per pass, including those that never reach a diffuse surface
+    double initial_radius = 0.05;   // Gather radius of the first pass, in scene units
+    double alpha = 2.0 / 3.0;       // Share of the photon density each pass keeps: lower shrinks the radius faster
+    int max_bounces = 8;            // Specular surfaces a photon passes before it is dropped
+
+    // Traces the photons of the next pass and gathers with the next, smaller radius
+    // sky(direction) is the radiance arriving from the sky along -direction; it must be
+    // safe to call from several threads at once
+    template <typename Sky>
+    void trace_Pass(const Scene& scene, Sky&& sky, int num_threads) {
+        Trace_Scope trace_pass("caustic photons", "render", passes);
+        radius_squared = (passes == 0) ? initial_radius * initial_radius
+                                       : radius_squared * (passes + alpha) / (passes + 1);
+        passes++;
+        find_Sources(scene);
+
+        // Split the photons between the sky and the lights by the caustic power each
+        // delivered in the last pass, keeping a few for a source that delivered little
+        double sky_share = 0;
+        if (!targets.empty()) {
+            sky_share = lights.empty() ? 1.0 : 0.5;
+            if (!lights.empty() && sky_delivered + light_delivered > 0) {
+                sky_share = std::clamp(sky_delivered / (sky_delivered + light_delivered), 0.05, 0.95);
+            }
+        }
+        const int sky_photons = targets.empty() ? 0 : int(photons_per_pass * sky_share);
+        const int light_photons = targets.empty() ? 0 : photons_per_pass - sky_photons;
+
+        num_threads = std::max(1, num_threads);
+        std::vector<std::vector<Photon>> stored(num_threads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                for (int i = t; i < sky_photons + light_photons; i += num_threads) {
+                    Rng rng((uint64_t(passes) << 32) | uint32_t(i));
+                    Ray ray;
+                    Color power;
+                    bool emitted = (i < sky_photons) ? emit_From_Sky(sky, rng, ray, power)
+                                                     : emit_From_Light(rng, ray, power);
+                    if (emitted) {
+                        trace_Photon(scene, ray, power / ((i < sky_photons) ? sky_photons : light_photons),
+                                     i < sky_photons, rng, stored[t]);
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        std::vector<Photon> all;
+        for (const auto& photons : stored) {
+            all.insert(all.end(), photons.begin(), photons.end());
+        }
+        sky_delivered = light_delivered = 0;
+        for (const Photon& photon : all) {
+            double luminance = 0.2126 * photon.power[0] + 0.7152 * photon.power[1] + 0.0722 * photon.power[2];
+            (photon.from_sky ? sky_delivered : light_delivered) += luminance;
+        }
+        stored_photons += all.size();
+        emitted_photons += uint64_t(sky_photons) + light_photons;
+        build_Grid(std::move(all));
+    }
+
+    // Starts over from the first pass and the initial radius
+    void restart() {
+        passes = 0;
+        photons.clear();
+        cell_start.assign(1, 0);
+        sky_delivered = light_delivered = 0;
+    }
+
+    // Whether a pass was traced since the start, so there are photons to gather
+    bool traced() const { return passes > 0; }
+
+    double radius() const { return std::sqrt(radius_squared); }
+
+    // Irradiance arriving at 'p' through specular surfaces, from the photons of the current
+    // pass that landed within the gather radius on the side 'normal' faces
+    Color irradiance(const Point3& p, const Vec3& normal) const {
+        if (photons.empty()) {
+            return Color(0,0,0);
+        }
+        const double radius = std::sqrt(radius_squared);
+
+        // The gather disk lies within 2 cells along each axis, found at most once each
+        // even where their hashes collide
+        uint32_t cells[8];
+        int cell_count = 0;
+        int low[3];
+        for (int a = 0; a < 3; a++) {
+            low[a] = int(std::floor((p[a] - radius) / cell_size));
+        }
+        for (int c = 0; c < 8; c++) {
+            uint32_t cell = cell_Hash(low[0] + (c & 1), low[1] + ((c >> 1) & 1), low[2] + ((c >> 2) & 1));
+            if (std::find(cells, cells + cell_count, cell) == cells + cell_count) {
+                cells[cell_count++] = cell;
+            }
+        }
+
+        // Photons on other surfaces close by, such as the far side of a thin object, are
+        // told apart by their distance from the tangent plane
+        double sum[3] = {0, 0, 0};
+        for (int c = 0; c < cell_count; c++) {
+            for (uint32_t k = cell_start[cells[c]]; k < cell_start[cells[c] + 1]; k++) {
+                const Photon& photon = photons[k];
+                Vec3 offset(photon.position[0] - p.x(), photon.position[1] - p.y(), photon.position[2] - p.z());
+                Vec3 direction(photon.direction[0], photon.direction[1], photon.direction[2]);
+                if (offset.length_Squared() > radius_squared || dot(direction, normal) >= 0
+                    || std::fabs(dot(offset, normal)) > 0.25 * radius) {
+                    continue;
+                }
+                for (int i = 0; i < 3; i++) {
+                    sum[i] += photon.power[i];
+                }
+            }
+        }
+        double area = pi * radius_squared;
+        return Color(sum[0] / area, sum[1] / area, sum[2] / area);
+    }
+
+    void print_Stats(std::ostream& out) const {
+        out << "Caustic photons: " << passes << " passes, " << stored_photons << " of " << emitted_photons
+            << " photons stored, gather radius " << radius() << "\n";
+    }
+
+private:
+    struct Photon {
+        float position[3];
+        float direction[3];     // Direction the photon travelled, unit length
+        float power[3];         // Share of the emitted power the photon carries
+        bool from_sky;
+    };
+
+    // Bounding sphere of a specular object, which photons are aimed at
+    struct Target {
+        Point3 center;
+        double radius;
+        double weight;          // Chance of aiming at it
+    };
+
+    struct Light {
+        const Hittable* object;
+        double cdf;             // Chance of emitting from this light or one before it
+        double probability;
+    };
+
+    std::vector<Target> targets;
+    std::vector<Light> lights;
+    Point3 scene_center;
+    double scene_radius = 0;
+
+    std::vector<Photon> photons;        // Sorted by cell
+    std::vector<uint32_t> cell_start;   // Photons of cell h are [cell_start[h], cell_start[h + 1])
+    double cell_size = 1;
+    double radius_squared = 0;
+    int passes = 0;
+    double sky_delivered = 0;           // Caustic power the sky and the lights delivered in the last pass, as luminance
+    double light_delivered = 0;
+    uint64_t stored_photons = 0;        // Since the first pass
+    uint64_t emitted_photons = 0;
+
+    // Finds the specular objects photons are aimed at, the lights they start from, and the
+    // sphere around the scene sky photons start outside of
+    void find_Sources(const Scene& scene) {
+        targets.clear();
+        lights.clear();
+        AABB bounds;
+        double light_power = 0;
+        scene.visit_Objects([&](const Hittable& object) {
+            AABB box;
+            if (object.bounding_Box(box)) {
+                bounds = AABB(bounds, box);
+            }
+            if (object.specular_Bounds(box)) {
+                Point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+                double radius = 0.5 * Vec3(box.x.size(), box.y.size(), box.z.size()).length();
+                targets.push_back(Target{center, radius, radius * radius});
+            }
+            Light_Bounds light;
+            if (object.light_Bounds(light)) {
+                light_power += light.power;
+                lights.push_back(Light{&object, light_power, light.power});
+            }
+        });
+        for (Light& light : lights) {
+            light.cdf /= light_power;
+            light.probability /= light_power;
+        }
+        double weight_sum = 0;
+        for (const Target& target : targets) {
+            weight_sum += target.weight;
+        }
+        for (Target& target : targets) {
+            target.weight /= weight_sum;
+        }
+        scene_center = Point3(0.5 * (bounds.x.min + bounds.x.max), 0.5 * (bounds.y.min + bounds.y.max),
+                              0.5 * (bounds.z.min + bounds.z.max));
+        scene_radius = 0.5 * Vec3(bounds.x.size(), bounds.y.size(), bounds.z.size()).length();
+    }
+
+    const Target& pick_Target(Rng& rng) const {
+        double u = rng.next_Double();
+        for (const Target& target : targets) {
+            if (u < target.weight) {
+                return target;
+            }
+            u -= target.weight;
+        }
+        return targets.back();
+    }
+
+    // A photon from the sky: a direction 'from' towards the sky, uniform over the sphere,
+    // and a point on the disk facing it across a target. The photon starts beyond the
+    // scene along 'from'. Its power is divided by the density of such lines for every
+    // target whose disk it crosses, as it could have been aimed at any of them
+    template <typename Sky>
+    bool emit_From_Sky(Sky&& sky, Rng& rng, Ray& ray, Color& power) const {
+        Vec3 from = random_Unit_Vector(rng);
+        const Target& target = pick_Target(rng);
+        Vec3 t, b;
+        build_Orthonormal_Basis(from, t, b);
+        Vec3 disk = random_In_Unit_Disk(rng);
+        Point3 on_disk = target.center + target.radius * (disk.x() * t + disk.y() * b);
+
+        double density = 0;
+        for (const Target& other : targets) {
+            Vec3 v = other.center - on_disk;
+            double along = dot(v, from);
+            if (v.length_Squared() - along * along < other.radius * other.radius) {
+                density += other.weight / (pi * other.radius * other.radius);
+            }
+        }
+        Color radiance = sky(from);
+        if (density <= 0 || radiance.near_Zero()) {
+            return false;
+        }
+        double distance = scene_radius + (on_disk - scene_center).length();
+        ray = Ray(on_disk + distance * from, -from);
+        power = radiance * (4 * pi / density);
+        return true;
+    }
+
+    // A photon from a light: a point on a light chosen by its power, and a direction within
+    // the cone from it to a target. Its power is divided by the density of that direction
+    // for every target whose cone holds it
+    bool emit_From_Light(Rng& rng, Ray& ray, Color& power) const {
+        double u = rng.next_Double();
+        const Light* light = &lights.back();
+        for (const Light& l : lights) {
+            if (u < l.cdf) {
+                light = &l;
+                break;
+            }
+        }
+        Point3 point;
+        Vec3 normal;
+        Color radiance;
+        double area;
+        if (!light->object->sample_Emitter(rng, point, normal, radiance, area)) {
+            return false;
+        }
+
+        const Target& target = pick_Target(rng);
+        Vec3 to_target = target.center - point;
+        double distance_squared = to_target.length_Squared();
+        if (distance_squared <= target.radius * target.radius) {
+            return false;
+        }
+        double cos_theta_max = std::sqrt(1 - target.radius * target.radius / distance_squared);
+        double z = 1 + rng.next_Double() * (cos_theta_max - 1);
+        double phi = 2 * pi * rng.next_Double();
+        double sin_theta = std::sqrt(std::max(0.0, 1 - z * z));
+        Vec3 t, b;
+        Vec3 w = unit_Vector(to_target);
+        build_Orthonormal_Basis(w, t, b);
+        Vec3 direction = (std::cos(phi) * sin_theta) * t + (std::sin(phi) * sin_theta) * b + z * w;
+
+        double cos_light = dot(direction, normal);
+        if (cos_light <= 0) {
+            return false;
+        }
+        double density = 0;
+        for (const Target& other : targets) {
+            Vec3 v = other.center - point;
+            double d2 = v.length_Squared();
+            if (d2 <= other.radius * other.radius) {
+                continue;
+            }
+            double cos_other = std::sqrt(1 - other.radius * other.radius / d2);
+            if (dot(direction, v) >= cos_other * std::sqrt(d2)) {
+                density += other.weight / (2 * pi * (1 - cos_other));
+            }
+        }
+        if (density <= 0) {
+            return false;
+        }
+        ray = Ray(point, direction);
+        power = radiance * (cos_light * area / (light->probability * density));
+        return true;
+    }
+
+    // Follows a photon through specular surfaces and stores it where it lands on a diffuse
+    // one. Photons reaching a diffuse surface first are not caustics and are dropped
+    void trace_Photon(const Scene& scene, Ray ray, Color power, bool from_sky, Rng& rng, std::vector<Photon>& out) const {
+        for (int bounce = 0; bounce <= max_bounces; bounce++) {
+            Hit_Record rec;
+            if (!scene.hit(ray, Interval(0.001, infinity), rec)) {
+                return;
+            }
+            if (rec.mat->specular()) {
+                Color attenuation;
+                Ray scattered;
+                if (!rec.mat->scatter(ray, rec, attenuation, scattered, rng)) {
+                    return;
+                }
+                power = power * attenuation;
+                ray = scattered;
+                continue;
+            }
+            if (bounce > 0 && rec.mat->roughness() >= 1.0) {
+                Vec3 d = unit_Vector(ray.direction());
+                out.push_back(Photon{{float(rec.p.x()), float(rec.p.y()), float(rec.p.z())},
+                                     {float(d.x()), float(d.y()), float(d.z())},
+                                     {float(power.x()), float(power.y()), float(power.z())}, from_sky});
+            }
+            return;
+        }
+    }
+
+    uint32_t cell_Hash(int x, int y, int z) const {
+        uint32_t h = uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u;
+        return h & uint32_t(cell_start.size() - 2);
+    }
+
+    // Sorts the photons by the hash of their cell (a counting sort), with cells as wide as
+    // the gather diameter and a table of at least two cells per photon
+    void build_Grid(std::vector<Photon> stored) {
+        cell_size = 2 * std::sqrt(radius_squared);
+        size_t table_size = 1;
+        while (table_size < 2 * stored.size()) {
+            table_size *= 2;
+        }
+        cell_start.assign(table_size + 1, 0);
+        std::vector<uint32_t> cells(stored.size());
+        for (size_t k = 0; k < stored.size(); k++) {
+            const float* position = stored[k].position;
+            cells[k] = cell_Hash(int(std::floor(position[0] / cell_size)), int(std::floor(position[1] / cell_size)),
+                                 int(std::floor(position[2] / cell_size)));
+            cell_start[cells[k] + 1]++;
+        }
+        for (size_t h = 0; h < table_size; h++) {
+            cell_start[h + 1] += cell_start[h];
+        }
+        photons.resize(stored.size());
+        std::vector<uint32_t> next(cell_start.begin(), cell_start.end() - 1);
+        for (size_t k = 0; k < stored.size(); k++) {
+            photons[next[cells[k]]++] = stored[k];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Small operating system helpers that differ between Windows and POSIX
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+    #define NOMINMAX            // Keep the min and max macros from hiding std::min and std::max
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <sys/resource.h>
+    #include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Returns the id of the running process
+inline uint32_t current_Process_Id() {
+#ifdef _WIN32
+    return uint32_t(GetCurrentProcessId());
+#else
+    return uint32_t(getpid());
+#endif
+}
+
+// Returns the most memory the process has had resident at once, in bytes
+inline uint64_t peak_Resident_Bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return uint64_t(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss);           // Bytes on macOS
+#else
+    return uint64_t(usage.ru_maxrss) * 1024;    // Kilobytes on Linux
+#endif
+#endif
+}
+
+// Moves 'source' over 'target', replacing it. Used to publish files that were written
+// under a temporary name, so readers never see a partly written file
+inline bool replace_File(const std::string& source, const std::string& target) {
+#ifdef _WIN32
+    // rename does not replace existing files on Windows
+    std::remove(target.c_str());
+#endif
+    return std::rename(source.c_str(), target.c_str()) == 0;
+}
+
+// Switches a standard stream to binary, so raw image data written to it is not altered
+// Windows would otherwise translate every 0x0A byte into a line ending
+inline void set_Binary_Mode(FILE* stream) {
+#ifdef _WIN32
+    _setmode(_fileno(stream), _O_BINARY);
+#else
+    (void)stream;
+#endif
+}
+
+#endif
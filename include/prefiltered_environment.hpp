@@ -0,0 +1,204 @@
+#ifndef PREFILTERED_ENVIRONMENT_H
+#define PREFILTERED_ENVIRONMENT_H
+
+// Environment map prefiltered by the reflection lobes of fuzzy metals
+// A Metal of fuzz f reflects into normalize(mirror + f * random unit vector). Level k of
+// the chain stores, for every direction, the average of the environment map over that lobe
+// around it for f = 2^-k, so a fuzzy reflection escaping to the sky reads the light of its
+// whole lobe in one lookup instead of the one direction it sampled. Lookups between two
+// levels blend them. The levels are lat-long images like the map, smaller for rougher
+// levels, and are built once per map and kept in the asset cache
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Prefilter file layout (host byte order): the magic, int32 level count, then per level
+// int32 width and height followed by its texels, row-major, as 3 floats each
+const char prefilter_file_magic[8] = {'S','R','T','P','F','L','0','1'};
+
+class Prefiltered_Environment {
+public:
+    static constexpr int level_count = 6;       // Fuzz 1 down to 1/32
+    static constexpr int lobe_samples = 128;    // Map lookups averaged per texel
+
+    bool loaded() const { return !levels.empty(); }
+
+    // Memory held by the levels
+    size_t memory_Bytes() const {
+        size_t bytes = 0;
+        for (const Level& level : levels) {
+            bytes += level.texels.size() * sizeof(float);
+        }
+        return bytes;
+    }
+
+    // Smallest fuzz the levels cover. Smoother reflections sample the map directly,
+    // their lobes are narrow enough to converge in a few samples
+    static double min_Roughness() { return std::ldexp(1.0, 1 - level_count); }
+
+    // Builds the levels from source(u, v, footprint), a lookup of the environment map at
+    // texture coordinates (u, v) blurred over a cone 'footprint' radians wide
+    // source must be safe to call from several threads at once
+    template <typename Source>
+    void build(Source&& source, int num_threads) {
+        // Lobe offsets spread evenly over the unit sphere (a Fibonacci spiral), the same
+        // for every texel so neighboring texels don't differ by sampling noise
+        std::vector<Vec3> offsets(lobe_samples);
+        const double golden_angle = pi * (3 - std::sqrt(5.0));
+        for (int s = 0; s < lobe_samples; s++) {
+            double z = 1 - (2 * s + 1) / double(lobe_samples);
+            double r = std::sqrt(std::max(0.0, 1 - z * z));
+            offsets[s] = Vec3(r * std::cos(golden_angle * s), r * std::sin(golden_angle * s), z);
+        }
+
+        std::vector<Level> built(level_count);
+        for (int k = 0; k < level_count; k++) {
+            double fuzz = std::ldexp(1.0, -k);
+            // About two texels across the lobe radius
+            Level& level = built[k];
+            level.width = 64;
+            while (level.width < 4 * pi / fuzz) {
+                level.width *= 2;
+            }
+            level.height = level.width / 2;
+            level.texels.resize(size_t(level.width) * level.height * 3);
+            // Each lookup stands for the part of the lobe between its neighbors
+            double footprint = 2 * fuzz / std::sqrt(double(lobe_samples));
+
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; t++) {
+                threads.emplace_back([&, t]() {
+                    for (int y = t; y < level.height; y += num_threads) {
+                        for (int x = 0; x < level.width; x++) {
+                            Vec3 center = direction_Of((x + 0.5) / level.width, (y + 0.5) / level.height);
+                            Color sum(0,0,0);
+                            for (const Vec3& offset : offsets) {
+                                double u, v;
+                                coordinates_Of(unit_Vector(center + fuzz * offset), u, v);
+                                sum += source(u, v, footprint);
+                            }
+                            float* texel = &level.texels[(size_t(y) * level.width + x) * 3];
+                            for (int c = 0; c < 3; c++) {
+                                texel[c] = float(sum[c] / lobe_samples);
+                            }
+                        }
+                    }
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+        levels = std::move(built);
+    }
+
+    // Average light of the lobe of a reflection of the given fuzz around 'direction'
+    // roughness must be at least min_Roughness()
+    Color sample(const Vec3& direction, double roughness) const {
+        double u, v;
+        coordinates_Of(unit_Vector(direction), u, v);
+        double lod = std::clamp(-std::log2(roughness), 0.0, double(level_count - 1));
+        int level = int(lod);
+        double t = lod - level;
+
+        Color c = bilinear(levels[level], u, v);
+        if (t > 0 && level + 1 < level_count) {
+            c = (1 - t) * c + t * bilinear(levels[level + 1], u, v);
+        }
+        return c;
+    }
+
+    bool write_File(const std::string& filename) const {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        int32_t count = int32_t(levels.size());
+        out.write(prefilter_file_magic, sizeof(prefilter_file_magic));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const Level& level : levels) {
+            int32_t size[2] = {level.width, level.height};
+            out.write(reinterpret_cast<const char*>(size), sizeof(size));
+            out.write(reinterpret_cast<const char*>(level.texels.data()), level.texels.size() * sizeof(float));
+        }
+        out.close();
+        return bool(out);
+    }
+
+    // Reads levels written by write_File. Returns false if the file is missing, damaged
+    // or was built with another number of levels
+    bool read_File(const std::string& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        char magic[8];
+        int32_t count = 0;
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, prefilter_file_magic, sizeof(magic)) != 0
+            || !in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count != level_count) {
+            return false;
+        }
+        std::vector<Level> file_levels(count);
+        for (Level& level : file_levels) {
+            int32_t size[2];
+            if (!in.read(reinterpret_cast<char*>(size), sizeof(size)) || size[0] <= 0 || size[1] <= 0
+                || size[0] > (1 << 16) || size[1] > (1 << 16)) {
+                return false;
+            }
+            level.width = size[0];
+            level.height = size[1];
+            level.texels.resize(size_t(level.width) * level.height * 3);
+            if (!in.read(reinterpret_cast<char*>(level.texels.data()), level.texels.size() * sizeof(float))) {
+                return false;
+            }
+        }
+        levels = std::move(file_levels);
+        return true;
+    }
+
+private:
+    struct Level {
+        int width = 0;
+        int height = 0;
+        std::vector<float> texels;      // RGB, row-major
+    };
+
+    std::vector<Level> levels;          // Fuzz 1, 1/2, 1/4, ...
+
+    // Texture coordinates of a unit direction, as the environment map lookup of Camera
+    static void coordinates_Of(const Vec3& d, double& u, double& v) {
+        u = 0.5 + std::atan2(d.z(), d.x()) / (2*pi);
+        v = 0.5 - std::asin(std::clamp(d.y(), -1.0, 1.0)) / pi;
+    }
+
+    // Unit direction of texture coordinates (u, v), the inverse of coordinates_Of
+    static Vec3 direction_Of(double u, double v) {
+        double phi = (u - 0.5) * 2*pi;
+        double latitude = (0.5 - v) * pi;
+        return Vec3(std::cos(latitude) * std::cos(phi), std::sin(latitude), std::cos(latitude) * std::sin(phi));
+    }
+
+    // Bilinear lookup wrapping in u and clamping in v
+    static Color bilinear(const Level& level, double u, double v) {
+        double x = u * level.width - 0.5;
+        double y = std::clamp(v * level.height - 0.5, 0.0, double(level.height - 1));
+        int x0 = int(std::floor(x));
+        int y0 = int(y);
+        double tx = x - x0;
+        double ty = y - y0;
+        int y1 = std::min(y0 + 1, level.height - 1);
+        x0 = ((x0 % level.width) + level.width) % level.width;
+        int x1 = (x0 + 1) % level.width;
+
+        auto texel = [&](int i, int j) {
+            const float* t = &level.texels[(size_t(j) * level.width + i) * 3];
+            return Color(t[0], t[1], t[2]);
+        };
+        return (1 - ty) * ((1 - tx) * texel(x0, y0) + tx * texel(x1, y0))
+             + ty * ((1 - tx) * texel(x0, y1) + tx * texel(x1, y1));
+    }
+};
+
+#endif
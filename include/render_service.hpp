@@ -0,0 +1,638 @@
+#ifndef RENDER_SERVICE_H
+#define RENDER_SERVICE_H
+
+// Long-running local render service
+// A Render_Service listens on a local TCP port for render jobs, so a pipeline can keep one
+// renderer running instead of starting a process, building the scene and loading its
+// environment map for every image. Jobs wait in a priority queue and run one at a time on
+// every render thread; queued and running jobs can be cancelled. Built scenes stay in
+// memory between jobs, and the least recently used ones are dropped once the cache holds
+// more memory than its budget. Each client receives its images as soon as they finish,
+// with the time they waited and rendered. Messages are framed as in network.hpp
+
+#include "network.hpp"
+#include "camera.hpp"
+#include "frame_settings.hpp"
+#include "scene.hpp"
+#include "tile.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Message types between clients and the render service
+enum Service_Message : uint32_t {
+    SERVICE_SUBMIT = 101,   // Client -> service: Job_Request
+    SERVICE_ACCEPTED,       // Service -> client: Job_Id, the id given to the last submitted job
+    SERVICE_CANCEL,         // Client -> service: Job_Id of a queued or running job
+    SERVICE_IMAGE,          // Service -> client: Job_Result, followed by RGB floats if the job is done
+    SERVICE_STATS,          // Client -> service: no payload. Service -> client: metrics as text
+    SERVICE_SHUTDOWN        // Client -> service: no payload, cancel every job and stop the service
+};
+
+struct Job_Request {
+    char scene[32];             // Scene name, see build_Scene, NUL terminated
+    int32_t priority;           // Higher runs first, equal priorities in submission order
+    Frame_Settings settings;    // Camera, resolution, samples per pixel and depth
+};
+
+struct Job_Id {
+    uint32_t job_id;
+};
+
+enum Job_Status : int32_t {
+    JOB_DONE = 0,
+    JOB_CANCELLED,
+    JOB_FAILED      // Unknown scene or invalid settings
+};
+
+struct Job_Result {
+    uint32_t job_id;
+    int32_t status;             // Job_Status
+    int32_t width, height;      // Image size, 0 unless done
+    double queue_ms;            // Time from submission until the job started
+    double render_ms;           // Time from start to finish, including building the scene
+};
+
+// Scene_Cache keeps built scenes in memory between jobs, evicting the least recently used
+// scenes while the cached scenes hold more than budget_bytes. Only the service's render
+// thread builds and evicts scenes; stats may be read from any thread
+class Scene_Cache {
+public:
+    size_t budget_bytes = size_t(1) << 30;
+
+    // Returns the named scene with its assets loaded, building it if it isn't cached
+    // Returns null for unknown scenes
+    shared_ptr<const Scene> acquire(const std::string& name) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto found = entries.find(name);
+        if (found != entries.end()) {
+            found->second.last_used = ++use_clock;
+            hits++;
+            return found->second.scene;
+        }
+        lock.unlock();
+
+        // Building may take a while, stats stay readable meanwhile
+        auto scene = make_shared<Scene>();
+        if (!build_Scene(name, *scene)) {
+            return nullptr;
+        }
+        scene->wait_Until_Loaded();
+
+        lock.lock();
+        builds++;
+        entries[name] = Entry{scene, ++use_clock, scene->memory_Bytes()};
+        return scene;
+    }
+
+    // Measures the memory of the cached scenes, which grows as renders read in texture
+    // tiles, and evicts scenes until they fit the budget. Scenes still in use are kept
+    void trim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (auto& entry : entries) {
+            entry.second.bytes = entry.second.scene->memory_Bytes();
+            total += entry.second.bytes;
+        }
+        while (total > budget_bytes) {
+            auto oldest = entries.end();
+            for (auto e = entries.begin(); e != entries.end(); ++e) {
+                if (e->second.scene.use_count() == 1
+                    && (oldest == entries.end() || e->second.last_used < oldest->second.last_used)) {
+                    oldest = e;
+                }
+            }
+            if (oldest == entries.end()) {
+                break;
+            }
+            total -= oldest->second.bytes;
+            entries.erase(oldest);
+            evictions++;
+        }
+    }
+
+    void print_Stats(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (const auto& entry : entries) {
+            total += entry.second.bytes;
+        }
+        out << "  Scene cache: " << entries.size() << " scenes, " << total / 1048576.0 << " MB of "
+            << budget_bytes / 1048576.0 << " MB budget, " << hits << " hits, " << builds << " builds, "
+            << evictions << " evictions\n";
+    }
+
+private:
+    struct Entry {
+        shared_ptr<Scene> scene;
+        uint64_t last_used;     // use_clock of the last job using the scene
+        size_t bytes;           // Memory of the scene when last measured
+    };
+
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    uint64_t use_clock = 0;
+    uint64_t hits = 0;
+    uint64_t builds = 0;
+    uint64_t evictions = 0;
+};
+
+class Render_Service {
+public:
+    int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    Scene_Cache scenes;
+
+    // Listens for clients on the local port. Port 0 picks a free port, see port()
+    bool listen(int port) {
+        listener = Socket::listen_On("127.0.0.1", port);
+        return listener.valid();
+    }
+
+    int port() const {
+        return listener.local_Port();
+    }
+
+    // Serves clients and renders their jobs until a client asks the service to shut down
+    void run() {
+        start_time = std::chrono::steady_clock::now();
+        std::thread renderer(&Render_Service::render_Jobs, this);
+        struct Client {
+            shared_ptr<Client_Connection> connection;
+            std::thread reader, sender;
+        };
+        std::vector<Client> clients;
+        while (!stopping.load()) {
+            Socket socket = listener.accept_Connection(poll_ms);
+            if (socket.valid()) {
+                auto connection = std::make_shared<Client_Connection>();
+                connection->socket = std::move(socket);
+                connection->socket.set_Send_Timeout(send_timeout_ms);
+                clients.push_back(Client{connection, std::thread(&Render_Service::serve_Client, this, connection),
+                                         std::thread(&Render_Service::send_Results, this, connection)});
+            }
+            // Threads of clients that disconnected are done
+            for (auto c = clients.begin(); c != clients.end(); ) {
+                if (c->connection->disconnected.load() && c->connection->results_sent.load()) {
+                    c->reader.join();
+                    c->sender.join();
+                    c = clients.erase(c);
+                }
+                else {
+                    ++c;
+                }
+            }
+        }
+        listener.close();
+        cancel([](const Render_Job&) { return true; });
+        job_ready.notify_all();
+        renderer.join();
+        // Readers close their client's results as they end. Senders get a moment to deliver
+        // the last results, then clients that still don't take them are cut off
+        for (auto& client : clients) {
+            client.reader.join();
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(shutdown_grace_ms);
+        for (auto& client : clients) {
+            while (!client.connection->results_sent.load() && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (!client.connection->results_sent.load()) {
+                client.connection->socket.disconnect();
+            }
+            client.sender.join();
+        }
+    }
+
+    // Writes the job counts, latency and throughput so far
+    void print_Stats(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        out << "Render service: up " << uptime << " s, " << queue.size() << " queued, " << (running ? 1 : 0)
+            << " running\n"
+            << "  Jobs: " << submitted << " submitted, " << completed << " done, " << cancelled << " cancelled, "
+            << failed << " failed\n";
+
+        if (!latencies_ms.empty()) {
+            std::vector<double> sorted = latencies_ms;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))]; };
+            double latency_sum = 0, queue_sum = 0;
+            for (size_t j = 0; j < latencies_ms.size(); j++) {
+                latency_sum += latencies_ms[j];
+                queue_sum += queue_ms[j];
+            }
+            out << "  Latency, submission to image: mean " << latency_sum / sorted.size() << " ms, p50 "
+                << percentile(0.5) << " ms, p95 " << percentile(0.95) << " ms; queued " << queue_sum / sorted.size()
+                << " ms on average\n";
+        }
+        out << "  Throughput: " << (uptime > 0 ? 60 * completed / uptime : 0) << " jobs/min, "
+            << (busy_seconds > 0 ? samples_rendered / busy_seconds / 1e6 : 0) << " M samples/s while rendering, busy "
+            << (uptime > 0 ? 100 * busy_seconds / uptime : 0) << "% of the time\n";
+        scenes.print_Stats(out);
+    }
+
+private:
+    static const int poll_ms = 200;             // How often blocked threads check for shutdown
+    static const size_t latency_history = 4096; // Completed jobs kept for the latency percentiles
+    static const size_t max_job_pixels = size_t(1) << 26;  // Largest image a job may ask for, 1.5 GB while rendered
+    static const int max_tile_size = 1024;      // Largest tile side, each render thread holds one tile
+    static const int send_timeout_ms = 30000;   // A client that takes no data for this long is dropped
+    static const int shutdown_grace_ms = 2000;  // Time the last results get to reach clients at shutdown
+
+    // A connected client. Its reader thread sends replies to requests; results of finished
+    // jobs are queued for its sender thread, so the render thread never waits on a client
+    struct Client_Connection {
+        Socket socket;
+        std::mutex send_mutex;                  // Held while a message is being sent
+        std::mutex results_mutex;
+        std::condition_variable results_ready;
+        std::deque<std::vector<char>> results;  // SERVICE_IMAGE payloads waiting to be sent
+        bool closing = false;                   // No more results will be queued
+        std::atomic<bool> disconnected{false};  // Set when the reader thread ends
+        std::atomic<bool> results_sent{false};  // Set when the sender thread ends
+
+        void queue_Result(std::vector<char>&& payload) {
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                results.push_back(std::move(payload));
+            }
+            results_ready.notify_one();
+        }
+
+        void close_Results() {
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                closing = true;
+            }
+            results_ready.notify_one();
+        }
+    };
+
+    struct Render_Job {
+        uint32_t id;
+        int32_t priority;
+        std::string scene_name;
+        Frame_Settings settings;
+        shared_ptr<Client_Connection> client;
+        std::chrono::steady_clock::time_point submitted;
+        bool started = false;
+        double queue_ms = 0;        // Time from submission to start, once started
+        std::atomic<bool> cancelled{false};
+    };
+
+    Socket listener;
+    std::atomic<bool> stopping{false};
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+    // Guards the queue and the metrics. Never held while sending, a slow client must not
+    // hold up the others
+    mutable std::mutex mutex;
+    std::condition_variable job_ready;
+    // Queued jobs by (-priority, id), so the first entry runs next
+    std::map<std::pair<int64_t, uint32_t>, shared_ptr<Render_Job>> queue;
+    shared_ptr<Render_Job> running;
+    uint32_t next_job_id = 1;
+
+    uint64_t submitted = 0, completed = 0, cancelled = 0, failed = 0;
+    std::vector<double> latencies_ms;   // Of the last latency_history completed jobs
+    std::vector<double> queue_ms;       // Queue wait of the same jobs
+    double busy_seconds = 0;            // Time spent rendering jobs
+    double samples_rendered = 0;        // Samples of every completed job
+
+    // Reads the requests of one client until it disconnects. Jobs of a client that
+    // disconnected are cancelled, nobody is left to receive their images
+    void serve_Client(shared_ptr<Client_Connection> connection) {
+        Trace::set_Thread_Name("service client");
+        uint32_t type;
+        std::vector<char> payload;
+        while (!stopping.load()) {
+            if (!connection->socket.wait_Readable(poll_ms)) {
+                continue;
+            }
+            if (!connection->socket.recv_Message(type, payload)) {
+                break;
+            }
+            if (type == SERVICE_SUBMIT && payload.size() == sizeof(Job_Request)) {
+                Job_Request request;
+                std::memcpy(&request, payload.data(), sizeof(request));
+                submit(connection, request);
+            }
+            else if (type == SERVICE_CANCEL && payload.size() == sizeof(Job_Id)) {
+                Job_Id id;
+                std::memcpy(&id, payload.data(), sizeof(id));
+                cancel([&](const Render_Job& job) { return job.id == id.job_id; });
+            }
+            else if (type == SERVICE_STATS) {
+                std::ostringstream stats;
+                print_Stats(stats);
+                std::string text = stats.str();
+                std::lock_guard<std::mutex> lock(connection->send_mutex);
+                connection->socket.send_Message(SERVICE_STATS, text.data(), text.size());
+            }
+            else if (type == SERVICE_SHUTDOWN) {
+                stopping.store(true);
+            }
+        }
+        cancel([&](const Render_Job& job) { return job.client == connection; });
+        connection->close_Results();
+        connection->disconnected.store(true);
+    }
+
+    // Sends the results queued for one client until its connection closes. A client that
+    // stops taking data is disconnected once a send times out, and its results dropped
+    void send_Results(shared_ptr<Client_Connection> connection) {
+        Trace::set_Thread_Name("service sender");
+        while (true) {
+            std::vector<char> payload;
+            {
+                std::unique_lock<std::mutex> lock(connection->results_mutex);
+                connection->results_ready.wait(lock, [&] { return !connection->results.empty() || connection->closing; });
+                if (connection->results.empty()) {
+                    break;
+                }
+                payload = std::move(connection->results.front());
+                connection->results.pop_front();
+            }
+            std::lock_guard<std::mutex> send_lock(connection->send_mutex);
+            if (!connection->socket.send_Message(SERVICE_IMAGE, payload.data(), payload.size())) {
+                connection->socket.disconnect();
+                break;
+            }
+        }
+        connection->results_sent.store(true);
+    }
+
+    void submit(const shared_ptr<Client_Connection>& connection, const Job_Request& request) {
+        auto job = make_shared<Render_Job>();
+        job->priority = request.priority;
+        job->scene_name = std::string(request.scene, std::find(request.scene, request.scene + sizeof(request.scene), '\0'));
+        job->settings = request.settings;
+        job->client = connection;
+        job->submitted = std::chrono::steady_clock::now();
+
+        // The id goes out before the job can finish, so clients see it before the image
+        std::lock_guard<std::mutex> send_lock(connection->send_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job->id = next_job_id++;
+            submitted++;
+            queue[{-int64_t(job->priority), job->id}] = job;
+        }
+        Job_Id accepted{job->id};
+        connection->socket.send_Message(SERVICE_ACCEPTED, &accepted, sizeof(accepted));
+        job_ready.notify_one();
+    }
+
+    // Cancels the queued and running jobs that match: queued jobs at once, the running job
+    // once its threads finish their current tiles
+    template <typename Match>
+    void cancel(Match&& match) {
+        std::vector<shared_ptr<Render_Job>> removed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto entry = queue.begin(); entry != queue.end(); ) {
+                if (match(*entry->second)) {
+                    removed.push_back(entry->second);
+                    entry = queue.erase(entry);
+                }
+                else {
+                    ++entry;
+                }
+            }
+            if (running && match(*running)) {
+                running->cancelled.store(true);
+            }
+        }
+        for (auto& job : removed) {
+            finish_Job(*job, JOB_CANCELLED, nullptr, 0, 0);
+        }
+    }
+
+    // Renders queued jobs one at a time until the service stops
+    void render_Jobs() {
+        Trace::set_Thread_Name("service");
+        while (true) {
+            shared_ptr<Render_Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [&] { return !queue.empty() || stopping.load(); });
+                if (queue.empty()) {
+                    return;
+                }
+                job = queue.begin()->second;
+                queue.erase(queue.begin());
+                running = job;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            job->started = true;
+            job->queue_ms = std::chrono::duration<double, std::milli>(start - job->submitted).count();
+            int width = 0, height = 0;
+            std::vector<Color> image;
+            Job_Status status = render_Job(*job, image, width, height);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running.reset();
+                busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (status == JOB_DONE) {
+                    samples_rendered += double(width) * height * job->settings.samples_per_pixel;
+                }
+            }
+            finish_Job(*job, status, status == JOB_DONE ? image.data() : nullptr, width, height);
+            // Evicting after the job counts the texture tiles it read in
+            scenes.trim();
+        }
+    }
+
+    // Renders a job's image with every render thread, stopping between tiles if cancelled
+    Job_Status render_Job(Render_Job& job, std::vector<Color>& image, int& width, int& height) {
+        Trace_Scope trace_job("service job", "render", job.id);
+        const Frame_Settings& s = job.settings;
+        if (s.image_width < 1 || s.image_width > 16384 || s.samples_per_pixel < 1 || s.max_depth < 0
+            || s.tile_size < 1 || s.tile_size > max_tile_size
+            || !(s.aspect_ratio > 0.01 && s.aspect_ratio < 100) || !(s.vfov > 0 && s.vfov < 180)) {
+            return JOB_FAILED;
+        }
+        shared_ptr<const Scene> scene = scenes.acquire(job.scene_name);
+        if (!scene) {
+            return JOB_FAILED;
+        }
+
+        Camera cam;
+        s.apply_To(cam);
+        cam.initialize();
+        width = cam.image_width;
+        height = cam.get_Image_Height();
+        // Checked before allocating: a failed allocation on the render thread would end the service
+        if (size_t(width) * height > max_job_pixels) {
+            return JOB_FAILED;
+        }
+        image.assign(size_t(width) * height, Color(0,0,0));
+
+        std::vector<Tile> tiles = make_Tiles(width, height, cam.tile_size);
+        std::atomic<int> next_tile(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&]() {
+                Trace::set_Thread_Name("render");
+                std::vector<Color> tile_pixels(size_t(cam.tile_size) * cam.tile_size);
+                for (int i = next_tile++; i < int(tiles.size()) && !job.cancelled.load(); i = next_tile++) {
+                    const Tile& tile = tiles[i];
+                    cam.render_Tile(*scene, tile, tile_pixels.data());
+                    // Tiles never overlap, so threads write their own tile without locking
+                    for (int j = tile.y0; j < tile.y1; j++) {
+                        std::copy_n(&tile_pixels[size_t(j - tile.y0) * tile.width()], tile.width(),
+                                    &image[size_t(j) * width + tile.x0]);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return job.cancelled.load() ? JOB_CANCELLED : JOB_DONE;
+    }
+
+    // Counts a finished job and queues its result for its client. Must not hold 'mutex'
+    void finish_Job(Render_Job& job, Job_Status status, const Color* image, int width, int height) {
+        auto now = std::chrono::steady_clock::now();
+        double total_ms = std::chrono::duration<double, std::milli>(now - job.submitted).count();
+        double waited_ms = job.started ? job.queue_ms : total_ms;
+        Job_Result result{job.id, status, image ? width : 0, image ? height : 0, waited_ms, total_ms - waited_ms};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status == JOB_DONE) {
+                completed++;
+                latencies_ms.push_back(total_ms);
+                queue_ms.push_back(waited_ms);
+                if (latencies_ms.size() > latency_history) {
+                    latencies_ms.erase(latencies_ms.begin());
+                    queue_ms.erase(queue_ms.begin());
+                }
+            }
+            else {
+                (status == JOB_CANCELLED ? cancelled : failed)++;
+            }
+        }
+
+        // The result is the Job_Result followed by the pixels as floats
+        std::vector<char> payload(sizeof(Job_Result) + (image ? sizeof(float) * 3 * size_t(width) * height : 0));
+        std::memcpy(payload.data(), &result, sizeof(result));
+        if (image) {
+            float* rgb = reinterpret_cast<float*>(payload.data() + sizeof(Job_Result));
+            for (size_t p = 0; p < size_t(width) * height; p++) {
+                *rgb++ = float(image[p].x());
+                *rgb++ = float(image[p].y());
+                *rgb++ = float(image[p].z());
+            }
+        }
+        job.client->queue_Result(std::move(payload));
+    }
+};
+
+// Render_Service_Client submits jobs to a render service and receives their images
+class Render_Service_Client {
+public:
+    bool connect(int port) {
+        socket = Socket::connect_To("127.0.0.1", port);
+        return socket.valid();
+    }
+
+    // Queues a job, returns its id, or 0 if the connection failed
+    uint32_t submit(const std::string& scene_name, const Frame_Settings& settings, int priority) {
+        Job_Request request{};
+        std::strncpy(request.scene, scene_name.c_str(), sizeof(request.scene) - 1);
+        request.priority = priority;
+        request.settings = settings;
+        if (!socket.send_Message(SERVICE_SUBMIT, &request, sizeof(request))) {
+            return 0;
+        }
+        std::vector<char> payload;
+        if (!receive(SERVICE_ACCEPTED, payload) || payload.size() != sizeof(Job_Id)) {
+            return 0;
+        }
+        Job_Id accepted;
+        std::memcpy(&accepted, payload.data(), sizeof(accepted));
+        return accepted.job_id;
+    }
+
+    bool cancel(uint32_t job_id) {
+        Job_Id id{job_id};
+        return socket.send_Message(SERVICE_CANCEL, &id, sizeof(id));
+    }
+
+    // Waits for the next finished job of this client, done, cancelled or failed
+    // 'image' receives the width * height pixels of done jobs
+    bool next_Result(Job_Result& result, std::vector<Color>& image) {
+        std::vector<char> payload;
+        if (!results.empty()) {
+            payload = std::move(results.front());
+            results.pop_front();
+        }
+        else if (!receive(SERVICE_IMAGE, payload)) {
+            return false;
+        }
+        if (payload.size() < sizeof(Job_Result)) {
+            return false;
+        }
+        std::memcpy(&result, payload.data(), sizeof(result));
+        size_t pixels = size_t(result.width) * result.height;
+        if (payload.size() != sizeof(Job_Result) + sizeof(float) * 3 * pixels) {
+            return false;
+        }
+        const float* rgb = reinterpret_cast<const float*>(payload.data() + sizeof(Job_Result));
+        image.resize(pixels);
+        for (Color& pixel : image) {
+            pixel = Color(rgb[0], rgb[1], rgb[2]);
+            rgb += 3;
+        }
+        return true;
+    }
+
+    // Returns the service's metrics as text
+    bool stats(std::string& text) {
+        std::vector<char> payload;
+        if (!socket.send_Message(SERVICE_STATS, nullptr, 0) || !receive(SERVICE_STATS, payload)) {
+            return false;
+        }
+        text.assign(payload.begin(), payload.end());
+        return true;
+    }
+
+    bool shutdown() {
+        return socket.send_Message(SERVICE_SHUTDOWN, nullptr, 0);
+    }
+
+private:
+    Socket socket;
+    std::deque<std::vector<char>> results;  // Images that arrived while waiting for other replies
+
+    // Receives messages until one of the given type, keeping images for next_Result
+    bool receive(uint32_t wanted, std::vector<char>& payload) {
+        uint32_t type;
+        while (socket.recv_Message(type, payload)) {
+            if (type == wanted) {
+                return true;
+            }
+            if (type == SERVICE_IMAGE) {
+                results.push_back(std::move(payload));
+            }
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// Rng is a counter-based random number generator
+// The n-th number of a stream is a hash of the stream key and n, so there is no hidden
+// shared state and a stream costs 16 bytes to create. Streams are keyed by pixel, sample
+// and bounce, which makes every random number of a render a pure function of where it
+// is used, and renders bit-identical at any thread count, tile order or process count
+class Rng {
+public:
+    explicit Rng(uint64_t key) : key(mix(key)), counter(0) {}
+
+    // Stream of one sample of pixel (i, j). 'seed' selects an independent set of streams
+    static Rng for_Sample(int i, int j, int sample, uint32_t seed = 0) {
+        uint64_t pixel = (uint64_t(uint32_t(j)) << 32) | uint32_t(i);
+        return Rng(combine(combine(pixel, uint64_t(uint32_t(sample))), seed));
+    }
+
+    // Independent stream for one bounce of the path this stream belongs to
+    Rng for_Bounce(int bounce) const {
+        return Rng(combine(key, uint64_t(uint32_t(bounce)) + 1));
+    }
+
+    // Returns the next 64 random bits of the stream
+    uint64_t next_U64() {
+        return mix(key + ++counter * 0x9E3779B97F4A7C15ull);
+    }
+
+    // Returns a random real in [0,1)
+    double next_Double() {
+        return (next_U64() >> 11) * (1.0 / 9007199254740992.0);   // 53 random mantissa bits
+    }
+
+private:
+    uint64_t key;       // Hashed stream key
+    uint64_t counter;   // Number of values drawn from the stream
+
+    // splitmix64 finalizer, a bijective 64-bit hash
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t combine(uint64_t a, uint64_t b) {
+        return mix(a ^ (b + 0x9E3779B97F4A7C15ull + (a << 6) + (a >> 2)));
+    }
+};
+
+#endif
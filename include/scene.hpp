@@ -0,0 +1,302 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "common.hpp"
+#include "hittable_list.hpp"
+#include "light_tree.hpp"
+#include "material.hpp"
+#include "sphere.hpp"
+#include "environmentmap.hpp"
+#include "geometry_stream.hpp"
+#include "platform.hpp"
+#include "trace.hpp"
+#include "wide_bvh.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Environment map used for lighting the default scene
+const std::string default_envmap_path = "..\\include\\hdr\\texturify_court.jpg";
+
+// Memory budget for the resident chunks of streamed geometry, per process
+const size_t streamed_geometry_budget = size_t(8) << 20;
+
+// Scene holds everything the camera renders
+struct Scene {
+    Hittable_List world;                    // Every object of the scene that stays in memory
+    Hittable_List lights;                   // Emissive objects, also in world, sampled directly for lighting
+    shared_ptr<Light_Tree> light_tree;      // Hierarchy that chooses which light to sample, see build_Light_Tree
+    shared_ptr<Wide_BVH> bvh;               // Hierarchy over the bounded objects of world, see build_BVH
+    shared_ptr<EnvironmentMap> envmap;      // Light from rays escaping the scene, a gradient sky if null
+    shared_ptr<Streamed_Geometry> streamed; // Geometry paged in from disk, none if null
+
+    // Adds an emissive object to the world and to the lights sampled for direct lighting
+    // Lights are only sampled once build_Light_Tree was called after adding the last one
+    // Call build_BVH as well once the scene is complete
+    void add_Light(shared_ptr<Hittable> object) {
+        world.add(object);
+        lights.add(object);
+    }
+
+    // Builds the light tree over the lights
+    void build_Light_Tree() {
+        Trace_Scope trace_build("light tree build", "assets");
+        light_tree = make_shared<Light_Tree>(lights.objects);
+    }
+
+    // Builds the BVH over the objects of world that have bounds. They leave the world's
+    // list and the BVH takes their place, so rays only test the objects near them
+    // Objects added later stay in the list, until build_BVH is called again
+    void build_BVH() {
+        Trace_Scope trace_build("bvh build", "assets");
+        std::vector<shared_ptr<Hittable>> bounded, unbounded;
+        for (const auto& object : world.objects) {
+            AABB box;
+            if (object == bvh) {
+                bounded.insert(bounded.end(), bvh->get_Objects().begin(), bvh->get_Objects().end());
+            }
+            else if (object->bounding_Box(box)) {
+                bounded.push_back(object);
+            }
+            else {
+                unbounded.push_back(object);
+            }
+        }
+        bvh = make_shared<Wide_BVH>(bounded);
+        world.objects = std::move(unbounded);
+        world.add(bvh);
+    }
+
+    // Calls visit(object) for every object held in memory, including those in the BVH
+    template <typename Visit>
+    void visit_Objects(Visit&& visit) const {
+        for (const auto& object : world.objects) {
+            if (bvh && object == bvh) {
+                for (const auto& bounded : bvh->get_Objects()) {
+                    visit(*bounded);
+                }
+            }
+            else {
+                visit(*object);
+            }
+        }
+    }
+
+    // Closest hit of a single ray with the world and the streamed geometry
+    // Ray batches should query streamed geometry in batches instead
+    bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const {
+        bool hit_anything = world.hit(r, ray_t, rec);
+        if (streamed && streamed->hit(r, Interval(ray_t.min, hit_anything ? rec.t : ray_t.max), rec)) {
+            hit_anything = true;
+        }
+        return hit_anything;
+    }
+
+    // Approximate memory the scene holds: its objects, the hierarchies over them, the
+    // environment map data in memory and the resident chunks of streamed geometry
+    // Materials shared by objects are not counted
+    size_t memory_Bytes() const {
+        const size_t object_bytes = sizeof(Sphere) + 2 * sizeof(void*) + sizeof(shared_ptr<Hittable>);
+        size_t bytes = (world.objects.size() + lights.objects.size()) * object_bytes;
+        if (bvh) {
+            bytes += bvh->size() * (object_bytes + sizeof(void*)) + bvh->node_Bytes();
+        }
+        if (light_tree) {
+            bytes += light_tree->memory_Bytes();
+        }
+        if (envmap) {
+            bytes += envmap->memory_Bytes();
+        }
+        if (streamed) {
+            bytes += streamed->stats().resident_bytes;
+        }
+        return bytes;
+    }
+
+    // Whether every asset loading in the background is ready
+    bool assets_Ready() const {
+        return !envmap || envmap->load_Finished();
+    }
+
+    // Waits for the assets loading in the background
+    void wait_Until_Loaded() const {
+        if (envmap) {
+            envmap->wait_Until_Loaded();
+        }
+    }
+
+    // Any-hit query of a single ray with the world and the streamed geometry
+    bool occluded(const Ray& r, Interval ray_t) const {
+        return world.occluded(r, ray_t) || (streamed && streamed->occluded(r, ray_t));
+    }
+};
+
+// Builds the default worldspace
+// Shared by the interactive renderer and render worker processes so that every
+// process renders exactly the same scene
+inline void build_Default_Scene(Scene& scene) {
+    auto material_ground = make_shared<Lambertian>(Color(0.9, 0.8, 0.3));
+    auto material_center = make_shared<Lambertian>(Color(0.1, 0.5, 0.5));
+    auto material_left   = make_shared<Dielectric>(1.50);
+    auto material_bubble = make_shared<Dielectric>(1.00 / 1.50);
+    auto material_right  = make_shared<Metal>(Color(0.8, 0.8, 0.9), 0.05);
+
+    scene.world.add(make_shared<Sphere>(Point3( 0.0, -50.5, 1.0), 50.0, material_ground));
+    //scene.world.add(make_shared<Sphere>(Point3(-1.0,    0.0, -1.0),   0.5, material_left));
+    scene.world.add(make_shared<Sphere>(Point3(-1.0,    0.0, 1.0),   0.4, material_bubble));
+    scene.world.add(make_shared<Sphere>(Point3( 1.0,    0.0, 1.0),   0.5, material_right));
+
+    // Environment map object for lighting
+    scene.envmap = make_shared<EnvironmentMap>(default_envmap_path);
+}
+
+// Builds a closed room lit only by a small, bright ceiling light
+// Paths can only find light by hitting the small light sphere, which is what
+// direct light sampling is for
+inline void build_Interior_Scene(Scene& scene) {
+    auto material_walls  = make_shared<Lambertian>(Color(0.75, 0.75, 0.7));
+    auto material_center = make_shared<Lambertian>(Color(0.1, 0.5, 0.5));
+    auto material_glass  = make_shared<Dielectric>(1.50);
+    auto material_metal  = make_shared<Metal>(Color(0.8, 0.8, 0.9), 0.05);
+    auto material_light  = make_shared<Diffuse_Light>(Color(60, 55, 45));
+
+    // The room is the inside of a large sphere, with the floor a sphere bulging up into it
+    scene.world.add(make_shared<Sphere>(Point3( 0.0,   0.0, 1.0), 6.0, material_walls));
+    scene.world.add(make_shared<Sphere>(Point3( 0.0, -50.5, 1.0), 50.0, material_walls));
+
+    scene.world.add(make_shared<Sphere>(Point3( 0.0,  0.0, 1.5), 0.5, material_center));
+    scene.world.add(make_shared<Sphere>(Point3(-1.1,  0.0, 1.0), 0.4, material_glass));
+    scene.world.add(make_shared<Sphere>(Point3( 1.1,  0.0, 1.0), 0.5, material_metal));
+
+    scene.add_Light(make_shared<Sphere>(Point3(0.0, 2.5, 1.0), 0.25, material_light));
+}
+
+// Builds a closed room lit by a small lamp hanging under the ceiling, with a wide shade
+// below it. Light sampling finds the shade in the way from everywhere the camera sees, so
+// the room is lit by the bright patch of ceiling above the lamp, which only scattered
+// rays find
+inline void build_Lamp_Scene(Scene& scene) {
+    auto material_walls  = make_shared<Lambertian>(Color(0.75, 0.75, 0.7));
+    auto material_center = make_shared<Lambertian>(Color(0.1, 0.5, 0.5));
+    auto material_left   = make_shared<Lambertian>(Color(0.7, 0.3, 0.2));
+    auto material_metal  = make_shared<Metal>(Color(0.8, 0.8, 0.9), 0.05);
+    auto material_shade  = make_shared<Lambertian>(Color(0.2, 0.2, 0.2));
+    auto material_light  = make_shared<Diffuse_Light>(Color(2000, 1840, 1500));
+
+    // The room is the inside of a large sphere, with the floor a sphere bulging up into it
+    scene.world.add(make_shared<Sphere>(Point3( 0.0,   0.0, 1.0), 6.0, material_walls));
+    scene.world.add(make_shared<Sphere>(Point3( 0.0, -50.5, 1.0), 50.0, material_walls));
+
+    scene.world.add(make_shared<Sphere>(Point3( 0.0,  0.0, 1.5), 0.5, material_center));
+    scene.world.add(make_shared<Sphere>(Point3(-1.1,  0.0, 1.0), 0.4, material_left));
+    scene.world.add(make_shared<Sphere>(Point3( 1.1,  0.0, 1.0), 0.5, material_metal));
+
+    scene.world.add(make_shared<Sphere>(Point3( 0.0,  4.3, 1.0), 1.0, material_shade));
+    scene.add_Light(make_shared<Sphere>(Point3(0.0, 5.5, 1.0), 0.05, material_light));
+}
+
+// Builds a field of small spheres too large to keep in memory at once, on the ground of
+// the default scene. The spheres are streamed from a chunk file in the working directory
+inline void build_Streamed_Scene(Scene& scene) {
+    const int sphere_count = 200000;
+    const double field_radius = 40.0;
+    const Point3 ground_center(0.0, -50.5, 1.0);
+    const double ground_radius = 50.0;
+
+    auto material_ground = make_shared<Lambertian>(Color(0.9, 0.8, 0.3));
+    scene.world.add(make_shared<Sphere>(ground_center, ground_radius, material_ground));
+
+    // Material table of the streamed spheres
+    std::vector<shared_ptr<Material>> materials;
+    Rng rng(2024);
+    for (int m = 0; m < 16; m++) {
+        Color albedo = Vec3::random(rng);
+        materials.push_back(make_shared<Lambertian>(albedo * Vec3::random(rng)));
+    }
+    for (int m = 0; m < 4; m++) {
+        Color albedo = Vec3::random(rng, 0.5, 1);
+        materials.push_back(make_shared<Metal>(albedo, random_double(rng, 0, 0.3)));
+    }
+    materials.push_back(make_shared<Dielectric>(1.50));
+
+    // Spheres rest on the ground, leaving a clearing around the default camera position
+    std::vector<Sphere_Record> spheres;
+    spheres.reserve(sphere_count);
+    while (int(spheres.size()) < sphere_count) {
+        double x = random_double(rng, -field_radius, field_radius);
+        double z = random_double(rng, -field_radius, field_radius) + ground_center.z();
+        double radius = random_double(rng, 0.04, 0.2);
+        double dx = x - ground_center.x();
+        double dz = z - ground_center.z();
+        if (dx*dx + dz*dz > field_radius*field_radius || x*x + (z + 1)*(z + 1) < 1.0) {
+            continue;
+        }
+        double y = ground_center.y() + sqrt((ground_radius + radius)*(ground_radius + radius) - dx*dx - dz*dz);
+        spheres.push_back(Sphere_Record{{x, y, z}, radius, int32_t(rng.next_U64() % materials.size()), 0});
+    }
+
+    // Files are named per process, so render workers on one machine don't share them
+    std::string filename = "streamed_scene." + std::to_string(current_Process_Id()) + ".geom";
+    scene.streamed = make_shared<Streamed_Geometry>();
+    if (!scene.streamed->build(filename, spheres, 256, materials, streamed_geometry_budget)) {
+        std::cerr << "Could not write streamed geometry: " << filename << std::endl;
+        scene.streamed.reset();
+    }
+
+    scene.envmap = make_shared<EnvironmentMap>(default_envmap_path);
+}
+
+// Builds a ground lit only by 'light_count' small lights hovering over it, scattered over
+// a wide field above the height of the camera. Their total power stays the same for any count, so the images differ in
+// how the light is divided, not in how bright they are
+inline void build_Light_Field_Scene(Scene& scene, int light_count) {
+    const double field_radius = 12.0;
+    const Point3 ground_center(0.0, -50.5, 1.0);
+    const double ground_radius = 50.0;
+
+    // A dark dome closes the scene, so that no sky light hides the noise of the lights
+    scene.world.add(make_shared<Sphere>(Point3(0.0, 0.0, 1.0), 20.0, make_shared<Lambertian>(Color(0.2, 0.2, 0.2))));
+    scene.world.add(make_shared<Sphere>(ground_center, ground_radius, make_shared<Lambertian>(Color(0.7, 0.7, 0.7))));
+    scene.world.add(make_shared<Sphere>(Point3(0.0, 0.0, 1.5), 0.5, make_shared<Lambertian>(Color(0.1, 0.5, 0.5))));
+
+    // Light radius falls with the count so that the total emitting area stays the same
+    const double light_radius = 0.5 / std::sqrt(double(light_count));
+    Rng rng(4051);
+    for (int l = 0; l < light_count; l++) {
+        double r = field_radius * std::sqrt(random_double(rng));
+        double phi = 2 * pi * random_double(rng);
+        Point3 center(r * std::cos(phi), random_double(rng, 2.0, 3.0), ground_center.z() + r * std::sin(phi));
+        Color emit = 40.0 * (Color(0.3, 0.3, 0.3) + 0.7 * Vec3::random(rng));
+        scene.add_Light(make_shared<Sphere>(center, light_radius, make_shared<Diffuse_Light>(emit)));
+    }
+}
+
+// Builds the scene with the given name, returns false if there is no such scene
+// Scenes are built by name so worker processes can build the same scene
+inline bool build_Scene(const std::string& name, Scene& scene) {
+    Trace_Scope trace_build("scene build", "assets");
+    if (name == "default") {
+        build_Default_Scene(scene);
+    }
+    else if (name == "interior") {
+        build_Interior_Scene(scene);
+    }
+    else if (name == "lamp") {
+        build_Lamp_Scene(scene);
+    }
+    else if (name == "streamed") {
+        build_Streamed_Scene(scene);
+    }
+    else if (name == "lights") {
+        build_Light_Field_Scene(scene, 10000);
+    }
+    else {
+        return false;
+    }
+    scene.build_Light_Tree();
+    scene.build_BVH();
+    return true;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
 
 class Sphere : public Hittable {
 public:
@@ -50,6 +51,100 @@ public:
         return true;
     }
 
+    // Whether the ray hits the sphere within ray_t, without computing any hit details
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        Vec3 oc = center - r.origin();
+        double a = r.direction().length_Squared();
+        double h = dot(r.direction(), oc);
+        double c = oc.length_Squared() - radius*radius;
+
+        double discriminant = h*h - a*c;
+        if (discriminant < 0) {
+            return false;
+        }
+
+        double sqrtd = sqrt(discriminant);
+        return ray_t.surrounds((h - sqrtd) / a) || ray_t.surrounds((h + sqrtd) / a);
+    }
+
+    // Solid angle pdf of sampling 'direction' uniformly within the cone of directions
+    // from 'origin' that hit the sphere
+    double pdf_Value(const Point3& origin, const Vec3& direction) const override {
+        if (!this->occluded(Ray(origin, direction), Interval(0.001, infinity))) {
+            return 0.0;
+        }
+
+        double distance_squared = (center - origin).length_Squared();
+        if (distance_squared <= radius*radius) {
+            return 0.0;     // Origin inside the sphere, it can't be sampled as a cone
+        }
+        double cos_theta_max = sqrt(1 - radius*radius / distance_squared);
+        double solid_angle = 2*pi*(1 - cos_theta_max);
+
+        return 1 / solid_angle;
+    }
+
+    // Samples a direction uniformly within the cone of directions from 'origin' that hit
+    // the sphere, so every sample towards a small light actually reaches it
+    Vec3 random_Direction(const Point3& origin, Rng& rng) const override {
+        Vec3 direction = center - origin;
+        double distance_squared = direction.length_Squared();
+        if (distance_squared <= radius*radius) {
+            return random_Unit_Vector(rng);
+        }
+
+        // Uniform direction in the cone, around the z axis
+        double r1 = random_double(rng);
+        double r2 = random_double(rng);
+        double cos_theta_max = sqrt(1 - radius*radius / distance_squared);
+        double z = 1 + r2*(cos_theta_max - 1);
+        double phi = 2*pi*r1;
+        double sin_theta = sqrt(1 - z*z);
+
+        Vec3 t, b;
+        Vec3 w = unit_Vector(direction);
+        build_Orthonormal_Basis(w, t, b);
+        return (cos(phi)*sin_theta) * t + (sin(phi)*sin_theta) * b + z * w;
+    }
+
+    // A sphere of emissive material sends light in every direction, over a hemisphere
+    // from each point of its surface
+    bool light_Bounds(Light_Bounds& bounds) const override {
+        Color emit = mat ? mat->emission() : Color(0,0,0);
+        double luminance = 0.2126 * emit.x() + 0.7152 * emit.y() + 0.0722 * emit.z();
+        if (luminance <= 0 || radius <= 0) {
+            return false;
+        }
+        Vec3 extent(radius, radius, radius);
+        bounds.box = AABB(center - extent, center + extent);
+        bounds.power = luminance * pi * 4 * pi * radius * radius;
+        bounds.axis = Vec3(0,0,1);
+        bounds.cos_theta_o = -1;
+        bounds.cos_theta_e = 0;
+        return true;
+    }
+
+    bool bounding_Box(AABB& box) const override {
+        Vec3 extent(radius, radius, radius);
+        box = AABB(center - extent, center + extent);
+        return true;
+    }
+
+    bool specular_Bounds(AABB& box) const override {
+        return mat && mat->specular() && bounding_Box(box);
+    }
+
+    bool sample_Emitter(Rng& rng, Point3& point, Vec3& normal, Color& radiance, double& area) const override {
+        radiance = mat ? mat->emission() : Color(0,0,0);
+        if (radiance.near_Zero() || radius <= 0) {
+            return false;
+        }
+        normal = random_Unit_Vector(rng);
+        point = center + radius * normal;
+        area = 4 * pi * radius * radius;
+        return true;
+    }
+
 private:
     Point3 center;
     double radius;
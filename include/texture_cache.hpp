@@ -0,0 +1,430 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+// Mipmapped, tiled textures served through per-thread LRU tile caches
+// The texels of every mip level are stored in square tiles in a texture file, and only
+// the tiles that lookups actually touch are read into memory, up to a fixed budget per
+// render thread. Lookups pick the mip level from the footprint of the lookup, so wide
+// footprints read a few tiles of a small level instead of aliasing over a large one
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Texture file layout (host byte order):
+//   Texture_File_Header header
+//   Texture_Level levels[level_count]
+//   Tiles, starting at a multiple of texture_file_alignment, level by level, each level's
+//   tiles in row-major tile order with the texels of a tile row-major, 3 channels each
+// Texels are stored in their in-memory format and every offset is from the start of the
+// file, so the file can be memory mapped and its tiles used in place
+const char texture_file_magic[8] = {'S','R','T','T','E','X','0','1'};
+const uint64_t texture_file_alignment = 4096;
+
+struct Texture_File_Header {
+    char magic[8];
+    int32_t width, height;      // Size of the full resolution image in texels
+    int32_t is_hdr;             // 1 for float channels, 0 for 8-bit channels
+    int32_t tile_size;          // Texels along each side of a tile
+    int32_t level_count;
+    int32_t padding;
+};
+
+struct Texture_Level {
+    int32_t width, height;      // Size of the level in texels
+    int32_t tiles_x, tiles_y;   // Number of tiles across and down
+    uint64_t offset;            // Offset of the level's first tile in the file
+};
+
+// Cache counters summed over all threads
+struct Texture_Cache_Stats {
+    uint64_t hits = 0;              // Tile lookups served from memory
+    uint64_t misses = 0;            // Tile lookups read from the backing file
+    size_t resident_bytes = 0;      // Bytes of tiles currently held by all caches
+    int caches = 0;                 // Number of per-thread caches
+
+    double hit_Rate() const {
+        uint64_t lookups = hits + misses;
+        return lookups > 0 ? double(hits) / lookups : 0.0;
+    }
+};
+
+// Tile_Cache is the LRU cache of texture tiles of a single thread
+// Tiles are keyed by their offset in the backing file
+class Tile_Cache {
+public:
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<size_t> resident_bytes{0};
+
+    Tile_Cache(const std::string& backing_file, size_t budget_bytes)
+    : file(backing_file, std::ios::binary), budget_bytes(budget_bytes) {}
+
+    // Returns the tile stored at offset in the backing file, reading it on a miss
+    // The pointer stays valid until the next call
+    const unsigned char* tile(uint64_t offset, size_t tile_bytes) {
+        // Consecutive lookups mostly hit the same tile, skip the hash map for those
+        if (!lru.empty() && lru.front().offset == offset) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return lru.front().data.data();
+        }
+
+        auto found = index.find(offset);
+        if (found != index.end()) {
+            // Move the tile to the front of the LRU list
+            lru.splice(lru.begin(), lru, found->second);
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return lru.front().data.data();
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+
+        // Evict least recently used tiles until the new tile fits, reusing the last buffer
+        Entry entry;
+        while (!lru.empty() && resident_bytes.load(std::memory_order_relaxed) + tile_bytes > budget_bytes) {
+            entry = std::move(lru.back());
+            lru.pop_back();
+            index.erase(entry.offset);
+            resident_bytes.fetch_sub(entry.data.size(), std::memory_order_relaxed);
+        }
+
+        entry.offset = offset;
+        entry.data.resize(tile_bytes);
+        file.clear();
+        file.seekg(std::streamoff(offset));
+        file.read(reinterpret_cast<char*>(entry.data.data()), std::streamsize(tile_bytes));
+
+        lru.push_front(std::move(entry));
+        index[offset] = lru.begin();
+        resident_bytes.fetch_add(tile_bytes, std::memory_order_relaxed);
+        return lru.front().data.data();
+    }
+
+private:
+    struct Entry {
+        uint64_t offset = 0;
+        std::vector<unsigned char> data;
+    };
+
+    std::ifstream file;
+    size_t budget_bytes;
+    std::list<Entry> lru;   // Most recently used tile first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+};
+
+// Tile_Cache_Pool owns the per-thread caches of one texture
+// A thread leases a cache on its first lookup and returns it when the thread exits,
+// so render threads started for a new frame reuse the tiles of the previous frame
+class Tile_Cache_Pool {
+public:
+    Tile_Cache_Pool(const std::string& backing_file, size_t budget_bytes)
+    : backing_file(backing_file), budget_bytes(budget_bytes) {}
+
+    Tile_Cache* acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!free_caches.empty()) {
+            Tile_Cache* cache = free_caches.back();
+            free_caches.pop_back();
+            return cache;
+        }
+        caches.push_back(std::make_unique<Tile_Cache>(backing_file, budget_bytes));
+        return caches.back().get();
+    }
+
+    void release(Tile_Cache* cache) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_caches.push_back(cache);
+    }
+
+    Texture_Cache_Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Texture_Cache_Stats stats;
+        for (const auto& cache : caches) {
+            stats.hits += cache->hits.load(std::memory_order_relaxed);
+            stats.misses += cache->misses.load(std::memory_order_relaxed);
+            stats.resident_bytes += cache->resident_bytes.load(std::memory_order_relaxed);
+        }
+        stats.caches = int(caches.size());
+        return stats;
+    }
+
+private:
+    std::mutex mutex;
+    std::string backing_file;
+    size_t budget_bytes;
+    std::vector<std::unique_ptr<Tile_Cache>> caches;
+    std::vector<Tile_Cache*> free_caches;
+};
+
+// Tiled_Texture is an RGB texture with a mip pyramid, stored as tiles in a texture file
+// Texels are stored as 8-bit (LDR images) or 32-bit float (HDR images) channels
+class Tiled_Texture {
+public:
+    static const int tile_size = 32;        // Texels along each side of a tile
+
+    Tiled_Texture() {}
+
+    Tiled_Texture(const Tiled_Texture&) = delete;
+    Tiled_Texture& operator=(const Tiled_Texture&) = delete;
+
+    // Builds the mip pyramid of a 3-channel image and writes it to a texture file
+    // Pass 8-bit texels in data8, or float texels in dataf
+    static bool write_File(const std::string& filename, int width, int height,
+                           const unsigned char* data8, const float* dataf) {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        bool hdr = (dataf != nullptr);
+        size_t bytes_per_tile = size_t(tile_size) * tile_size * 3 * (hdr ? sizeof(float) : sizeof(unsigned char));
+        std::vector<Texture_Level> file_levels = plan_Levels(width, height, bytes_per_tile);
+
+        Texture_File_Header header{};
+        std::memcpy(header.magic, texture_file_magic, sizeof(header.magic));
+        header.width = width;
+        header.height = height;
+        header.is_hdr = hdr ? 1 : 0;
+        header.tile_size = tile_size;
+        header.level_count = int32_t(file_levels.size());
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(file_levels.data()), file_levels.size() * sizeof(Texture_Level));
+
+        // Pad up to the first tile
+        std::vector<char> padding(size_t(file_levels[0].offset - uint64_t(out.tellp())), 0);
+        out.write(padding.data(), std::streamsize(padding.size()));
+
+        bool written = hdr ? write_Pyramid(out, file_levels, dataf) : write_Pyramid(out, file_levels, data8);
+        out.close();
+        return written && bool(out);
+    }
+
+    // Opens a texture file written by write_File, with a tile cache of cache_budget_bytes
+    // per render thread. Returns false if the file is missing, damaged or of another layout
+    bool open(const std::string& filename, size_t cache_budget_bytes) {
+        std::ifstream in(filename, std::ios::binary);
+        Texture_File_Header header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, texture_file_magic, sizeof(header.magic)) != 0
+            || header.tile_size != tile_size || header.level_count <= 0) {
+            return false;
+        }
+        std::vector<Texture_Level> file_levels(header.level_count);
+        if (!in.read(reinterpret_cast<char*>(file_levels.data()), file_levels.size() * sizeof(Texture_Level))) {
+            return false;
+        }
+
+        is_hdr = (header.is_hdr != 0);
+        texel_bytes = 3 * (is_hdr ? sizeof(float) : sizeof(unsigned char));
+        tile_bytes = size_t(tile_size) * tile_size * texel_bytes;
+
+        // A file cut short, e.g. by a crash while it was written, is missing tiles
+        const Texture_Level& last = file_levels.back();
+        in.seekg(0, std::ios::end);
+        if (uint64_t(in.tellg()) < last.offset + uint64_t(last.tiles_x) * last.tiles_y * tile_bytes) {
+            return false;
+        }
+
+        levels = std::move(file_levels);
+        texture_file = filename;
+        pool = std::make_shared<Tile_Cache_Pool>(texture_file, cache_budget_bytes);
+        return true;
+    }
+
+    bool loaded() const { return pool != nullptr; }
+    int width() const { return levels.empty() ? 0 : levels[0].width; }
+    int height() const { return levels.empty() ? 0 : levels[0].height; }
+    int level_Count() const { return int(levels.size()); }
+
+    // Trilinear lookup at texture coordinates (u, v) in [0,1], wrapping in u and
+    // clamping in v. lod is the fractional mip level, 0 being the full resolution image
+    Color sample(double u, double v, double lod) const {
+        Tile_Cache& cache = thread_Cache();
+        lod = Interval(0, level_Count() - 1).clamp(lod);
+        int level = int(lod);
+        double t = lod - level;
+
+        Color c = bilinear(cache, level, u, v);
+        if (t > 0 && level + 1 < level_Count()) {
+            c = (1 - t) * c + t * bilinear(cache, level + 1, u, v);
+        }
+        return c;
+    }
+
+    // Returns the texel at (x, y) of a mip level, coordinates must be in range
+    Color texel(Tile_Cache& cache, int level, int x, int y) const {
+        const Level& l = levels[level];
+        uint64_t offset = l.offset + (uint64_t(y / tile_size) * l.tiles_x + (x / tile_size)) * tile_bytes;
+        const unsigned char* tile = cache.tile(offset, tile_bytes);
+        size_t texel_index = size_t(y % tile_size) * tile_size + (x % tile_size);
+
+        if (is_hdr) {
+            const float* rgb = reinterpret_cast<const float*>(tile) + 3 * texel_index;
+            return Color(rgb[0], rgb[1], rgb[2]);
+        }
+        const unsigned char* rgb = tile + 3 * texel_index;
+        return Color(rgb[0] / 255.999, rgb[1] / 255.999, rgb[2] / 255.999);
+    }
+
+    Texture_Cache_Stats stats() const {
+        return pool ? pool->stats() : Texture_Cache_Stats();
+    }
+
+    // Total size of all tiles in the texture file
+    uint64_t stored_Bytes() const {
+        return levels.empty() ? 0 : levels.back().offset + uint64_t(levels.back().tiles_x) * levels.back().tiles_y * tile_bytes
+                                    - levels.front().offset;
+    }
+
+private:
+    using Level = Texture_Level;
+
+    // A thread's lease on a cache of one texture, returned to the pool when the thread exits
+    struct Cache_Lease {
+        std::shared_ptr<Tile_Cache_Pool> pool;
+        Tile_Cache* cache;
+        Cache_Lease(std::shared_ptr<Tile_Cache_Pool> pool) : pool(pool), cache(pool->acquire()) {}
+        Cache_Lease(Cache_Lease&& other) noexcept : pool(std::move(other.pool)), cache(other.cache) {}
+        ~Cache_Lease() { if (pool) { pool->release(cache); } }
+    };
+
+    std::vector<Level> levels;
+    std::string texture_file;
+    bool is_hdr = false;
+    size_t texel_bytes = 3;
+    size_t tile_bytes = 0;
+    std::shared_ptr<Tile_Cache_Pool> pool;
+
+    // Returns the calling thread's cache for this texture
+    Tile_Cache& thread_Cache() const {
+        thread_local std::vector<Cache_Lease> leases;
+        for (auto& lease : leases) {
+            if (lease.pool == pool) {
+                return *lease.cache;
+            }
+        }
+        leases.emplace_back(pool);
+        return *leases.back().cache;
+    }
+
+    Color bilinear(Tile_Cache& cache, int level, double u, double v) const {
+        const Level& l = levels[level];
+        double x = u * l.width - 0.5;
+        double y = v * l.height - 0.5;
+        int x0 = int(std::floor(x));
+        int y0 = int(std::floor(y));
+        double fx = x - x0;
+        double fy = y - y0;
+
+        // Wrap horizontally, the image covers all directions around the vertical axis
+        auto wrap_x = [&](int i) { i %= l.width; return i < 0 ? i + l.width : i; };
+        auto clamp_y = [&](int j) { return j < 0 ? 0 : (j >= l.height ? l.height - 1 : j); };
+        int xa = wrap_x(x0), xb = wrap_x(x0 + 1);
+        int ya = clamp_y(y0), yb = clamp_y(y0 + 1);
+
+        Color top = (1 - fx) * texel(cache, level, xa, ya) + fx * texel(cache, level, xb, ya);
+        Color bottom = (1 - fx) * texel(cache, level, xa, yb) + fx * texel(cache, level, xb, yb);
+        return (1 - fy) * top + fy * bottom;
+    }
+
+    // Sizes and file offsets of the mip levels of a width x height image, down to 1x1
+    static std::vector<Level> plan_Levels(int width, int height, size_t bytes_per_tile) {
+        std::vector<Level> planned;
+        while (true) {
+            planned.push_back(Level{width, height, (width + tile_size - 1) / tile_size, (height + tile_size - 1) / tile_size, 0});
+            if (width == 1 && height == 1) {
+                break;
+            }
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        uint64_t offset = sizeof(Texture_File_Header) + planned.size() * sizeof(Level);
+        offset = (offset + texture_file_alignment - 1) / texture_file_alignment * texture_file_alignment;
+        for (Level& level : planned) {
+            level.offset = offset;
+            offset += uint64_t(level.tiles_x) * level.tiles_y * bytes_per_tile;
+        }
+        return planned;
+    }
+
+    // Writes every mip level, each level being a 2x2 box filtered copy of the one above
+    // Only the current and next level are held in memory at once
+    template <typename T>
+    static bool write_Pyramid(std::ofstream& out, const std::vector<Level>& file_levels, const T* data) {
+        const T* current = data;
+        std::vector<T> current_storage, next_storage;
+
+        for (size_t l = 0; l < file_levels.size(); l++) {
+            write_Level(out, file_levels[l], current);
+            if (l + 1 < file_levels.size()) {
+                next_storage = downsample(current, file_levels[l].width, file_levels[l].height);
+                current_storage.swap(next_storage);
+                current = current_storage.data();
+            }
+        }
+        return bool(out);
+    }
+
+    // Writes a level as tiles in row-major tile order, padding edge tiles with edge texels
+    template <typename T>
+    static void write_Level(std::ofstream& out, const Level& level, const T* texels) {
+        std::vector<T> tile(size_t(tile_size) * tile_size * 3);
+        for (int ty = 0; ty < level.tiles_y; ty++) {
+            for (int tx = 0; tx < level.tiles_x; tx++) {
+                T* dst = tile.data();
+                for (int y = 0; y < tile_size; y++) {
+                    int sy = std::min(ty * tile_size + y, level.height - 1);
+                    for (int x = 0; x < tile_size; x++) {
+                        int sx = std::min(tx * tile_size + x, level.width - 1);
+                        const T* src = texels + 3 * (size_t(sy) * level.width + sx);
+                        *dst++ = src[0];
+                        *dst++ = src[1];
+                        *dst++ = src[2];
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(tile.data()), std::streamsize(tile.size() * sizeof(T)));
+            }
+        }
+    }
+
+    // Halves a level with a 2x2 box filter, odd rows and columns reuse the edge texel
+    template <typename T>
+    static std::vector<T> downsample(const T* texels, int width, int height) {
+        int next_width = std::max(1, width / 2);
+        int next_height = std::max(1, height / 2);
+        std::vector<T> next(size_t(next_width) * next_height * 3);
+
+        for (int y = 0; y < next_height; y++) {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < next_width; x++) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < 3; c++) {
+                    double sum = double(texels[3 * (size_t(y0) * width + x0) + c])
+                               + double(texels[3 * (size_t(y0) * width + x1) + c])
+                               + double(texels[3 * (size_t(y1) * width + x0) + c])
+                               + double(texels[3 * (size_t(y1) * width + x1) + c]);
+                    next[3 * (size_t(y) * next_width + x) + c] = to_Texel<T>(sum / 4);
+                }
+            }
+        }
+        return next;
+    }
+
+    template <typename T>
+    static T to_Texel(double value) {
+        return std::is_floating_point<T>::value ? T(value) : T(value + 0.5);
+    }
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <algorithm>
+#include <vector>
+
+// Tile is a rectangular block of pixels [x0,x1) x [y0,y1) of the image,
+// the unit of work handed to render threads and render workers
+struct Tile {
+    int x0, y0;     // Upper left pixel of the tile (inclusive)
+    int x1, y1;     // Lower right pixel of the tile (exclusive)
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_Count() const { return width() * height(); }
+};
+
+// Splits an image into square tiles of side tile_size, in row-major order
+// Tiles along the right and bottom edges are clipped to the image bounds
+inline std::vector<Tile> make_Tiles(int image_width, int image_height, int tile_size) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < image_height; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            tiles.push_back(Tile{x, y,
+                std::min(x + tile_size, image_width),
+                std::min(y + tile_size, image_height)});
+        }
+    }
+    return tiles;
+}
+
+#endif
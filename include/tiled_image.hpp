@@ -0,0 +1,192 @@
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+// Tiled image files for renders too large to hold in memory
+// Finished tiles go to the file as they come, so a render only keeps the tiles being
+// rendered and the tiles waiting to be written, not the image. A writer thread takes
+// tiles from a bounded queue (write-behind); render threads only wait for it when the
+// disk falls behind by the whole queue
+//
+// File layout (host byte order): the magic, then int32 width, height and tile size, then
+// the tiles in row-major order of tiles, each as its rows of linear RGB pixels, 3 floats
+// each. Tiles along the right and bottom edges are clipped to the image like the tiles
+// of make_Tiles, so every tile has a fixed place in the file and tiles can be written in
+// any order
+
+#include "common.hpp"
+#include "tile.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const char tiled_image_magic[8] = {'S','R','T','T','I','L','E','1'};
+
+// Statistics of a tiled image written by Tiled_Image_Writer
+struct Tiled_Image_Stats {
+    uint64_t tiles = 0;             // Tiles written
+    uint64_t bytes = 0;             // Pixel bytes written
+    double write_seconds = 0;       // Time the writer thread spent writing
+    double stall_seconds = 0;       // Time render threads waited for room in the queue, summed
+    int peak_queued = 0;            // Most tiles waiting to be written at once
+
+    // Pixel bytes per second of writing
+    double write_Bandwidth() const { return write_seconds > 0 ? bytes / write_seconds : 0; }
+};
+
+class Tiled_Image_Writer {
+public:
+    Tiled_Image_Writer() {}
+    ~Tiled_Image_Writer() { close(); }
+
+    Tiled_Image_Writer(const Tiled_Image_Writer&) = delete;
+    Tiled_Image_Writer& operator=(const Tiled_Image_Writer&) = delete;
+
+    // Creates the file for an image of width x height pixels in tiles of side tile_size and
+    // starts the writer thread. At most max_queued tiles wait to be written at a time
+    // Returns false if the file can't be created
+    bool open(const std::string& filename, int width, int height, int tile_size, int max_queued) {
+        out.open(filename, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        int32_t header[3] = {width, height, tile_size};
+        out.write(tiled_image_magic, sizeof(tiled_image_magic));
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        this->width = width;
+        this->tile_size = tile_size;
+        this->max_queued = std::max(1, max_queued);
+        failed = !out;
+        closing = false;
+        writer = std::thread([this]() { write_Loop(); });
+        return !failed;
+    }
+
+    // Queues a finished tile for writing, waiting while the queue is full
+    // 'pixels' is row-major with tile.width() pixels per row and can be reused on return
+    void write_Tile(const Tile& tile, const Color* pixels) {
+        std::vector<float> data;
+        auto wait_start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (int(queue.size()) >= max_queued) {
+                Trace_Scope trace_wait("tile queue full", "io");
+                room.wait(lock, [&]() { return int(queue.size()) < max_queued; });
+                stats.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+            }
+            if (!free_buffers.empty()) {
+                data.swap(free_buffers.back());
+                free_buffers.pop_back();
+            }
+        }
+
+        // Converting outside the lock lets render threads fill their tiles at the same time
+        data.resize(size_t(tile.pixel_Count()) * 3);
+        for (int p = 0; p < tile.pixel_Count(); p++) {
+            for (int c = 0; c < 3; c++) {
+                data[size_t(p) * 3 + c] = float(pixels[p][c]);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(Queued_Tile{tile, std::move(data)});
+        stats.peak_queued = std::max(stats.peak_queued, int(queue.size()));
+        queued.notify_one();
+    }
+
+    // Writes the tiles still queued and closes the file
+    // Returns false if any write failed
+    bool close() {
+        if (!writer.joinable()) {
+            return !failed;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        queued.notify_one();
+        writer.join();
+        out.close();
+        failed = failed || !out;
+        return !failed;
+    }
+
+    // Statistics so far; complete once close returned
+    Tiled_Image_Stats get_Stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    // Byte offset of a tile's pixels in the file
+    // Full rows of tiles come before it, then the tiles to its left in its own row, which
+    // are as high as it is and tile.x0 wide together, as in the grid of make_Tiles
+    static uint64_t tile_Offset(const Tile& tile, int width) {
+        const uint64_t pixel_bytes = 3 * sizeof(float);
+        uint64_t pixels_before = uint64_t(tile.y0) * width + uint64_t(tile.x0) * tile.height();
+        return sizeof(tiled_image_magic) + 3 * sizeof(int32_t) + pixels_before * pixel_bytes;
+    }
+
+private:
+    struct Queued_Tile {
+        Tile tile;
+        std::vector<float> data;
+    };
+
+    std::ofstream out;
+    std::thread writer;
+    mutable std::mutex mutex;
+    std::condition_variable queued;     // A tile was queued, or the writer should finish
+    std::condition_variable room;       // The queue has room
+    std::deque<Queued_Tile> queue;
+    std::vector<std::vector<float>> free_buffers;   // Buffers of written tiles, for reuse
+    Tiled_Image_Stats stats;
+    int width = 0;
+    int tile_size = 0;
+    int max_queued = 1;
+    bool closing = false;
+    bool failed = false;    // Only touched by the writer thread while it runs
+
+    void write_Loop() {
+        Trace::set_Thread_Name("tile writer");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queued.wait(lock, [&]() { return !queue.empty() || closing; });
+            if (queue.empty()) {
+                return;
+            }
+            // The tile stays queued while it is written, so the queue bounds the tiles in memory
+            Queued_Tile& next = queue.front();
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            {
+                Trace_Scope trace_write("tile write", "io");
+                out.seekp(std::streamoff(tile_Offset(next.tile, width)));
+                out.write(reinterpret_cast<const char*>(next.data.data()), std::streamsize(next.data.size() * sizeof(float)));
+                if (!out) {
+                    failed = true;
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            lock.lock();
+            stats.tiles++;
+            stats.bytes += next.data.size() * sizeof(float);
+            stats.write_seconds += seconds;
+            free_buffers.push_back(std::move(next.data));
+            queue.pop_front();
+            room.notify_one();
+        }
+    }
+};
+
+#endif
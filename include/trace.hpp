@@ -0,0 +1,270 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing of render activity, written as Chrome trace / Perfetto JSON
+// (open the file in chrome://tracing or ui.perfetto.dev)
+// Tracing is off unless Trace::start is called. While off, a Trace_Scope costs one
+// relaxed atomic load. While on, each thread records its events into its own ring
+// buffer, so threads never wait on each other to record
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A finished span of work on one thread
+struct Trace_Event {
+    const char* name;       // Static strings only, events keep the pointer
+    const char* category;
+    int64_t arg;            // Event specific number, e.g. the tile index, or -1 if none
+    uint64_t begin_ns;      // Nanoseconds since Trace::start
+    uint64_t end_ns;
+};
+
+// Trace_Buffer holds the most recent events of one thread, overwriting the oldest ones
+// once full. A buffer is reused by later threads after its thread ends, so threads
+// started for every frame share a few timeline rows instead of adding one each
+class Trace_Buffer {
+public:
+    static constexpr size_t capacity = 16384;
+
+    explicit Trace_Buffer(int id) : id(id), events(capacity) {}
+
+    const int id;           // Timeline row of the buffer
+    std::atomic<const char*> name{nullptr};    // Name of the threads using the buffer
+
+    void record(const Trace_Event& event) {
+        // Only the owning thread records; the lock is uncontended except while writing the file
+        std::lock_guard<std::mutex> lock(mutex);
+        events[count % capacity] = event;
+        count++;
+    }
+
+    // Appends the recorded events, oldest first, and returns how many were overwritten
+    uint64_t copy_Events(std::vector<Trace_Event>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t first = (count > capacity) ? count - capacity : 0;
+        for (uint64_t e = first; e < count; e++) {
+            out.push_back(events[e % capacity]);
+        }
+        return first;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<Trace_Event> events;
+    uint64_t count = 0;     // Events recorded so far
+};
+
+// Trace holds the tracing state of the process: whether it is on, and every thread's buffer
+class Trace {
+public:
+    // Starts recording events
+    static void start() {
+        state().start_time = std::chrono::steady_clock::now();
+        state().enabled.store(true);
+    }
+
+    static bool enabled() {
+        return state().enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now_Ns() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - state().start_time).count());
+    }
+
+    // Names the calling thread in the timeline, e.g. "render" or "envmap loader"
+    // 'name' must be a static string
+    static void set_Thread_Name(const char* name) {
+        if (enabled()) {
+            Thread_Handle& handle = thread_Handle();
+            handle.release();
+            handle.acquire(name);
+        }
+    }
+
+    static void record(const char* name, const char* category, int64_t arg, uint64_t begin_ns, uint64_t end_ns) {
+        thread_Buffer().record(Trace_Event{name, category, arg, begin_ns, end_ns});
+    }
+
+    // Writes the recorded events of all threads as Chrome trace JSON
+    // Threads may keep recording meanwhile, but only events recorded before are written
+    // Returns false if the file could not be written
+    static bool write(const std::string& filename) {
+        std::ofstream out(filename);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        auto separator = [&]() -> const char* {
+            const char* s = first ? "" : ",\n";
+            first = false;
+            return s;
+        };
+
+        uint64_t overwritten = 0;
+        std::vector<std::shared_ptr<Trace_Buffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            buffers = state().buffers;
+        }
+        std::vector<Trace_Event> events;
+        for (const auto& buffer : buffers) {
+            events.clear();
+            overwritten += buffer->copy_Events(events);
+            const char* thread_name = buffer->name.load();
+            out << separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"args\":{\"name\":\"" << (thread_name ? thread_name : "thread") << "\"}}";
+            for (const Trace_Event& e : events) {
+                // Timestamps are in microseconds
+                out << separator() << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                    << ",\"ts\":" << e.begin_ns / 1000.0 << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0;
+                if (e.arg >= 0) {
+                    out << ",\"args\":{\"n\":" << e.arg << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n],\"otherData\":{\"overwritten_events\":" << overwritten << "}}\n";
+        return bool(out);
+    }
+
+private:
+    struct State {
+        std::atomic<bool> enabled{false};
+        std::chrono::steady_clock::time_point start_time;
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Trace_Buffer>> buffers;     // Every buffer, for writing
+        std::vector<std::shared_ptr<Trace_Buffer>> free_buffers; // Buffers of threads that ended
+    };
+
+    static State& state() {
+        static State instance;
+        return instance;
+    }
+
+    // Gives the calling thread a buffer on first use and returns it for reuse when the
+    // thread ends. Threads reuse buffers of ended threads with the same name, so each
+    // timeline row shows one kind of thread
+    struct Thread_Handle {
+        std::shared_ptr<Trace_Buffer> buffer;
+
+        void acquire(const char* name) {
+            State& s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (size_t b = 0; b < s.free_buffers.size(); b++) {
+                const char* buffer_name = s.free_buffers[b]->name.load();
+                if (buffer_name == name || (buffer_name && name && std::strcmp(buffer_name, name) == 0)) {
+                    buffer = s.free_buffers[b];
+                    s.free_buffers.erase(s.free_buffers.begin() + b);
+                    return;
+                }
+            }
+            buffer = std::make_shared<Trace_Buffer>(int(s.buffers.size()) + 1);
+            buffer->name.store(name);
+            s.buffers.push_back(buffer);
+        }
+
+        void release() {
+            if (buffer) {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.free_buffers.push_back(buffer);
+                buffer.reset();
+            }
+        }
+
+        ~Thread_Handle() { release(); }
+    };
+
+    static Thread_Handle& thread_Handle() {
+        thread_local Thread_Handle handle;
+        return handle;
+    }
+
+    static Trace_Buffer& thread_Buffer() {
+        Thread_Handle& handle = thread_Handle();
+        if (!handle.buffer) {
+            handle.acquire(nullptr);
+        }
+        return *handle.buffer;
+    }
+};
+
+// Trace_Scope records the time from its construction to its destruction as an event,
+// if tracing is on
+class Trace_Scope {
+public:
+    Trace_Scope(const char* name, const char* category, int64_t arg = -1) {
+        if (Trace::enabled()) {
+            this->name = name;
+            this->category = category;
+            this->arg = arg;
+            begin_ns = Trace::now_Ns();
+        }
+    }
+
+    ~Trace_Scope() {
+        if (name) {
+            Trace::record(name, category, arg, begin_ns, Trace::now_Ns());
+        }
+    }
+
+    Trace_Scope(const Trace_Scope&) = delete;
+    Trace_Scope& operator=(const Trace_Scope&) = delete;
+
+private:
+    const char* name = nullptr;     // Null if tracing was off when the scope began
+    const char* category = nullptr;
+    int64_t arg = -1;
+    uint64_t begin_ns = 0;
+};
+
+// Locks 'mutex'. If another thread holds it and tracing is on, the time spent waiting
+// is recorded as an event named 'name', so lock contention shows in the timeline
+template <typename Mutex>
+std::unique_lock<Mutex> lock_Traced(Mutex& mutex, const char* name) {
+    std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        Trace_Scope wait(name, "lock");
+        lock.lock();
+    }
+    return lock;
+}
+
+// Trace_Session traces the whole run of a command line mode: it starts tracing if given
+// a file name and writes the trace to it when it goes out of scope
+class Trace_Session {
+public:
+    explicit Trace_Session(const std::string& filename) : filename(filename) {
+        if (!filename.empty()) {
+            Trace::start();
+        }
+    }
+
+    ~Trace_Session() {
+        if (filename.empty()) {
+            return;
+        }
+        if (Trace::write(filename)) {
+            std::cerr << "Wrote trace to " << filename << "\n";
+        }
+        else {
+            std::cerr << "Could not write trace: " << filename << "\n";
+        }
+    }
+
+    Trace_Session(const Trace_Session&) = delete;
+    Trace_Session& operator=(const Trace_Session&) = delete;
+
+private:
+    std::string filename;
+};
+
+#endif
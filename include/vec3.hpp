@@ -70,13 +70,13 @@ public:
     }
 
     // Returns a random Vec3 with X, Y, Z components between [0, 1)
-    static Vec3 random() {
-        return Vec3(random_double(), random_double(), random_double());
+    static Vec3 random(Rng& rng) {
+        return Vec3(random_double(rng), random_double(rng), random_double(rng));
     }
 
     // Returns a random Vec3 with X, Y, Z components between [min, max)
-    static Vec3 random(double min, double max) {
-        return Vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+    static Vec3 random(Rng& rng, double min, double max) {
+        return Vec3(random_double(rng, min,max), random_double(rng, min,max), random_double(rng, min,max));
     }
 };
 
@@ -138,9 +138,9 @@ inline Vec3 unit_Vector(const Vec3& v) {
 }
 
 // Returns a random Vec3 inside a unit sphere (radius = 1)
-inline Vec3 random_In_Unit_Sphere() {
+inline Vec3 random_In_Unit_Sphere(Rng& rng) {
     while (true) {
-        Vec3 p = Vec3::random(-1,1);
+        Vec3 p = Vec3::random(rng, -1,1);
         if (p.length_Squared() < 1) {
             return p;
         }
@@ -148,9 +148,9 @@ inline Vec3 random_In_Unit_Sphere() {
 }
 
 // Returns a random Vec3 in the X-Y plane inside a unit disk
-inline Vec3 random_In_Unit_Disk(std::mt19937 &gen, std::uniform_real_distribution<double> &dist) {
+inline Vec3 random_In_Unit_Disk(Rng& rng) {
     while (true) {
-        Vec3 p = Vec3(dist(gen), dist(gen), 0);
+        Vec3 p = Vec3(random_double(rng, -1,1), random_double(rng, -1,1), 0);
         if (p.length_Squared() < 1) {
             return p;
         }
@@ -158,19 +158,26 @@ inline Vec3 random_In_Unit_Disk(std::mt19937 &gen, std::uniform_real_distributio
 }
 
 // Returns a random unit vector on the surface of a unit sphere
-inline Vec3 random_Unit_Vector() {
-    return unit_Vector(random_In_Unit_Sphere());
+inline Vec3 random_Unit_Vector(Rng& rng) {
+    return unit_Vector(random_In_Unit_Sphere(rng));
 }
 
 // Returns a random unit vector within the hemisphere defined by a normal vector
-inline Vec3 random_On_Hemisphere(const Vec3& normal) {
-    Vec3 on_unit_sphere = random_Unit_Vector();
+inline Vec3 random_On_Hemisphere(const Vec3& normal, Rng& rng) {
+    Vec3 on_unit_sphere = random_Unit_Vector(rng);
     if (dot(on_unit_sphere, normal) > 0.0) // in the same hemisphere as the normal
         return on_unit_sphere;
     else
         return -on_unit_sphere;
 }
 
+// Builds unit vectors `t` and `b` that form an orthonormal basis together with unit vector `n`
+inline void build_Orthonormal_Basis(const Vec3& n, Vec3& t, Vec3& b) {
+    Vec3 a = (fabs(n.x()) > 0.9) ? Vec3(0,1,0) : Vec3(1,0,0);
+    b = unit_Vector(cross(n, a));
+    t = cross(b, n);
+}
+
 // Reflects vector `v` about a normal
 // Reflection formula: v' = v - 2 * dot(v, normal) * normal
 // Commonly used in reflection models for lighting
@@ -0,0 +1,604 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+// Bounding volume hierarchies over objects held in memory
+// Binary_BVH splits the objects in two by the surface area heuristic until few objects are
+// left per leaf. Wide_BVH collapses that tree into nodes of up to 8 children, whose boxes
+// are stored in 8 bits per side relative to the box of their parent, so one 80 byte node
+// stands for the up to 7 binary nodes of 56 bytes it replaces. A ray tests all children of
+// a node at once, with AVX2 when compiled for it (-mavx2, /arch:AVX2) and a scalar loop
+// otherwise, and visits the children it hits nearest first, so a closest hit found early
+// cuts off the farther ones
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Work of the rays traced through a hierarchy, for comparing hierarchies
+struct BVH_Traversal_Stats {
+    uint64_t rays = 0;
+    uint64_t nodes_visited = 0;
+};
+
+// Surface area of a box, 0 for empty boxes
+inline double surface_Area(const AABB& box) {
+    double x = std::max(0.0, box.x.size());
+    double y = std::max(0.0, box.y.size());
+    double z = std::max(0.0, box.z.size());
+    return 2 * (x * y + y * z + z * x);
+}
+
+class Binary_BVH : public Hittable {
+public:
+    static constexpr int max_leaf_size = 4;     // Objects per leaf
+    static constexpr int bin_count = 12;        // Candidate splits per axis
+    static constexpr int max_depth = 48;        // Deeper nodes split at the median, which bounds the depth
+
+    struct Node {
+        AABB bounds;
+        int32_t index;      // Second child of an inner node (the first follows it), or first object of a leaf
+        int16_t count;      // Objects of a leaf, 0 for inner nodes
+        int16_t axis;       // Axis an inner node was split along
+    };
+
+    Binary_BVH() {}
+
+    // Builds the hierarchy over the objects that have bounds, the others are left out
+    explicit Binary_BVH(const std::vector<shared_ptr<Hittable>>& objects) {
+        std::vector<Build_Object> build;
+        for (size_t i = 0; i < objects.size(); i++) {
+            AABB box;
+            if (objects[i]->bounding_Box(box)) {
+                Point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+                build.push_back(Build_Object{box, center, int(i)});
+            }
+        }
+        if (build.empty()) {
+            return;
+        }
+        nodes.reserve(2 * build.size());
+        build_Node(build, 0, build.size(), 0);
+        for (const Build_Object& object : build) {
+            this->objects.push_back(objects[object.object]);
+        }
+    }
+
+    const std::vector<Node>& get_Nodes() const { return nodes; }
+
+    // The objects, in the order the leaves refer to them
+    const std::vector<shared_ptr<Hittable>>& get_Objects() const { return objects; }
+
+    size_t node_Bytes() const { return nodes.size() * sizeof(Node); }
+
+    bool bounding_Box(AABB& box) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        box = nodes[0].bounds;
+        return true;
+    }
+
+    bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const override {
+        return closest_Hit<false>(r, ray_t, rec, nullptr);
+    }
+
+    // hit, counting the nodes visited into 'stats'
+    bool hit_Counted(const Ray& r, Interval ray_t, Hit_Record& rec, BVH_Traversal_Stats& stats) const {
+        stats.rays++;
+        return closest_Hit<true>(r, ray_t, rec, &stats);
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        int stack[2 * max_depth + 64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int index = stack[--stack_size];
+            const Node& node = nodes[index];
+            Interval box_t = ray_t;
+            if (!node.bounds.hit(r, box_t)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (int i = node.index; i < node.index + node.count; i++) {
+                    if (objects[i]->occluded(r, ray_t)) {
+                        return true;
+                    }
+                }
+                continue;
+            }
+            stack[stack_size++] = node.index;
+            stack[stack_size++] = index + 1;
+        }
+        return false;
+    }
+
+private:
+    struct Build_Object {
+        AABB box;
+        Point3 center;
+        int object;     // Index into the objects the hierarchy was built from
+    };
+
+    std::vector<Node> nodes;                    // Depth first, the root first
+    std::vector<shared_ptr<Hittable>> objects;
+
+    template <bool Count>
+    bool closest_Hit(const Ray& r, Interval ray_t, Hit_Record& rec, BVH_Traversal_Stats* stats) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        bool hit_anything = false;
+        int stack[2 * max_depth + 64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            int index = stack[--stack_size];
+            const Node& node = nodes[index];
+            if (Count) {
+                stats->nodes_visited++;
+            }
+            Interval box_t = ray_t;
+            if (!node.bounds.hit(r, box_t)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (int i = node.index; i < node.index + node.count; i++) {
+                    if (objects[i]->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+            // Nearer child on top
+            int first = index + 1;
+            int second = node.index;
+            if (r.direction()[node.axis] < 0) {
+                std::swap(first, second);
+            }
+            stack[stack_size++] = second;
+            stack[stack_size++] = first;
+        }
+        return hit_anything;
+    }
+
+    // Builds the subtree over build[begin, end) and returns the index of its root
+    int build_Node(std::vector<Build_Object>& build, size_t begin, size_t end, int depth) {
+        int index = int(nodes.size());
+        nodes.push_back(Node{});
+        AABB bounds, centers;
+        for (size_t i = begin; i < end; i++) {
+            bounds = AABB(bounds, build[i].box);
+            centers = AABB(centers, AABB(build[i].center, build[i].center));
+        }
+        const size_t count = end - begin;
+
+        // Cost of a split: a node visit (half an object test) plus the objects tested in the
+        // children, as likely to be reached as their surface areas
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_bin = 0;
+        double parent_area = surface_Area(bounds);
+        for (int axis = 0; axis < 3 && count > 1 && depth < max_depth && parent_area > 0; axis++) {
+            const Interval& range = centers.axis_Interval(axis);
+            if (range.size() <= 0) {
+                continue;
+            }
+            AABB bin_bounds[bin_count];
+            size_t bin_counts[bin_count] = {};
+            for (size_t i = begin; i < end; i++) {
+                int b = bin_Of(build[i], axis, range);
+                bin_bounds[b] = AABB(bin_bounds[b], build[i].box);
+                bin_counts[b]++;
+            }
+            double below_area[bin_count];
+            size_t below_count[bin_count];
+            AABB below;
+            size_t below_objects = 0;
+            for (int b = 0; b < bin_count; b++) {
+                below = AABB(below, bin_bounds[b]);
+                below_objects += bin_counts[b];
+                below_area[b] = surface_Area(below);
+                below_count[b] = below_objects;
+            }
+            AABB above;
+            size_t above_objects = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                above = AABB(above, bin_bounds[b]);
+                above_objects += bin_counts[b];
+                if (above_objects == 0 || below_count[b - 1] == 0) {
+                    continue;
+                }
+                double cost = 0.5 + (below_area[b - 1] * below_count[b - 1] + surface_Area(above) * above_objects) / parent_area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if (count == 1 || (count <= size_t(max_leaf_size) && double(count) <= best_cost)) {
+            nodes[index] = Node{bounds, int32_t(begin), int16_t(count), 0};
+            return index;
+        }
+
+        size_t middle = begin;
+        int axis = best_axis;
+        if (best_axis >= 0) {
+            const Interval range = centers.axis_Interval(best_axis);
+            middle = size_t(std::partition(build.begin() + begin, build.begin() + end, [&](const Build_Object& object) {
+                return bin_Of(object, best_axis, range) < best_bin;
+            }) - build.begin());
+        }
+        else {
+            // Objects at the same place, or a node too deep: split at the median
+            axis = centers.longest_Axis();
+            middle = begin + count / 2;
+            std::nth_element(build.begin() + begin, build.begin() + middle, build.begin() + end,
+                             [&](const Build_Object& a, const Build_Object& b) { return a.center[axis] < b.center[axis]; });
+        }
+
+        build_Node(build, begin, middle, depth + 1);
+        int second = build_Node(build, middle, end, depth + 1);
+        nodes[index] = Node{bounds, second, 0, int16_t(axis)};
+        return index;
+    }
+
+    static int bin_Of(const Build_Object& object, int axis, const Interval& range) {
+        int b = int(bin_count * (object.center[axis] - range.min) / range.size());
+        return std::clamp(b, 0, bin_count - 1);
+    }
+};
+
+class Wide_BVH : public Hittable {
+public:
+    static constexpr int width = 8;     // Children per node
+
+    // A node of up to 8 children. Child boxes are in steps of 2^exponent from the origin,
+    // per axis, rounded outwards to 8 bits. Unused children have inverted boxes that no ray hits
+    struct alignas(16) Node {
+        float origin[3];            // Lower corner of the node's box
+        int32_t child_base;         // Index of the first inner child node, the others follow it
+        int32_t object_base;        // Index of the first object of the leaf children
+        int8_t exponent[3];
+        uint8_t internal_mask;      // Children that are inner nodes
+        uint8_t meta[width];        // Leaf children: first object from object_base << 3 | (count - 1)
+        uint8_t bounds[6][width];   // Quantized child boxes: low x, y, z, then high x, y, z
+    };
+    static_assert(Binary_BVH::max_leaf_size * width <= 32, "leaf objects must be addressable by 5 bits");
+
+    Wide_BVH() {}
+
+    // Builds the hierarchy over the objects that have bounds, the others are left out
+    explicit Wide_BVH(const std::vector<shared_ptr<Hittable>>& objects) {
+        Binary_BVH binary(objects);
+        if (!binary.bounding_Box(bounds)) {
+            return;
+        }
+        nodes.push_back(Node{});
+        collapse(binary, 0, 0);
+        for (const auto& object : this->objects) {
+            object_pointers.push_back(object.get());
+        }
+    }
+
+    size_t size() const { return objects.size(); }
+
+    // The objects, in the order the leaves refer to them
+    const std::vector<shared_ptr<Hittable>>& get_Objects() const { return objects; }
+
+    size_t node_Bytes() const { return nodes.size() * sizeof(Node); }
+
+    bool bounding_Box(AABB& box) const override {
+        box = bounds;
+        return !nodes.empty();
+    }
+
+    bool hit(const Ray& r, Interval ray_t, Hit_Record& rec) const override {
+        return closest_Hit<false>(r, ray_t, rec, nullptr);
+    }
+
+    // hit, counting the nodes visited into 'stats'
+    bool hit_Counted(const Ray& r, Interval ray_t, Hit_Record& rec, BVH_Traversal_Stats& stats) const {
+        stats.rays++;
+        return closest_Hit<true>(r, ray_t, rec, &stats);
+    }
+
+    bool occluded(const Ray& r, Interval ray_t) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        Ray_Frame frame(r);
+        Stack_Entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = Stack_Entry{0, 0, 0};
+        while (stack_size > 0) {
+            Stack_Entry entry = stack[--stack_size];
+            if (entry.count > 0) {
+                for (int i = entry.index; i < entry.index + entry.count; i++) {
+                    if (object_pointers[i]->occluded(r, ray_t)) {
+                        return true;
+                    }
+                }
+                continue;
+            }
+            const Node& node = nodes[entry.index];
+            float t_near[width];
+            int mask = intersect_Children(node, frame, float(ray_t.min), float(ray_t.max), t_near);
+            int next_child = node.child_base;
+            for (int c = 0; c < width; c++) {
+                bool internal = (node.internal_mask >> c) & 1;
+                if ((mask >> c) & 1) {
+                    stack[stack_size++] = child_Entry(node, c, internal ? next_child : -1, 0);
+                }
+                next_child += internal ? 1 : 0;
+            }
+        }
+        return false;
+    }
+
+private:
+    // A node to visit, or the objects of a leaf, with the distance where the ray enters its box
+    struct Stack_Entry {
+        int32_t index;      // Node, or first object of a leaf
+        int32_t count;      // Objects of a leaf, 0 for a node
+        float t;
+    };
+
+    // Every level leaves at most 7 siblings on the stack
+    static constexpr int stack_capacity = (width - 1) * (Binary_BVH::max_depth + 64) + 1;
+
+    // The ray in the single precision of the nodes
+    struct Ray_Frame {
+        float origin[3];
+        float inverse_direction[3];
+        bool negative[3];
+
+        explicit Ray_Frame(const Ray& r) {
+            for (int a = 0; a < 3; a++) {
+                origin[a] = float(r.origin()[a]);
+                // Axis-parallel rays divide by zero; a large finite inverse keeps 0 * inverse from being NaN
+                double inverse = 1.0 / r.direction()[a];
+                inverse_direction[a] = float(std::clamp(inverse, -1e20, 1e20));
+                negative[a] = r.direction()[a] < 0;
+            }
+        }
+    };
+
+    std::vector<Node> nodes;                    // The root first
+    std::vector<shared_ptr<Hittable>> objects;  // In the order the leaves refer to them
+    std::vector<const Hittable*> object_pointers;
+    AABB bounds;
+
+    // Tests the ray against every child box of a node within [t_min, t_max]. Returns the
+    // children hit as a bit mask and sets t_near to where the ray enters each child box
+    static int intersect_Children(const Node& node, const Ray_Frame& frame, float t_min, float t_max, float* t_near) {
+        // Plane q of axis a is at origin + q * 2^exponent, which the ray reaches at q * scale + offset
+        float scale[3], offset[3];
+        for (int a = 0; a < 3; a++) {
+            scale[a] = std::ldexp(1.0f, node.exponent[a]) * frame.inverse_direction[a];
+            offset[a] = (node.origin[a] - frame.origin[a]) * frame.inverse_direction[a];
+        }
+        // Rounding can place the far plane of a box a little too near; this widens it by a few ulps
+        const float far_widening = 1.0000004f;
+#if defined(__AVX2__)
+        __m256 near_t = _mm256_set1_ps(t_min);
+        __m256 far_t = _mm256_set1_ps(infinity);
+        for (int a = 0; a < 3; a++) {
+            const uint8_t* near_plane = node.bounds[frame.negative[a] ? a + 3 : a];
+            const uint8_t* far_plane = node.bounds[frame.negative[a] ? a : a + 3];
+            __m256 s = _mm256_set1_ps(scale[a]);
+            __m256 o = _mm256_set1_ps(offset[a]);
+            near_t = _mm256_max_ps(near_t, _mm256_add_ps(_mm256_mul_ps(load_Planes(near_plane), s), o));
+            far_t = _mm256_min_ps(far_t, _mm256_add_ps(_mm256_mul_ps(load_Planes(far_plane), s), o));
+        }
+        far_t = _mm256_min_ps(_mm256_mul_ps(far_t, _mm256_set1_ps(far_widening)), _mm256_set1_ps(t_max));
+        _mm256_storeu_ps(t_near, near_t);
+        return _mm256_movemask_ps(_mm256_cmp_ps(near_t, far_t, _CMP_LE_OQ));
+#else
+        int mask = 0;
+        for (int c = 0; c < width; c++) {
+            float near_t = t_min;
+            float far_t = infinity;
+            for (int a = 0; a < 3; a++) {
+                float near_plane = node.bounds[frame.negative[a] ? a + 3 : a][c];
+                float far_plane = node.bounds[frame.negative[a] ? a : a + 3][c];
+                near_t = std::max(near_t, near_plane * scale[a] + offset[a]);
+                far_t = std::min(far_t, far_plane * scale[a] + offset[a]);
+            }
+            far_t = std::min(far_t * far_widening, t_max);
+            t_near[c] = near_t;
+            mask |= (near_t <= far_t) ? (1 << c) : 0;
+        }
+        return mask;
+#endif
+    }
+
+#if defined(__AVX2__)
+    // The 8 quantized planes of one side of the child boxes, as floats
+    static __m256 load_Planes(const uint8_t* planes) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes));
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    }
+#endif
+
+    // Stack entry of child c of a node; 'child_node' is the child's index if it is an inner node
+    Stack_Entry child_Entry(const Node& node, int c, int child_node, float t) const {
+        if (child_node >= 0) {
+            return Stack_Entry{child_node, 0, t};
+        }
+        return Stack_Entry{node.object_base + (node.meta[c] >> 3), (node.meta[c] & 7) + 1, t};
+    }
+
+    template <bool Count>
+    bool closest_Hit(const Ray& r, Interval ray_t, Hit_Record& rec, BVH_Traversal_Stats* stats) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        Ray_Frame frame(r);
+        bool hit_anything = false;
+        Stack_Entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = Stack_Entry{0, 0, float(-infinity)};
+        while (stack_size > 0) {
+            Stack_Entry entry = stack[--stack_size];
+            if (entry.t > ray_t.max) {
+                continue;   // A closer hit was found since the entry was pushed
+            }
+            if (entry.count > 0) {
+                for (int i = entry.index; i < entry.index + entry.count; i++) {
+                    if (object_pointers[i]->hit(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            const Node& node = nodes[entry.index];
+            if (Count) {
+                stats->nodes_visited++;
+            }
+            float t_near[width];
+            int mask = intersect_Children(node, frame, float(ray_t.min), float(ray_t.max), t_near);
+
+            // Sort the children hit farthest first, so the nearest ends on top of the stack
+            Stack_Entry hits[width];
+            int hit_count = 0;
+            int next_child = node.child_base;
+            for (int c = 0; c < width; c++) {
+                bool internal = (node.internal_mask >> c) & 1;
+                if ((mask >> c) & 1) {
+                    Stack_Entry child = child_Entry(node, c, internal ? next_child : -1, t_near[c]);
+                    int k = hit_count++;
+                    while (k > 0 && hits[k - 1].t < child.t) {
+                        hits[k] = hits[k - 1];
+                        k--;
+                    }
+                    hits[k] = child;
+                }
+                next_child += internal ? 1 : 0;
+            }
+            for (int k = 0; k < hit_count; k++) {
+                stack[stack_size++] = hits[k];
+            }
+        }
+        return hit_anything;
+    }
+
+    // Fills wide node 'wide_index' with the binary nodes below binary node 'binary_index',
+    // opening the inner node of largest surface area until there are 8, and builds the
+    // wide nodes of its inner children
+    void collapse(const Binary_BVH& binary, int binary_index, int wide_index) {
+        const std::vector<Binary_BVH::Node>& binary_nodes = binary.get_Nodes();
+        const Binary_BVH::Node& parent = binary_nodes[binary_index];
+
+        int children[width];
+        int child_count = 0;
+        if (parent.count > 0) {
+            children[child_count++] = binary_index;
+        }
+        else {
+            children[child_count++] = binary_index + 1;
+            children[child_count++] = parent.index;
+        }
+        while (child_count < width) {
+            int largest = -1;
+            double largest_area = -1;
+            for (int c = 0; c < child_count; c++) {
+                const Binary_BVH::Node& child = binary_nodes[children[c]];
+                if (child.count == 0 && surface_Area(child.bounds) > largest_area) {
+                    largest_area = surface_Area(child.bounds);
+                    largest = c;
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            int opened = children[largest];
+            children[largest] = opened + 1;
+            children[child_count++] = binary_nodes[opened].index;
+        }
+
+        Node node{};
+        set_Frame(node, parent.bounds);
+        node.child_base = int32_t(nodes.size());
+        node.object_base = int32_t(objects.size());
+        std::vector<std::pair<int, int>> inner;     // (binary node, wide node) of the inner children
+        for (int c = 0; c < width; c++) {
+            if (c >= child_count) {
+                // Inverted box: the ray enters at the far plane and leaves at the near one
+                for (int a = 0; a < 3; a++) {
+                    node.bounds[a][c] = 255;
+                    node.bounds[a + 3][c] = 0;
+                }
+                continue;
+            }
+            const Binary_BVH::Node& child = binary_nodes[children[c]];
+            quantize_Child(node, c, child.bounds);
+            if (child.count == 0) {
+                node.internal_mask |= uint8_t(1 << c);
+                inner.emplace_back(children[c], int(nodes.size()) + int(inner.size()));
+            }
+            else {
+                node.meta[c] = uint8_t(((objects.size() - node.object_base) << 3) | (child.count - 1));
+                for (int i = child.index; i < child.index + child.count; i++) {
+                    objects.push_back(binary.get_Objects()[i]);
+                }
+            }
+        }
+        nodes.resize(nodes.size() + inner.size());
+        nodes[wide_index] = node;
+        for (const auto& [binary_child, wide_child] : inner) {
+            collapse(binary, binary_child, wide_child);
+        }
+    }
+
+    // Chooses the origin and the smallest steps with which 255 steps span the node's box
+    static void set_Frame(Node& node, const AABB& box) {
+        for (int a = 0; a < 3; a++) {
+            const Interval& range = box.axis_Interval(a);
+            float origin = float(range.min);
+            if (double(origin) > range.min) {
+                origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+            }
+            double extent = range.max - origin;
+            int exponent = (extent > 0) ? int(std::ceil(std::log2(extent / 255))) : -100;
+            exponent = std::clamp(exponent, -100, 100);
+            while (exponent < 100 && std::ldexp(255.0, exponent) < extent) {
+                exponent++;
+            }
+            node.origin[a] = origin;
+            node.exponent[a] = int8_t(exponent);
+        }
+    }
+
+    // Stores the box of child c in the node's steps, rounding outwards
+    static void quantize_Child(Node& node, int c, const AABB& box) {
+        for (int a = 0; a < 3; a++) {
+            const Interval& range = box.axis_Interval(a);
+            double step = std::ldexp(1.0, node.exponent[a]);
+            double low = std::floor((range.min - node.origin[a]) / step);
+            double high = std::ceil((range.max - node.origin[a]) / step);
+            node.bounds[a][c] = uint8_t(std::clamp(low, 0.0, 255.0));
+            node.bounds[a + 3][c] = uint8_t(std::clamp(high, 0.0, 255.0));
+        }
+    }
+};
+
+#endif
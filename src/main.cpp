@@ -11,14 +11,25 @@
 #define SDL_MAIN_HANDLED    // Disables SDL's handling of main
 #include "common.hpp"
 #include "camera.hpp"
+#include "display.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
 #include "material.hpp"
 #include "sphere.hpp"
+#include "scene.hpp"
+#include "distributed.hpp"
+#include "checkpoint.hpp"
+#include "benchmark.hpp"
+#include "frame_controller.hpp"
+#include "animation.hpp"
+#include "render_service.hpp"
+#include "tiled_image.hpp"
 
 #include <string>
 #include <atomic>
 #include <thread>
+#include <chrono>
+#include <fstream>
 
 // Atomic flag to signal when rendering is complete
 // Using atomic ensures thread-safe access without explicit locking
@@ -26,58 +37,498 @@ std::atomic<bool> rendering_complete(false);
 // Atomic flag to signal when a frame should be rendered
 std::atomic<bool> should_render(true);
 
+// Writes a linear HDR image as a plain text PPM file
+void write_PPM(const std::string& filename, const std::vector<Color>& image, int width, int height) {
+    std::ofstream out(filename);
+    out << "P3\n" << width << " " << height << "\n255\n";
+    for (const Color& pixel_color : image) {
+        write_Color(out, pixel_color);
+    }
+}
+
+// Runs this process as a render worker: loads the scene once, then renders tiles
+// for the coordinator at host:port on num_threads connections until told to quit
+int run_Worker(const std::string& host, int port, int num_threads, const std::string& scene_name) {
+    Scene scene;
+    if (!build_Scene(scene_name, scene)) {
+        std::cerr << "Unknown scene: " << scene_name << std::endl;
+        return -1;
+    }
+
+    scene.wait_Until_Loaded();
+    Render_Worker::run(host, port, num_threads, scene);
+    return 0;
+}
+
+// Renders one high-quality frame on num_workers local worker processes, and reports
+// the scaling efficiency against rendering the same frame in this process
+int run_Distributed(const std::string& exe_path, const std::string& scene_name, int num_workers,
+                    int image_width, int samples_per_pixel) {
+    if (num_workers < 1) {
+        std::cerr << "The number of workers must be at least 1" << std::endl;
+        return -1;
+    }
+
+    Scene scene;
+    if (!build_Scene(scene_name, scene)) {
+        std::cerr << "Unknown scene: " << scene_name << std::endl;
+        return -1;
+    }
+
+    scene.wait_Until_Loaded();
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    if (image_width > 0) { cam.image_width = image_width; }
+    if (samples_per_pixel > 0) { cam.samples_per_pixel = samples_per_pixel; }
+
+    const int hardware_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    const int threads_per_worker = std::max(1, hardware_threads / num_workers);
+    using clock = std::chrono::steady_clock;
+
+    // Single-process path
+    std::cout << "Rendering " << cam.image_width << " px, " << cam.samples_per_pixel
+            << " spp in this process with " << hardware_threads << " threads...\n";
+    std::vector<Color> reference;
+    auto start = clock::now();
+    cam.render_HDR(scene, reference, hardware_threads);
+    double single_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    // Distributed path
+    Render_Coordinator coordinator;
+    if (!coordinator.listen("127.0.0.1", 0)) {
+        std::cerr << "Coordinator could not listen for workers\n";
+        return -1;
+    }
+    if (!coordinator.spawn_Local_Workers(exe_path, num_workers, threads_per_worker, scene_name)) {
+        std::cerr << "Could not start worker processes\n";
+        return -1;
+    }
+    int connected = coordinator.accept_Workers(num_workers * threads_per_worker, 30000);
+    std::cout << "Rendering on " << num_workers << " workers with " << connected << " connections...\n";
+
+    std::vector<Color> image;
+    start = clock::now();
+    bool complete = coordinator.render(cam, image);
+    double distributed_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    if (!complete) {
+        std::cerr << "All workers were lost before the frame was finished\n";
+        coordinator.shutdown();
+        return -1;
+    }
+
+    // Efficiency compares thread-seconds, so it stays meaningful when worker
+    // processes together use more or fewer threads than the single process
+    double speedup = single_seconds / distributed_seconds;
+    double efficiency = (single_seconds * hardware_threads) / (distributed_seconds * connected);
+
+    std::cout << "Single process: " << single_seconds << " s\n"
+            << "Distributed:    " << distributed_seconds << " s\n"
+            << "Speedup: " << speedup << "x, scaling efficiency: " << 100.0 * efficiency << "%\n";
+
+    // Random numbers only depend on pixel and sample, so both paths render the same image,
+    // up to workers sending their results as floats
+    double max_difference = 0;
+    for (size_t p = 0; p < image.size() && p < reference.size(); p++) {
+        for (int c = 0; c < 3; c++) {
+            max_difference = std::max(max_difference, std::fabs(image[p][c] - double(float(reference[p][c]))));
+        }
+    }
+    std::cout << "Largest pixel difference to the single process render: " << max_difference << "\n";
+    if (scene.envmap) {
+        scene.envmap->print_Cache_Stats(std::cout);
+    }
+    if (scene.streamed) {
+        scene.streamed->print_Stats(std::cout);
+    }
+    coordinator.print_Stats(std::cout);
+    coordinator.shutdown();
+
+    int image_height = int(image.size()) / cam.image_width;
+    write_PPM("distributed.ppm", image, cam.image_width, image_height);
+    std::cout << "Wrote distributed.ppm\n";
+    return 0;
+}
+
+// Renders the image sequence of a keyframed camera path, loading the scene once
+// Frames go to numbered files, or to standard output as raw RGB if output is "-"
+int run_Animation(const std::string& path_file, const std::string& output, const std::string& scene_name,
+                  int image_width, int samples_per_pixel, double fps) {
+    Camera_Path path;
+    if (!path.load(path_file)) {
+        return -1;
+    }
+
+    // Standard output carries the frames when piping, so messages, including those of
+    // the scene as it loads, go to standard error
+    Frame_Writer writer(output);
+    std::streambuf* cout_buffer = std::cout.rdbuf();
+    if (writer.to_Pipe()) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+    std::ostream& log = std::cout;
+
+    Scene scene;
+    if (!build_Scene(scene_name, scene)) {
+        std::cerr << "Unknown scene: " << scene_name << std::endl;
+        std::cout.rdbuf(cout_buffer);
+        return -1;
+    }
+    scene.wait_Until_Loaded();
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    if (image_width > 0) { cam.image_width = image_width; }
+    if (samples_per_pixel > 0) { cam.samples_per_pixel = samples_per_pixel; }
+
+    Animation_Settings settings;
+    settings.fps = fps;
+    settings.num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    log << "Rendering " << path.keys.size() << " keyframes over " << path.end_Time() - path.start_Time()
+        << " s at " << fps << " frames/s, " << cam.image_width << "x" << int(cam.image_width / cam.aspect_ratio)
+        << " px, " << cam.samples_per_pixel << " spp, " << settings.num_threads << " threads\n";
+
+    Animation_Stats stats;
+    bool complete = render_Animation(scene, cam, path, settings, writer, log, stats);
+    stats.print(log, settings.num_threads);
+    std::cout.rdbuf(cout_buffer);
+    return complete ? 0 : -1;
+}
+
+// Renders a high-quality frame of width x height pixels straight into a tiled image file,
+// without an image in memory or a window, for images too large for either. Reports the
+// peak memory of the process and how fast the tiles were written
+int run_Tiled_Render(const std::string& output, const std::string& scene_name, int width, int height,
+                     int samples_per_pixel) {
+    if (width <= 0 || height <= 0) {
+        std::cerr << "Image size must be positive" << std::endl;
+        return -1;
+    }
+    Scene scene;
+    if (!build_Scene(scene_name, scene)) {
+        std::cerr << "Unknown scene: " << scene_name << std::endl;
+        return -1;
+    }
+    scene.wait_Until_Loaded();
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    // A little wider than width / height, so the image height rounds down to 'height' exactly.
+    // The viewport follows the pixel counts, so the image isn't stretched
+    cam.aspect_ratio = width / (height + 0.5);
+    cam.image_width = width;
+    if (samples_per_pixel > 0) { cam.samples_per_pixel = samples_per_pixel; }
+    const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    // Room for a few tiles per render thread: enough to ride out slow writes, while the
+    // tiles in memory stay independent of the image size
+    Tiled_Image_Writer writer;
+    if (!writer.open(output, width, height, cam.tile_size, 4 * num_threads)) {
+        std::cerr << "Could not create " << output << std::endl;
+        return -1;
+    }
+    std::cout << "Rendering " << width << "x" << height << " px, " << cam.samples_per_pixel << " spp, "
+              << num_threads << " threads, to " << output << "\n";
+
+    auto start = std::chrono::steady_clock::now();
+    cam.render_Streamed(scene, num_threads, [&](const Tile& tile, const Color* tile_pixels) {
+        writer.write_Tile(tile, tile_pixels);
+    });
+    bool written = writer.close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Tiled_Image_Stats stats = writer.get_Stats();
+    std::cout << "Rendered in " << seconds << " s, wrote " << stats.tiles << " tiles, " << stats.bytes / 1048576.0
+              << " MB in " << stats.write_seconds << " s of writing (" << stats.write_Bandwidth() / 1048576.0
+              << " MB/s)\n"
+              << "  Write queue peaked at " << stats.peak_queued << " tiles, render threads waited "
+              << stats.stall_seconds << " s for it; peak memory " << peak_Resident_Bytes() / 1048576.0 << " MB\n";
+    if (!written) {
+        std::cerr << "Could not write " << output << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Runs this process as a render service on the local port until a client stops it
+// num_threads and cache_mb of 0 keep the defaults
+int run_Service(int port, int num_threads, int cache_mb) {
+    Render_Service service;
+    if (num_threads > 0) { service.num_threads = num_threads; }
+    if (cache_mb > 0) { service.scenes.budget_bytes = size_t(cache_mb) << 20; }
+    if (!service.listen(port)) {
+        std::cerr << "Render service could not listen on port " << port << std::endl;
+        return -1;
+    }
+    std::cout << "Render service listening on 127.0.0.1:" << service.port() << " with "
+              << service.num_threads << " render threads" << std::endl;
+    service.run();
+    service.print_Stats(std::cout);
+    return 0;
+}
+
+// Renders a high-quality frame of the scene on the render service at the local port and
+// writes it to 'output' as a PPM file
+int run_Submit(int port, const std::string& output, const std::string& scene_name,
+               int image_width, int samples_per_pixel, int priority) {
+    Render_Service_Client client;
+    if (!client.connect(port)) {
+        std::cerr << "Could not connect to the render service on port " << port << std::endl;
+        return -1;
+    }
+
+    Camera cam;
+    cam.init_High_Quality_Settings();
+    if (image_width > 0) { cam.image_width = image_width; }
+    if (samples_per_pixel > 0) { cam.samples_per_pixel = samples_per_pixel; }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t job_id = client.submit(scene_name, Frame_Settings::from_Camera(cam, 0), priority);
+    Job_Result result;
+    std::vector<Color> image;
+    if (job_id == 0 || !client.next_Result(result, image)) {
+        std::cerr << "Lost the connection to the render service" << std::endl;
+        return -1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (result.status != JOB_DONE) {
+        std::cerr << "Job " << job_id << (result.status == JOB_CANCELLED ? " was cancelled" : " failed") << std::endl;
+        return -1;
+    }
+    write_PPM(output, image, result.width, result.height);
+    std::cout << "Job " << job_id << ": " << result.width << "x" << result.height << " px in " << seconds
+              << " s (queued " << result.queue_ms << " ms, rendered " << result.render_ms << " ms), wrote "
+              << output << "\n";
+    return 0;
+}
+
+// Sends a command to the render service at the local port: stats prints its metrics,
+// cancel cancels a job by id, stop shuts the service down
+int run_Service_Command(int port, const std::string& command, uint32_t job_id) {
+    Render_Service_Client client;
+    if (!client.connect(port)) {
+        std::cerr << "Could not connect to the render service on port " << port << std::endl;
+        return -1;
+    }
+    if (command == "stats") {
+        std::string text;
+        if (!client.stats(text)) {
+            return -1;
+        }
+        std::cout << text;
+        return 0;
+    }
+    if (command == "cancel" && job_id > 0) {
+        return client.cancel(job_id) ? 0 : -1;
+    }
+    if (command == "stop") {
+        return client.shutdown() ? 0 : -1;
+    }
+    std::cerr << "Unknown render service command: " << command << std::endl;
+    return -1;
+}
+
 int main(int argc, char* argv[]) {
 
+    // Options
+    std::string checkpoint_file;        // File the render is checkpointed to, none if empty
+    double checkpoint_interval = 60.0;  // Seconds between checkpoints
+    std::string resume_file;            // Checkpoint to resume the render from, none if empty
+    int resume_samples_per_pixel = 0;   // Raises the sample target of a resumed render if set
+    std::string scene_name = "default"; // Scene to render, see build_Scene
+    double target_frame_ms = 16;        // Frame time real-time rendering adjusts its settings to, 0 for fixed settings
+    int interleave = 1;                 // Real-time rendering traces 1 in interleave pixels per frame
+    double fps = 24;                    // Frames per second of camera path animations
+    std::string trace_file;             // Chrome trace of the run is written here, no tracing if empty
+    bool irradiance_cache = false;      // Interactive renders interpolate diffuse indirect light from a cache
+    bool path_guiding = false;          // Single high-quality renders guide paths towards the light they learned
+    bool caustics = false;              // Interactive renders gather caustics from photons
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_file = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                checkpoint_interval = std::stod(argv[++i]);
+            }
+        }
+        else if (arg == "--scene" && i + 1 < argc) {
+            scene_name = argv[++i];
+        }
+        else if (arg == "--target-ms" && i + 1 < argc) {
+            target_frame_ms = std::stod(argv[++i]);
+        }
+        else if (arg == "--interleave" && i + 1 < argc) {
+            interleave = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "--fps" && i + 1 < argc) {
+            fps = std::stod(argv[++i]);
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+        }
+        else if (arg == "--irradiance-cache") {
+            irradiance_cache = true;
+        }
+        else if (arg == "--path-guiding") {
+            path_guiding = true;
+        }
+        else if (arg == "--caustics") {
+            caustics = true;
+        }
+        else if (arg == "--resume" && i + 1 < argc) {
+            resume_file = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                resume_samples_per_pixel = std::stoi(argv[++i]);
+            }
+        }
+    }
+
+    // Records a timeline of the run until main returns
+    Trace_Session trace_session(trace_file);
+    Trace::set_Thread_Name("main");
+
+    // Headless command line modes
+    std::string mode = (argc > 1) ? argv[1] : "";
+    if (mode == "--worker" && argc > 4) {
+        return run_Worker(argv[2], std::stoi(argv[3]), std::stoi(argv[4]), scene_name);
+    }
+    if (mode == "--bench" && argc > 2) {
+        if (!run_Benchmark(argv[2])) {
+            std::cerr << "Unknown benchmark: " << argv[2] << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    if (mode == "--animate" && argc > 2) {
+        if (fps <= 0) {
+            std::cerr << "--fps must be positive\n";
+            return -1;
+        }
+        // "-" as the output is standard output, not an option
+        bool has_output = argc > 3 && (argv[3][0] != '-' || std::string(argv[3]) == "-");
+        return run_Animation(argv[2], has_output ? argv[3] : "frame_%04d.ppm", scene_name,
+            (has_output && argc > 4 && argv[4][0] != '-') ? std::stoi(argv[4]) : 0,
+            (has_output && argc > 5 && argv[5][0] != '-') ? std::stoi(argv[5]) : 0, fps);
+    }
+    if (mode == "--render-tiled" && argc > 4) {
+        return run_Tiled_Render(argv[2], scene_name, std::stoi(argv[3]), std::stoi(argv[4]),
+            (argc > 5 && argv[5][0] != '-') ? std::stoi(argv[5]) : 0);
+    }
+    if (mode == "--serve" && argc > 2) {
+        return run_Service(std::stoi(argv[2]),
+            (argc > 3 && argv[3][0] != '-') ? std::stoi(argv[3]) : 0,
+            (argc > 4 && argv[4][0] != '-') ? std::stoi(argv[4]) : 0);
+    }
+    if (mode == "--submit" && argc > 3) {
+        return run_Submit(std::stoi(argv[2]), argv[3], scene_name,
+            (argc > 4 && argv[4][0] != '-') ? std::stoi(argv[4]) : 0,
+            (argc > 5 && argv[5][0] != '-') ? std::stoi(argv[5]) : 0,
+            (argc > 6 && argv[6][0] != '-') ? std::stoi(argv[6]) : 0);
+    }
+    if (mode == "--service" && argc > 3) {
+        return run_Service_Command(std::stoi(argv[2]), argv[3], (argc > 4) ? uint32_t(std::stoul(argv[4])) : 0);
+    }
+    if (mode == "--distributed" && argc > 2) {
+        return run_Distributed(argv[0], scene_name, std::stoi(argv[2]),
+            (argc > 3 && argv[3][0] != '-') ? std::stoi(argv[3]) : 0,
+            (argc > 4 && argv[4][0] != '-') ? std::stoi(argv[4]) : 0);
+    }
+
     std::cout << "Starting program...\n";
 
     // Worldspace setup
-    Hittable_List world;
-
-    auto material_ground = make_shared<Lambertian>(Color(0.9, 0.8, 0.3));
-    auto material_center = make_shared<Lambertian>(Color(0.1, 0.5, 0.5));
-    auto material_left   = make_shared<Dielectric>(1.50);
-    auto material_bubble = make_shared<Dielectric>(1.00 / 1.50);
-    auto material_right  = make_shared<Metal>(Color(0.8, 0.8, 0.9), 0.05);
-
-    world.add(make_shared<Sphere>(Point3( 0.0, -50.5, 1.0), 50.0, material_ground));
-    //world.add(make_shared<Sphere>(Point3(-1.0,    0.0, -1.0),   0.5, material_left));
-    world.add(make_shared<Sphere>(Point3(-1.0,    0.0, 1.0),   0.4, material_bubble));
-    world.add(make_shared<Sphere>(Point3( 1.0,    0.0, 1.0),   0.5, material_right));
-    
-    // Environment map object for lighting
-    EnvironmentMap envmap("..\\include\\hdr\\texturify_court.jpg");
+    Scene scene;
+    if (!build_Scene(scene_name, scene)) {
+        std::cerr << "Unknown scene: " << scene_name << std::endl;
+        return -1;
+    }
 
     std::string input;
     bool real_time_rendering = true;
 
-    std::cout << "\nCamera Settings\n'Real-time' rendering (interactive): Enter A\n"
-            << "Single high-quality render with settings: Enter B\n"
-            << "Input: ";
+    // Create and initialize Camera object settings
+    Camera cam;
+
+    // Accumulated samples of a single high-quality render
+    Film film;
 
-    std::cin >> input;
-    while (input.compare("A") && input.compare("B")) {
-        std::cout << "\nInvalid input"
-                << "\n'Real-time' rendering (interactive): Enter A:\nSingle render with settings: Enter B\n"
+    // Scales the real-time settings to hold the target frame time
+    Frame_Time_Controller frame_controller;
+    frame_controller.target_ms = target_frame_ms;
+
+    // Resuming continues a single high-quality render with the settings stored in the checkpoint
+    if (!resume_file.empty()) {
+        Frame_Settings settings;
+        if (!load_Checkpoint(resume_file, settings, film)) {
+            std::cerr << "Could not read checkpoint: " << resume_file << std::endl;
+            return -1;
+        }
+        settings.apply_To(cam);
+        if (resume_samples_per_pixel > 0) {
+            cam.samples_per_pixel = resume_samples_per_pixel;
+        }
+        if (checkpoint_file.empty()) {
+            checkpoint_file = resume_file;
+        }
+        std::cout << "Resuming render from " << resume_file << "\n";
+        input = "B";
+    }
+    else {
+        std::cout << "\nCamera Settings\n'Real-time' rendering (interactive): Enter A\n"
+                << "Single high-quality render with settings: Enter B\n"
                 << "Input: ";
+
         std::cin >> input;
+        while (input.compare("A") && input.compare("B")) {
+            std::cout << "\nInvalid input"
+                    << "\n'Real-time' rendering (interactive): Enter A:\nSingle render with settings: Enter B\n"
+                    << "Input: ";
+            std::cin >> input;
+        }
     }
-    
-    // Create and initialize Camera object settings
-    Camera cam;
 
     if (input == "A") {
         cam.init_Real_Time_Settings();
+        cam.interleave = interleave;
+        frame_controller.start(cam);
         std::cout << "Starting rendering...\n"
                 << "Use WASD to move camera position,\nuse arrow keys to move camera direction\n"
                 << "Hit ESCAPE to close the program.\n";
     }
     else if (input == "B") {
         real_time_rendering = false;
-        cam.init_Custom_Settings();
+        if (resume_file.empty()) {
+            cam.init_Custom_Settings();
+        }
 
         std::cout << "Hit ESCAPE to close the program.\n";
     }
 
+    // The cache is kept for the whole session, so later real-time frames reuse its records
+    if (irradiance_cache) {
+        cam.irradiance_cache = make_shared<Irradiance_Cache>();
+    }
+
+    // The guide learns over the passes of a progressive render, real-time frames are too short
+    if (path_guiding && !real_time_rendering) {
+        cam.path_guide = make_shared<Path_Guide>();
+    }
+
+    // Real-time frames keep the photons of one pass, progressive renders trace new ones every pass
+    if (caustics) {
+        cam.caustics = make_shared<Caustic_Photons>();
+    }
+
+    // Periodically save single high-quality renders so they can be resumed
+    Checkpointer checkpointer(film, checkpoint_file, checkpoint_interval);
+    if (!real_time_rendering && !checkpoint_file.empty()) {
+        checkpointer.start(Frame_Settings::from_Camera(cam, 0));
+        std::cout << "Checkpointing to " << checkpoint_file << " every " << checkpoint_interval << " seconds\n";
+    }
+
 
     std::cout << "Starting SDL...\n";
 
@@ -87,17 +538,16 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
-    SDL_Window* window = SDL_CreateWindow("Simple Ray Tracer",
-        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-        cam.image_width, int(cam.image_width/cam.aspect_ratio), SDL_WINDOW_SHOWN);
-
-    if (!window) {
-        std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+    // Real-time frames are scaled up to a window of fixed size, whatever their resolution
+    const int window_width = real_time_rendering ? frame_controller.output_width : cam.image_width;
+    Display display;
+    if (!display.open("Simple Ray Tracer", window_width, int(window_width/cam.aspect_ratio))) {
         return -1;
     }
 
-    SDL_Surface* surface = SDL_GetWindowSurface(window);
-    SDL_RaiseWindow(window);
+    // Image shown in the window. Render threads draw into it, and only this thread
+    // uploads it to the window
+    Frame_Buffer frame;
 
     // Thread object
     // This allows the main thread to remain responsive for SDL events
@@ -109,13 +559,26 @@ int main(int argc, char* argv[]) {
 
     while (!quit) {
         // Start a new render if needed
-        if (!render_thread.joinable() && should_render.load()) {
-            render_thread = std::thread(&Camera::render, &cam, std::ref(world),
-                surface, &envmap, std::ref(rendering_complete));
+        // Real-time rendering starts at once with a placeholder sky for assets still loading,
+        // a single high-quality render waits for them so every sample sees the same scene
+        if (!render_thread.joinable() && should_render.load() && (real_time_rendering || scene.assets_Ready())) {
+            if (real_time_rendering) {
+                render_thread = std::thread([&]() {
+                    Trace::set_Thread_Name("frame");
+                    cam.render(scene, frame, rendering_complete);
+                });
+            }
+            else {
+                render_thread = std::thread([&]() {
+                    Trace::set_Thread_Name("frame");
+                    cam.render_Progressive(scene, frame, film, should_render, rendering_complete);
+                });
+            }
         }
 
         // Handle SDL events
         while (SDL_PollEvent(&e) != 0) {
+            display.handle_Event(e);
             if (e.type == SDL_QUIT) {
                 quit = true;
                 should_render.store(false);
@@ -124,6 +587,7 @@ int main(int argc, char* argv[]) {
                 switch(e.key.keysym.sym){
                     case SDLK_ESCAPE:
                         quit = true;
+                        should_render.store(false);
                         break;
                     // Change camera position
                     case SDLK_a:
@@ -163,8 +627,9 @@ int main(int argc, char* argv[]) {
         }
 
         // Update the window periodically
-        // This ensures the user sees the progress of the render
-        SDL_UpdateWindowSurface(window);
+        // This ensures the user sees the progress of the render. Only the pixels that
+        // changed are uploaded, and nothing is drawn while the image is unchanged
+        display.present(frame);
         SDL_Delay(16);  // Cap at roughly 60 FPS for smooth updates
 
         // Check if rendering is complete
@@ -180,6 +645,10 @@ int main(int argc, char* argv[]) {
                 should_render.store(false);
             } 
             else {
+                // Adjust the settings of the next frame to the time this one took
+                frame_controller.frame_Done(cam.last_render_ms, cam);
+                display.set_Title("Simple Ray Tracer - " + frame_controller.status(cam));
+
                 // Reset for next frame in real-time mode
                 rendering_complete.store(false);
                 should_render.store(true);
@@ -194,10 +663,28 @@ int main(int argc, char* argv[]) {
         render_thread.join();
     }
 
+    // Save the final state of an interrupted or finished render
+    checkpointer.stop();
+
     std::cout << "Rendering complete.\n";
+    if (scene.envmap) {
+        scene.envmap->print_Cache_Stats(std::cout);
+    }
+    if (scene.streamed) {
+        scene.streamed->print_Stats(std::cout);
+    }
+    if (cam.irradiance_cache) {
+        cam.irradiance_cache->print_Stats(std::cout);
+    }
+    if (cam.path_guide) {
+        cam.path_guide->print_Stats(std::cout);
+    }
+    if (cam.caustics) {
+        cam.caustics->print_Stats(std::cout);
+    }
 
     // Clean up
-    SDL_DestroyWindow(window);
+    display.close();
     SDL_Quit();
 
     return 0;